@@ -0,0 +1,691 @@
+/*
+ * apex_cache.c
+ * Contains the timing model of the APEX memory hierarchy, set associative
+ * caches backed by a fixed latency main memory
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cache.h"
+#include "apex_macros.h"
+
+int
+initCache(Cache *cache, const char *name, int size, int assoc, int line_size,
+          int hit_latency, int replacement, int write_back, int write_allocate,
+          Cache *next, Main_Memory *memory)
+{
+    cache->name = name;
+    cache->assoc = assoc;
+    cache->line_size = line_size;
+    cache->sets = size / (assoc * line_size);
+    cache->hit_latency = hit_latency;
+    cache->replacement = replacement;
+    cache->write_back = write_back;
+    cache->write_allocate = write_allocate;
+    cache->fill_counter = 0;
+    cache->rand_state = 0x2545f491;
+    cache->next = next;
+    cache->memory = memory;
+    cache->read_hits = 0;
+    cache->read_misses = 0;
+    cache->write_hits = 0;
+    cache->write_misses = 0;
+    cache->writebacks = 0;
+    cache->mshrs = NULL;
+    cache->num_mshrs = 0;
+    cache->mshr_merges = 0;
+    cache->mshr_full = 0;
+    cache->prefetches = 0;
+    cache->prefetch_useful = 0;
+    cache->prefetch_late = 0;
+    cache->peers = NULL;
+    cache->num_peers = 0;
+    cache->invalidations = 0;
+    cache->upgrades = 0;
+    cache->transfers = 0;
+
+    cache->lines = calloc(cache->sets * cache->assoc, sizeof(Cache_Line));
+    if (!cache->lines)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void
+freeCache(Cache *cache)
+{
+    free(cache->lines);
+    cache->lines = NULL;
+    free(cache->mshrs);
+    cache->mshrs = NULL;
+}
+
+/* Gives the cache count MSHRs so it keeps serving hits while misses are
+ * outstanding, see accessCacheNonBlocking */
+int
+initMSHRs(Cache *cache, int count)
+{
+    cache->mshrs = calloc(count, sizeof(MSHR));
+    if (!cache->mshrs)
+    {
+        return FALSE;
+    }
+    cache->num_mshrs = count;
+    return TRUE;
+}
+
+/* Reads a line from the level below, returns its latency */
+static int
+readNextLevel(Cache *cache, unsigned int address)
+{
+    if (cache->next)
+    {
+        return accessCache(cache->next, address, FALSE);
+    }
+    cache->memory->reads++;
+    return cache->memory->latency;
+}
+
+/* Writes go through a write buffer, so they cost no latency on the access
+ * that caused them */
+static void
+writeNextLevel(Cache *cache, unsigned int address)
+{
+    if (cache->next)
+    {
+        accessCache(cache->next, address, TRUE);
+        return;
+    }
+    cache->memory->writes++;
+}
+
+/* MESI snoop of the other caches holding the line of address. A write
+ * invalidates their copies, a read leaves them shared, and a modified copy
+ * is written back on the way. Returns the most exclusive state found,
+ * MESI_INVALID when no peer had the line */
+static int
+snoopPeers(Cache *cache, unsigned int address, int is_write)
+{
+    int found = MESI_INVALID;
+    for (int i = 0; i < cache->num_peers; i++)
+    {
+        Cache *peer = cache->peers[i];
+        if (peer == cache)
+        {
+            continue;
+        }
+        unsigned int block = address / peer->line_size;
+        int set_index = block % peer->sets;
+        unsigned int tag = block / peer->sets;
+        Cache_Line *set = &peer->lines[set_index * peer->assoc];
+        for (int way = 0; way < peer->assoc; way++)
+        {
+            if (!set[way].valid || set[way].tag != tag)
+            {
+                continue;
+            }
+            if (set[way].state > found)
+            {
+                found = set[way].state;
+            }
+            if (set[way].dirty)
+            {
+                peer->writebacks++;
+                writeNextLevel(peer, block * peer->line_size);
+                set[way].dirty = FALSE;
+            }
+            if (is_write)
+            {
+                set[way].valid = FALSE;
+                set[way].state = MESI_INVALID;
+                peer->invalidations++;
+            }
+            else
+            {
+                set[way].state = MESI_SHARED;
+            }
+        }
+    }
+    return found;
+}
+
+static void
+touchCacheLine(Cache *cache, Cache_Line *set, int way)
+{
+    int age = set[way].lru_age;
+    for (int i = 0; i < cache->assoc; i++)
+    {
+        if (set[i].valid && set[i].lru_age < age)
+        {
+            set[i].lru_age++;
+        }
+    }
+    set[way].lru_age = 0;
+}
+
+static int
+getVictimWay(Cache *cache, Cache_Line *set)
+{
+    int victim = 0;
+    for (int i = 0; i < cache->assoc; i++)
+    {
+        if (!set[i].valid)
+        {
+            return i;
+        }
+    }
+
+    switch (cache->replacement)
+    {
+    case REPL_FIFO:
+    {
+        for (int i = 1; i < cache->assoc; i++)
+        {
+            if (set[i].fill_order < set[victim].fill_order)
+            {
+                victim = i;
+            }
+        }
+        break;
+    }
+
+    case REPL_RANDOM:
+    {
+        /* xorshift keeps runs reproducible */
+        cache->rand_state ^= cache->rand_state << 13;
+        cache->rand_state ^= cache->rand_state >> 17;
+        cache->rand_state ^= cache->rand_state << 5;
+        victim = cache->rand_state % cache->assoc;
+        break;
+    }
+
+    default:
+    {
+        for (int i = 1; i < cache->assoc; i++)
+        {
+            if (set[i].lru_age > set[victim].lru_age)
+            {
+                victim = i;
+            }
+        }
+        break;
+    }
+    }
+    return victim;
+}
+
+/* Brings the line holding address into a way of the set in MESI state,
+ * writing back a dirty victim. Returns the latency of reading the line from
+ * below, or of the transfer when a peer supplies it */
+static int
+fillLine(Cache *cache, Cache_Line *set, int set_index, unsigned int tag, unsigned int address, int dirty,
+         int state, int from_peer)
+{
+    int way = getVictimWay(cache, set);
+    if (set[way].valid && set[way].dirty)
+    {
+        unsigned int victim_block = set[way].tag * cache->sets + set_index;
+        cache->writebacks++;
+        writeNextLevel(cache, victim_block * cache->line_size);
+    }
+
+    int latency = from_peer ? COHERENCE_LATENCY : readNextLevel(cache, address);
+
+    if (!set[way].valid)
+    {
+        /* A fresh way starts out as the oldest so the touch ages the rest */
+        set[way].lru_age = cache->assoc;
+    }
+    set[way].valid = TRUE;
+    set[way].tag = tag;
+    set[way].dirty = dirty;
+    set[way].state = state;
+    set[way].prefetched = FALSE;
+    set[way].fill_order = cache->fill_counter++;
+    touchCacheLine(cache, set, way);
+    return latency;
+}
+
+/* Looks the address up, fills on a miss and returns the access latency in
+ * cycles including the time spent in the lower levels */
+int
+accessCache(Cache *cache, unsigned int address, int is_write)
+{
+    unsigned int block = address / cache->line_size;
+    int set_index = block % cache->sets;
+    unsigned int tag = block / cache->sets;
+    Cache_Line *set = &cache->lines[set_index * cache->assoc];
+
+    for (int way = 0; way < cache->assoc; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            touchCacheLine(cache, set, way);
+            if (set[way].prefetched)
+            {
+                set[way].prefetched = FALSE;
+                cache->prefetch_useful++;
+            }
+            int latency = cache->hit_latency;
+            if (is_write && cache->num_peers && set[way].state == MESI_SHARED)
+            {
+                snoopPeers(cache, address, TRUE);
+                cache->upgrades++;
+                latency += COHERENCE_LATENCY;
+            }
+            if (is_write)
+            {
+                set[way].state = MESI_MODIFIED;
+                cache->write_hits++;
+                if (cache->write_back)
+                {
+                    set[way].dirty = TRUE;
+                }
+                else
+                {
+                    writeNextLevel(cache, address);
+                }
+            }
+            else
+            {
+                cache->read_hits++;
+            }
+            return latency;
+        }
+    }
+
+    int peer_state = cache->num_peers ? snoopPeers(cache, address, is_write) : MESI_INVALID;
+    if (is_write)
+    {
+        cache->write_misses++;
+        if (!cache->write_allocate)
+        {
+            writeNextLevel(cache, address);
+            return cache->hit_latency;
+        }
+    }
+    else
+    {
+        cache->read_misses++;
+    }
+
+    int state = is_write ? MESI_MODIFIED : (peer_state != MESI_INVALID ? MESI_SHARED : MESI_EXCLUSIVE);
+    if (peer_state == MESI_MODIFIED)
+    {
+        cache->transfers++;
+    }
+    int latency = cache->hit_latency + fillLine(cache, set, set_index, tag, address, is_write && cache->write_back,
+                                                state, peer_state == MESI_MODIFIED);
+
+    if (is_write && !cache->write_back)
+    {
+        writeNextLevel(cache, address);
+    }
+    return latency;
+}
+
+/* Lookup for a cache with MSHRs at cycle now. An access to a line that is
+ * still being filled merges into its MSHR and completes with the fill,
+ * hits are served under outstanding misses, and a new miss needs a free
+ * MSHR. Returns the latency, or -1 when the miss has to be retried */
+int
+accessCacheNonBlocking(Cache *cache, unsigned int address, int is_write, int now)
+{
+    unsigned int block = address / cache->line_size;
+    MSHR *free_mshr = NULL;
+    for (int i = 0; i < cache->num_mshrs; i++)
+    {
+        MSHR *mshr = &cache->mshrs[i];
+        if (mshr->valid && mshr->ready_cycle <= now)
+        {
+            mshr->valid = FALSE;
+        }
+        if (!mshr->valid)
+        {
+            free_mshr = free_mshr ? free_mshr : mshr;
+            continue;
+        }
+        if (mshr->block == block)
+        {
+            /* The line is already allocated, the access itself is a hit */
+            cache->mshr_merges++;
+            if (mshr->is_prefetch)
+            {
+                cache->prefetch_late++;
+                mshr->is_prefetch = FALSE;
+            }
+            accessCache(cache, address, is_write);
+            return mshr->ready_cycle - now;
+        }
+    }
+
+    unsigned int set_index = block % cache->sets;
+    unsigned int tag = block / cache->sets;
+    Cache_Line *set = &cache->lines[set_index * cache->assoc];
+    int hit = FALSE;
+    for (int way = 0; way < cache->assoc; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            hit = TRUE;
+        }
+    }
+    if (!hit && !free_mshr)
+    {
+        cache->mshr_full++;
+        return -1;
+    }
+
+    int latency = accessCache(cache, address, is_write);
+    if (!hit && latency > cache->hit_latency)
+    {
+        free_mshr->valid = TRUE;
+        free_mshr->block = block;
+        free_mshr->ready_cycle = now + latency;
+        free_mshr->is_prefetch = FALSE;
+    }
+    return latency;
+}
+
+/* Starts filling the line holding address without a demand access. Lines
+ * already present or in flight are left alone, and a prefetch never waits
+ * for an MSHR. Returns TRUE when a fill was started */
+int
+prefetchCache(Cache *cache, unsigned int address, int now)
+{
+    unsigned int block = address / cache->line_size;
+    unsigned int set_index = block % cache->sets;
+    unsigned int tag = block / cache->sets;
+    Cache_Line *set = &cache->lines[set_index * cache->assoc];
+    MSHR *free_mshr = NULL;
+
+    for (int way = 0; way < cache->assoc; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            return FALSE;
+        }
+    }
+    for (int i = 0; i < cache->num_mshrs; i++)
+    {
+        MSHR *mshr = &cache->mshrs[i];
+        if (mshr->valid && mshr->ready_cycle > now)
+        {
+            if (mshr->block == block)
+            {
+                return FALSE;
+            }
+        }
+        else if (!free_mshr)
+        {
+            free_mshr = mshr;
+        }
+    }
+    if (!free_mshr)
+    {
+        return FALSE;
+    }
+
+    int peer_state = cache->num_peers ? snoopPeers(cache, address, FALSE) : MESI_INVALID;
+    if (peer_state == MESI_MODIFIED)
+    {
+        cache->transfers++;
+    }
+    int latency = cache->hit_latency + fillLine(cache, set, set_index, tag, address, FALSE,
+                                                peer_state != MESI_INVALID ? MESI_SHARED : MESI_EXCLUSIVE,
+                                                peer_state == MESI_MODIFIED);
+    /* Marked so its first demand access counts as a useful prefetch */
+    for (int way = 0; way < cache->assoc; way++)
+    {
+        if (set[way].valid && set[way].tag == tag)
+        {
+            set[way].prefetched = TRUE;
+        }
+    }
+    free_mshr->valid = TRUE;
+    free_mshr->block = block;
+    free_mshr->ready_cycle = now + latency;
+    free_mshr->is_prefetch = TRUE;
+    cache->prefetches++;
+    return TRUE;
+}
+
+void
+initPrefetcher(Prefetcher *prefetcher, int type, int degree)
+{
+    memset(prefetcher, 0, sizeof(Prefetcher));
+    prefetcher->type = type;
+    prefetcher->degree = degree;
+}
+
+static void
+prefetchBlock(Cache *cache, long block, int now)
+{
+    if (block < 0 || block * cache->line_size > 0xffffffffL)
+    {
+        return;
+    }
+    prefetchCache(cache, block * cache->line_size, now);
+}
+
+/* Reference prediction table indexed by the PC of the memory instruction.
+ * Once the same stride repeats, the next degree addresses are prefetched */
+static void
+observeStride(Prefetcher *prefetcher, Cache *cache, int pc_value, unsigned int address, int now)
+{
+    Stride_Entry *entry = &prefetcher->stride[(pc_value / 4) % STRIDE_TABLE_SIZE];
+    if (!entry->valid || entry->pc_value != pc_value)
+    {
+        entry->valid = TRUE;
+        entry->pc_value = pc_value;
+        entry->last_address = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+    int stride = (int)(address - entry->last_address);
+    if (stride != 0 && stride == entry->stride)
+    {
+        if (entry->confidence < 3)
+        {
+            entry->confidence++;
+        }
+    }
+    else
+    {
+        if (entry->confidence > 0)
+        {
+            entry->confidence--;
+        }
+        else
+        {
+            entry->stride = stride;
+        }
+    }
+    entry->last_address = address;
+    if (entry->confidence < 2)
+    {
+        return;
+    }
+    for (int i = 1; i <= prefetcher->degree; i++)
+    {
+        long target = (long)address + (long)entry->stride * i;
+        if (target >= 0)
+        {
+            prefetchBlock(cache, target / cache->line_size, now);
+        }
+    }
+}
+
+/* Tracks sequential line streams regardless of PC. A stream that moved to
+ * the next line in the same direction twice keeps STREAM_DISTANCE lines
+ * fetched ahead of itself */
+static void
+observeStream(Prefetcher *prefetcher, Cache *cache, unsigned int address, int now)
+{
+    unsigned int block = address / cache->line_size;
+    Stream_Entry *match = NULL;
+    Stream_Entry *victim = &prefetcher->stream[0];
+
+    for (int i = 0; i < STREAM_TABLE_SIZE; i++)
+    {
+        Stream_Entry *stream = &prefetcher->stream[i];
+        if (stream->valid && (block == stream->last_block || block == stream->last_block + 1 ||
+                              block + 1 == stream->last_block))
+        {
+            match = stream;
+            break;
+        }
+        if (!stream->valid || (victim->valid && stream->lru_age > victim->lru_age))
+        {
+            victim = stream;
+        }
+    }
+    for (int i = 0; i < STREAM_TABLE_SIZE; i++)
+    {
+        prefetcher->stream[i].lru_age++;
+    }
+
+    if (!match)
+    {
+        victim->valid = TRUE;
+        victim->last_block = block;
+        victim->direction = 0;
+        victim->confidence = 0;
+        victim->lru_age = 0;
+        return;
+    }
+    match->lru_age = 0;
+    if (block == match->last_block)
+    {
+        return;
+    }
+    int direction = block > match->last_block ? 1 : -1;
+    if (direction == match->direction)
+    {
+        if (match->confidence < 3)
+        {
+            match->confidence++;
+        }
+    }
+    else
+    {
+        match->direction = direction;
+        match->confidence = 1;
+    }
+    match->last_block = block;
+    if (match->confidence < 2)
+    {
+        return;
+    }
+    for (int i = 1; i <= STREAM_DISTANCE; i++)
+    {
+        prefetchBlock(cache, (long)block + direction * i, now);
+    }
+}
+
+/* Called for every demand access the cache sees */
+void
+observePrefetcher(Prefetcher *prefetcher, Cache *cache, int pc_value, unsigned int address, int now)
+{
+    switch (prefetcher->type)
+    {
+    case PREFETCH_NEXT_LINE:
+    {
+        long block = address / cache->line_size;
+        for (int i = 1; i <= prefetcher->degree; i++)
+        {
+            prefetchBlock(cache, block + i, now);
+        }
+        break;
+    }
+
+    case PREFETCH_STRIDE:
+    {
+        observeStride(prefetcher, cache, pc_value, address, now);
+        break;
+    }
+
+    case PREFETCH_STREAM:
+    {
+        observeStream(prefetcher, cache, address, now);
+        break;
+    }
+
+    default:
+    {
+        break;
+    }
+    }
+}
+
+const char *
+getPrefetcherName(int type)
+{
+    switch (type)
+    {
+    case PREFETCH_NEXT_LINE:
+        return "next-line";
+    case PREFETCH_STRIDE:
+        return "stride";
+    case PREFETCH_STREAM:
+        return "stream";
+    default:
+        return "none";
+    }
+}
+
+/* Accuracy is the share of prefetches that were demanded, coverage the share
+ * of would-be misses a prefetch removed, timeliness the share of useful
+ * prefetches that completed before their demand */
+void
+printPrefetchStats(const Prefetcher *prefetcher, const Cache *cache)
+{
+    int misses = cache->read_misses + cache->write_misses;
+    int useful = cache->prefetch_useful;
+    printf("PF   : %s issued = %d useful = %d late = %d accuracy = %.2f%% coverage = %.2f%% timeliness = %.2f%%\n",
+           getPrefetcherName(prefetcher->type), cache->prefetches, useful, cache->prefetch_late,
+           cache->prefetches ? (100.0 * useful) / cache->prefetches : 0.0,
+           (useful + misses) ? (100.0 * useful) / (useful + misses) : 0.0,
+           useful ? (100.0 * (useful - cache->prefetch_late)) / useful : 0.0);
+}
+
+int
+getOutstandingMisses(const Cache *cache, int now)
+{
+    int count = 0;
+    for (int i = 0; i < cache->num_mshrs; i++)
+    {
+        if (cache->mshrs[i].valid && cache->mshrs[i].ready_cycle > now)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+void
+printCacheStats(const Cache *cache)
+{
+    int hits = cache->read_hits + cache->write_hits;
+    int misses = cache->read_misses + cache->write_misses;
+    int accesses = hits + misses;
+
+    printf("%-4s: accesses = %d hits = %d misses = %d (reads %d/%d, writes %d/%d hit/miss) writebacks = %d miss rate = %.2f%%\n",
+           cache->name, accesses, hits, misses, cache->read_hits, cache->read_misses,
+           cache->write_hits, cache->write_misses, cache->writebacks,
+           accesses ? (100.0 * misses) / accesses : 0.0);
+}
+
+void
+printCoherenceStats(const Cache *cache)
+{
+    printf("%-4s: invalidations = %d upgrades = %d cache to cache transfers = %d\n",
+           cache->name, cache->invalidations, cache->upgrades, cache->transfers);
+}
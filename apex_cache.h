@@ -0,0 +1,122 @@
+/*
+ * apex_cache.h
+ * Contains APEX memory hierarchy declarations
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+
+#include "apex_macros.h"
+
+/* Fixed latency main memory behind the last cache level */
+typedef struct Main_Memory
+{
+    int latency;
+    int reads;
+    int writes;
+}Main_Memory;
+
+typedef struct Cache_Line
+{
+    int valid;
+    int dirty;
+    unsigned int tag;
+    int lru_age; //0 for the most recently used way of the set
+    int fill_order;
+    int prefetched; //brought in by a prefetch and not demanded yet
+    int state; //MESI_ state of a valid line, kept once the cache has peers
+}Cache_Line;
+
+/* Miss status holding register, tracks one line being filled */
+typedef struct MSHR
+{
+    int valid;
+    unsigned int block;
+    int ready_cycle; //cycle the fill completes
+    int is_prefetch;
+}MSHR;
+
+/* Timing model of one cache level. Data itself stays in data_memory, the
+ * cache only tracks tags to decide the latency of an access */
+typedef struct Cache
+{
+    const char *name;
+    int sets;
+    int assoc;
+    int line_size;
+    int hit_latency;
+    int replacement;
+    int write_back;
+    int write_allocate;
+    Cache_Line *lines;
+    int fill_counter;
+    unsigned int rand_state;
+    struct Cache *next;  /* Next level, NULL when backed by main memory */
+    Main_Memory *memory;
+    MSHR *mshrs;         /* NULL for a cache that blocks on every miss */
+    int num_mshrs;
+    struct Cache **peers; /* Caches kept coherent with this one, may include itself */
+    int num_peers;
+
+    int read_hits;
+    int read_misses;
+    int write_hits;
+    int write_misses;
+    int writebacks;
+    int mshr_merges;     /* Secondary misses to a line already being filled */
+    int mshr_full;       /* Misses turned away because every MSHR was busy */
+    int prefetches;      /* Prefetch fills issued into this cache */
+    int prefetch_useful; /* Prefetched lines later demanded */
+    int prefetch_late;   /* ... of which the demand arrived before the fill */
+    int invalidations;   /* Lines lost to a write by a peer */
+    int upgrades;        /* Writes to a shared line that invalidated the peers */
+    int transfers;       /* Misses served by a peer holding the line modified */
+}Cache;
+
+typedef struct Stride_Entry
+{
+    int valid;
+    int pc_value;
+    unsigned int last_address;
+    int stride;
+    int confidence;
+}Stride_Entry;
+
+typedef struct Stream_Entry
+{
+    int valid;
+    unsigned int last_block;
+    int direction; //+1 or -1 once trained, 0 before
+    int confidence;
+    int lru_age;
+}Stream_Entry;
+
+/* Watches the demand address stream of a cache and fills lines ahead of it.
+ * type is one of the PREFETCH_ kinds */
+typedef struct Prefetcher
+{
+    int type;
+    int degree;
+    Stride_Entry stride[STRIDE_TABLE_SIZE];
+    Stream_Entry stream[STREAM_TABLE_SIZE];
+}Prefetcher;
+
+int initCache(Cache *cache, const char *name, int size, int assoc, int line_size,
+              int hit_latency, int replacement, int write_back, int write_allocate,
+              Cache *next, Main_Memory *memory);
+void freeCache(Cache *cache);
+int initMSHRs(Cache *cache, int count);
+int accessCache(Cache *cache, unsigned int address, int is_write);
+int accessCacheNonBlocking(Cache *cache, unsigned int address, int is_write, int now);
+int getOutstandingMisses(const Cache *cache, int now);
+int prefetchCache(Cache *cache, unsigned int address, int now);
+void initPrefetcher(Prefetcher *prefetcher, int type, int degree);
+void observePrefetcher(Prefetcher *prefetcher, Cache *cache, int pc_value, unsigned int address, int now);
+const char *getPrefetcherName(int type);
+void printPrefetchStats(const Prefetcher *prefetcher, const Cache *cache);
+void printCacheStats(const Cache *cache);
+void printCoherenceStats(const Cache *cache);
+#endif
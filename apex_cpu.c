@@ -10,8 +10,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "file_parser.c"
+#include "apex_cache.c"
+#include "apex_memory.c"
 #include "apex_cpu.h"
 #include "apex_macros.h"
 
@@ -24,32 +30,35 @@ get_code_memory_index_from_pc(const int pc)
 {
     return (pc - 4000) / 4;
 }
-static void
-enqueueFreeList(int index, APEX_CPU *cpu)
-{
-    cpu->pr.tail = (++cpu->pr.tail) % 15;
-    cpu->pr.PR_File[cpu->pr.tail].free = index;
-    cpu->pr.PR_File[cpu->pr.tail].reg_invalid = 1;
-}
 
-static void reverse_insert_pr(int index, APEX_CPU *cpu)
+/* Caches and data memory are shared with the other cores of a multi-core
+ * run, every access to them holds the coherence bus */
+static void lock_bus(APEX_CPU *cpu)
 {
-    int head = cpu->pr.head;
-    if (head == 0)
+    if (cpu->bus_lock)
     {
-        head = PR_FILE_SIZE - 1;
+        pthread_mutex_lock(cpu->bus_lock);
     }
-    else
+}
+
+static void unlock_bus(APEX_CPU *cpu)
+{
+    if (cpu->bus_lock)
     {
-        head = head - 1;
+        pthread_mutex_unlock(cpu->bus_lock);
     }
-    cpu->pr.head = head;
-    cpu->pr.PR_File[cpu->pr.head].free = index;
+}
+static void
+setPRFree(int index, APEX_CPU *cpu)
+{
+    cpu->pr.free_map[index / 64] |= 1ULL << (index % 64);
+    cpu->pr.reg_invalid[index] = 1;
+    cpu->pr.count++;
 }
 
 static int isPRF_empty(APEX_CPU *cpu)
 {
-    if (cpu->pr.tail == -1 && cpu->pr.head == -1)
+    if (cpu->pr.count == 0)
     {
         return 1;
     }
@@ -62,41 +71,349 @@ static int getFreeRegFromPR(APEX_CPU *cpu)
     {
         return -1;
     }
-    int index = cpu->pr.head;
+    /* Find first set over the bitmap, count > 0 guarantees a set bit */
+    int word = 0;
+    while (!cpu->pr.free_map[word])
+    {
+        word++;
+    }
+    int free = word * 64 + __builtin_ctzll(cpu->pr.free_map[word]);
+    cpu->pr.free_map[word] &= cpu->pr.free_map[word] - 1;
+    cpu->pr.count--;
+
+    cpu->thread->ren.pr_map[word] |= 1ULL << (free % 64);
+    cpu->thread->ren.pr_refs[free] = 1;
+
+    cpu->pr.reg_invalid[free] = 1;
+    cpu->pr.is_const[free] = 0;
+    cpu->pr.cc_reg[free] = -1;
+    cpu->pr.thread[free] = cpu->tid;
+    return free;
+}
+
+/* Adds reg to state as a register named by one mapping */
+static void holdPR(Rename_State *state, int reg)
+{
+    state->pr_map[reg / 64] |= 1ULL << (reg % 64);
+    state->pr_refs[reg] = 1;
+}
+
+/* Adds CC register cc to state as named by one mapping */
+static void holdCC(Rename_State *state, int cc)
+{
+    state->cc_map |= 1u << cc;
+    state->cc_refs[cc] = 1;
+}
+
+/* Drops one reference to reg from state, TRUE when it was the last */
+static int dropPRRef(Rename_State *state, int reg)
+{
+    if (--state->pr_refs[reg] > 0)
+    {
+        return FALSE;
+    }
+    state->pr_map[reg / 64] &= ~(1ULL << (reg % 64));
+    return TRUE;
+}
 
-    if (cpu->DR1.opcode == OPCODE_ADD || cpu->DR1.opcode == OPCODE_SUB || cpu->DR1.opcode == OPCODE_DIV || cpu->DR1.opcode == OPCODE_MUL || cpu->DR1.opcode == OPCODE_ADDL || cpu->DR1.opcode == OPCODE_SUBL || cpu->DR1.opcode == OPCODE_CMP)
+/* Drops one reference to CC register cc from state, TRUE when it was the
+ * last */
+static int dropCCRef(Rename_State *state, int cc)
+{
+    if (--state->cc_refs[cc] > 0)
     {
-        cpu->prev_cc = cpu->pr.PR_File[index].free;
+        return FALSE;
     }
+    state->cc_map &= ~(1u << cc);
+    return TRUE;
+}
 
-    if (cpu->pr.tail == cpu->pr.head)
+/* Only a retirement drops a mapping, so every checkpoint the thread still
+ * has is younger and counts it too. dropRef is applied to each of them */
+static void dropCheckpointRefs(APEX_CPU *cpu, int (*dropRef)(Rename_State *, int), int reg)
+{
+    BIS *bis = &cpu->thread->bis;
+    LSQ *lsq = &cpu->thread->lsq;
+    for (int i = bis->head; i != -1; i = i == bis->tail ? -1 : (i + 1) % BIS_SIZE)
     {
-        cpu->pr.tail = -1;
-        cpu->pr.head = -1;
+        dropRef(&bis->entry[i]->ren, reg);
     }
-    else
+    for (int i = lsq->head; i != -1; i = i == lsq->tail ? -1 : (i + 1) % LSQ_SIZE)
+    {
+        if (lsq->lost[i])
+        {
+            dropRef(&lsq->ren[i], reg);
+        }
+    }
+}
+
+/* Slot of value in the thread's constant map */
+static int *getConstSlot(APEX_CPU *cpu, int value)
+{
+    return &cpu->thread->const_map[(unsigned)value & (CONST_MAP_SIZE - 1)];
+}
+
+/* Drops one mapping of a physical register, it goes back to the free list
+ * with its last one */
+static void releasePR(APEX_CPU *cpu, int reg)
+{
+    dropCheckpointRefs(cpu, dropPRRef, reg);
+    if (!dropPRRef(&cpu->thread->ren, reg))
+    {
+        return;
+    }
+    if (cpu->pr.is_const[reg] && *getConstSlot(cpu, cpu->pr.phy_Reg[reg]) == reg)
+    {
+        *getConstSlot(cpu, cpu->pr.phy_Reg[reg]) = -1;
+    }
+    cpu->pr.is_const[reg] = 0;
+    setPRFree(reg, cpu);
+}
+
+static int isCCFree(APEX_CPU *cpu, int cc)
+{
+    return (cpu->ccf.free_map >> cc) & 1;
+}
+
+static void setCCFree(APEX_CPU *cpu, int cc)
+{
+    cpu->ccf.free_map |= 1u << cc;
+    cpu->ccf.reg[cc].invalid = 1;
+    cpu->ccf.count++;
+}
+
+/* Drops one mapping of a CC register. The pinned ones are never freed */
+static void releaseCC(APEX_CPU *cpu, int cc)
+{
+    if (cc == CC_ZERO_CLEAR || cc == CC_ZERO_SET)
+    {
+        return;
+    }
+    dropCheckpointRefs(cpu, dropCCRef, cc);
+    if (dropCCRef(&cpu->thread->ren, cc))
+    {
+        setCCFree(cpu, cc);
+    }
+}
+
+/* DIV result. Dividing by zero gives 0 and INT_MIN / -1 wraps, the same in
+ * the detailed and the functional model, so a wrong path DIV is harmless */
+static int divide(int dividend, int divisor)
+{
+    if (divisor == 0)
+    {
+        return 0;
+    }
+    if (divisor == -1)
+    {
+        return (int)(0u - (unsigned)dividend);
+    }
+    return dividend / divisor;
+}
+
+static int writes_flags(int opcode)
+{
+    return opcode == OPCODE_ADD || opcode == OPCODE_SUB || opcode == OPCODE_MUL || opcode == OPCODE_DIV ||
+           opcode == OPCODE_ADDL || opcode == OPCODE_SUBL || opcode == OPCODE_CMP;
+}
+
+/* Whether opcode reads memory into a register, FADD included */
+static int is_load_opcode(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_LDR || opcode == OPCODE_FADD;
+}
+
+/* Whether an IQ entry of opcode has a physical register as dest. Loads
+ * have their LSQ index there */
+static int writes_register(int opcode)
+{
+    return opcode == OPCODE_ADD || opcode == OPCODE_SUB || opcode == OPCODE_MUL || opcode == OPCODE_DIV ||
+           opcode == OPCODE_AND || opcode == OPCODE_OR || opcode == OPCODE_XOR || opcode == OPCODE_ADDL ||
+           opcode == OPCODE_SUBL || opcode == OPCODE_MOVC || opcode == OPCODE_JAL;
+}
+
+/* Makes cc the flags producer for DR1 and everything renamed after it */
+static void mapFlags(APEX_CPU *cpu, int cc)
+{
+    cpu->thread->DR1.cc_pd = cc;
+    cpu->thread->DR1.cc_prev = cpu->thread->prev_cc;
+    cpu->thread->prev_cc = cc;
+}
+
+/* Renames the flags written by DR1 onto a new CC register. reg is the data
+ * register the flags describe, -1 for CMP. The caller checked one is free */
+static void renameFlags(APEX_CPU *cpu, int reg)
+{
+    int cc = __builtin_ctz(cpu->ccf.free_map);
+    cpu->ccf.free_map &= cpu->ccf.free_map - 1;
+    cpu->ccf.count--;
+    cpu->thread->ren.cc_map |= 1u << cc;
+    cpu->thread->ren.cc_refs[cc] = 1;
+    cpu->ccf.reg[cc].invalid = 1;
+    cpu->ccf.reg[cc].alloc_seq = cpu->ccf.alloc_seq++;
+    cpu->ccf.reg[cc].thread = cpu->tid;
+    mapFlags(cpu, cc);
+    if (reg != -1)
+    {
+        cpu->pr.cc_reg[reg] = cc;
+        cpu->pr.cc_seq[reg] = cpu->ccf.reg[cc].alloc_seq;
+    }
+}
+
+/* CC register still holding the flags of data register reg, -1 once it has
+ * been released or was never there */
+static int getLiveFlags(APEX_CPU *cpu, int reg)
+{
+    int cc = cpu->pr.cc_reg[reg];
+    if (cc == -1 || isCCFree(cpu, cc) || cpu->ccf.reg[cc].alloc_seq != cpu->pr.cc_seq[reg])
     {
-        cpu->pr.head = (++cpu->pr.head) % 15;
+        return -1;
     }
+    return cc;
+}
 
-    int free = cpu->pr.PR_File[index].free;
+/* Takes the destination registers of DR1: a PR, plus a CC register when it
+ * writes the flags. Nothing is taken and -1 returned if either file is dry */
+static int getFreeDestRegs(APEX_CPU *cpu)
+{
+    int flags = writes_flags(cpu->thread->DR1.opcode);
+    if (isPRF_empty(cpu) || (flags && cpu->ccf.count == 0))
+    {
+        return -1;
+    }
+    int free = getFreeRegFromPR(cpu);
+    if (flags)
+    {
+        renameFlags(cpu, free);
+    }
+    return free;
+}
 
-    cpu->pr.PR_File[free].reg_invalid = 1;
+/* Returns a register holding value with a new reference taken, allocating
+ * and writing one when the constant map has no live register for it. -1 if
+ * none is free. Only the thread's own constants are shared, another
+ * thread's recovery could free them. A recovery frees registers without
+ * clearing their slots, so a hit is checked against the register */
+static int getConstantPR(APEX_CPU *cpu, int value)
+{
+    int *slot = getConstSlot(cpu, value);
+    int reg = *slot;
+    if (reg != -1 && cpu->pr.is_const[reg] && cpu->pr.phy_Reg[reg] == value && cpu->pr.thread[reg] == cpu->tid &&
+        cpu->thread->ren.pr_refs[reg] > 0)
+    {
+        cpu->thread->ren.pr_refs[reg]++;
+        return reg;
+    }
+    int free = getFreeRegFromPR(cpu);
+    if (free != -1)
+    {
+        *slot = free;
+        cpu->pr.phy_Reg[free] = value;
+        cpu->pr.cc_reg[free] = value == 0 ? CC_ZERO_SET : CC_ZERO_CLEAR;
+        cpu->pr.cc_seq[free] = 0;
+        cpu->pr.is_const[free] = 1;
+        cpu->pr.reg_invalid[free] = 0;
+    }
     return free;
 }
 
+/* Resolves MOVC, zero idioms and register copies in DR1 by pointing rd at a
+ * register that already holds the result. The instruction then needs no IQ
+ * entry, FU or bus cycle. Returns 0 when DR1 has to rename it normally */
+static int eliminateInRename(APEX_CPU *cpu)
+{
+    CPU_Stage *stage = &cpu->thread->DR1;
+    int reg;
+
+    switch (stage->opcode)
+    {
+    case OPCODE_MOVC:
+    {
+        reg = getConstantPR(cpu, stage->imm);
+        cpu->consts_eliminated += reg != -1;
+        break;
+    }
+    case OPCODE_SUB:
+    case OPCODE_XOR:
+    {
+        if (stage->rs1 != stage->rs2)
+        {
+            return 0;
+        }
+        reg = getConstantPR(cpu, 0);
+        if (reg != -1 && stage->opcode == OPCODE_SUB)
+        {
+            mapFlags(cpu, CC_ZERO_SET);
+        }
+        cpu->zero_idioms_eliminated += reg != -1;
+        break;
+    }
+    case OPCODE_ADDL:
+    case OPCODE_SUBL:
+    {
+        /* The copy also produces the flags, so the source has to still have
+         * a CC register describing its own value */
+        reg = cpu->thread->rt.reg[stage->rs1];
+        int cc = getLiveFlags(cpu, reg);
+        if (stage->imm != 0 || cc == -1)
+        {
+            return 0;
+        }
+        cpu->thread->ren.pr_refs[reg]++;
+        cpu->thread->ren.cc_refs[cc]++;
+        mapFlags(cpu, cc);
+        cpu->copies_eliminated++;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    stage->stall = reg == -1;
+    if (!stage->stall)
+    {
+        stage->prev_phy_reg = cpu->thread->rt.reg[stage->rd];
+        stage->dest_arch_reg = stage->rd;
+        cpu->thread->rt.reg[stage->rd] = reg;
+        stage->pd = reg;
+        stage->eliminated = 1;
+    }
+    return 1;
+}
+
+/* Puts back a rename table, flags mapping and the registers held with them,
+ * saved at dispatch, once the ROB has been cut back to the checkpoint.
+ * Registers the thread took since then go back to the free lists a bitmap
+ * word at a time. The checkpoint saw every retirement since, see
+ * dropCheckpointRefs */
+static void restoreRenameState(APEX_CPU *cpu, const int *rt, int cc, const Rename_State *state)
+{
+    memcpy(cpu->thread->rt.reg, rt, sizeof(cpu->thread->rt.reg));
+    cpu->thread->prev_cc = cc;
+    for (int i = 0; i < PR_MAP_WORDS; i++)
+    {
+        unsigned long long freed = cpu->thread->ren.pr_map[i] & ~state->pr_map[i];
+        cpu->pr.free_map[i] |= freed;
+        cpu->pr.count += __builtin_popcountll(freed);
+    }
+    unsigned int freed = cpu->thread->ren.cc_map & ~state->cc_map;
+    cpu->ccf.free_map |= freed;
+    cpu->ccf.count += __builtin_popcount(freed);
+    memcpy(&cpu->thread->ren, state, sizeof(cpu->thread->ren));
+}
+
 static void setSrcRegWithPR(int r1, int r2, int r3, APEX_CPU *cpu)
 {
     if (r1 != -1)
     {
-        cpu->DR1.ps1 = cpu->rt.reg[cpu->DR1.rs1];
+        cpu->thread->DR1.ps1 = cpu->thread->rt.reg[cpu->thread->DR1.rs1];
     }
     if (r2 != -1)
     {
-        cpu->DR1.ps2 = cpu->rt.reg[cpu->DR1.rs2];
+        cpu->thread->DR1.ps2 = cpu->thread->rt.reg[cpu->thread->DR1.rs2];
         if (r3 != -1)
         {
-            cpu->DR1.ps3 = cpu->rt.reg[cpu->DR1.rs3];
+            cpu->thread->DR1.ps3 = cpu->thread->rt.reg[cpu->thread->DR1.rs3];
         }
     }
 }
@@ -114,6 +431,7 @@ print_instruction(const CPU_Stage *stage)
     case OPCODE_XOR:
     case OPCODE_CMP:
     case OPCODE_LDR:
+    case OPCODE_FADD:
     {
         printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
                stage->rs2);
@@ -135,12 +453,19 @@ print_instruction(const CPU_Stage *stage)
     case OPCODE_LOAD:
     case OPCODE_ADDL:
     case OPCODE_SUBL:
+    case OPCODE_JAL:
     {
         printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
                stage->imm);
         break;
     }
 
+    case OPCODE_RET:
+    {
+        printf("%s,R%d ", stage->opcode_str, stage->rs1);
+        break;
+    }
+
     case OPCODE_STORE:
     {
         printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
@@ -169,6 +494,7 @@ print_instruction(const CPU_Stage *stage)
     }
 
     case OPCODE_NOP:
+    case OPCODE_FENCE:
     {
         printf("%s", stage->opcode_str);
         break;
@@ -279,7 +605,7 @@ print_reg_file(const APEX_CPU *cpu)
 
     for (int i = 0; i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-2d[%-3d] ", i, cpu->regs[i]);
+        printf("R%-2d[%-3d] ", i, cpu->thread->regs[i]);
     }
 
     printf("\n");
@@ -291,7 +617,7 @@ void print_rename_table(APEX_CPU *cpu)
 
     for (int i = 0; i < REG_FILE_SIZE; ++i)
     {
-        printf("R%-2d[%-3d] ", i, cpu->rt.reg[i]);
+        printf("R%-2d[%-3d] ", i, cpu->thread->rt.reg[i]);
     }
 
     printf("\n");
@@ -301,16 +627,13 @@ void print_physical_reg_file(APEX_CPU *cpu)
 {
     printf("\n-----------------------\n%s\n-----------------------\n", "Physical Register File:");
 
-    for (int i = 0; i < PR_FILE_SIZE / 2; ++i)
-    {
-        printf("P%-3d[%-3d] ", i, cpu->pr.PR_File[i].phy_Reg);
-    }
-
-    printf("\n");
-
-    for (int i = PR_FILE_SIZE / 2; i < PR_FILE_SIZE; ++i)
+    for (int i = 0; i < PR_FILE_SIZE; ++i)
     {
-        printf("P%-3d[%-3d] ", i, cpu->pr.PR_File[i].phy_Reg);
+        printf("P%-3d[%-3d] ", i, cpu->pr.phy_Reg[i]);
+        if (i % 16 == 15)
+        {
+            printf("\n");
+        }
     }
 
     printf("\n");
@@ -354,162 +677,973 @@ void print_fwd_bus(APEX_CPU *cpu)
     }
 }
 
-/*
- * Fetch Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
- */
+/* Prints the end of simulation statistics */
 static void
-APEX_fetch(APEX_CPU *cpu)
+print_stats(const APEX_CPU *cpu)
 {
-    APEX_Instruction *current_ins;
-    if (cpu->waitingForBranch)
+    printf("\n----------\n%s\n----------\n", "Statistics:");
+    printf("Cycles = %d Instructions = %d IPC = %.3f\n", cpu->clock, cpu->insn_completed,
+           cpu->clock ? (double)cpu->insn_completed / cpu->clock : 0.0);
+    printf("Retire: width = %d cycles retiring", COMMIT_WIDTH);
+    for (int i = 0; i <= COMMIT_WIDTH; i++)
     {
-        strcpy(cpu->fetch.opcode_str, "NOP");
-        cpu->fetch.opcode = OPCODE_NOP;
-        cpu->fetch.pc = 0;
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Fetch", &cpu->fetch);
-        }
-        cpu->DR1 = cpu->fetch;
+        printf(" %d:%d(%.1f%%)", i, cpu->retire_histogram[i],
+               cpu->clock ? 100.0 * cpu->retire_histogram[i] / cpu->clock : 0.0);
+    }
+    printf("\n");
+    printf("Branch: checkpoint recoveries = %d\n", cpu->branch_recoveries);
+    printf("Issue: select policy = %s issued = %d average dispatch to issue = %.2f average ready to issue = %.2f max ready to issue = %d\n",
+           getSelectPolicyName(cpu->select_policy), cpu->insn_issued,
+           cpu->insn_issued ? (double)cpu->issue_wait_cycles / cpu->insn_issued : 0.0,
+           cpu->insn_issued ? (double)cpu->ready_wait_cycles / cpu->insn_issued : 0.0, cpu->max_ready_wait);
+    printf("Rename: physical registers = %d CC registers = %d blocked cycles = %d eliminated constants = %d zero idioms = %d copies = %d\n",
+           PR_FILE_SIZE, CC_FILE_SIZE, cpu->rename_blocked_cycles, cpu->consts_eliminated, cpu->zero_idioms_eliminated,
+           cpu->copies_eliminated);
+    printf("Fusion: CMP+branch pairs = %d ADDL+LOAD pairs = %d fusion rate = %.2f%%\n", cpu->cmp_branches_fused,
+           cpu->addl_loads_fused,
+           cpu->insn_completed ? 200.0 * (cpu->cmp_branches_fused + cpu->addl_loads_fused) / cpu->insn_completed : 0.0);
+    printf("Fetch: I-cache stall cycles = %d decode starved cycles = %d\n", cpu->icache_stall_cycles,
+           cpu->decode_starved_cycles);
+    printf("LSD  : loops streamed = %d micro-ops streamed = %d fetch bypassed cycles = %d\n", cpu->loops_streamed,
+           cpu->lsd_uops, cpu->lsd_cycles);
+    printf("Trace: built = %d lookups = %d hits = %d hit rate = %.2f%% average delivered width = %.2f of %d\n",
+           cpu->traces_built, cpu->trace_lookups, cpu->trace_hits,
+           cpu->trace_lookups ? 100.0 * cpu->trace_hits / cpu->trace_lookups : 0.0,
+           cpu->trace_hits ? (double)cpu->trace_insns / cpu->trace_hits : 0.0, TRACE_LENGTH);
+    printf("LSQ  : loads executed = %d forwarded from stores = %d speculated past unknown stores = %d ordering violations = %d\n",
+           cpu->loads_executed, cpu->loads_forwarded, cpu->loads_speculated, cpu->ordering_violations);
+    printf("SB   : loads forwarded = %d full cycles = %d\n", cpu->loads_buffer_forwarded, cpu->store_buffer_full_cycles);
+    printf("Value prediction: predicted loads = %d mispredicted = %d accuracy = %.2f%%\n", cpu->values_predicted,
+           cpu->value_mispredictions,
+           cpu->values_predicted ? 100.0 * (cpu->values_predicted - cpu->value_mispredictions) / cpu->values_predicted : 0.0);
+    printf("Sync : atomics = %d fences = %d fence stall cycles = %d\n", cpu->atomics_executed, cpu->fences,
+           cpu->fence_stall_cycles);
+    for (int i = 0; i < cpu->num_threads && cpu->num_threads > 1; i++)
+    {
+        const APEX_Thread *thread = &cpu->threads[i];
+        printf("Thread %d: fetch policy = %s instructions = %d IPC = %.3f front end cycles = %d average IQ entries = %.2f branch recoveries = %d\n",
+               i, getFetchPolicyName(cpu->fetch_policy), thread->insn_completed,
+               cpu->clock ? (double)thread->insn_completed / cpu->clock : 0.0, thread->front_end_cycles,
+               cpu->clock ? (double)thread->iq_occupancy / cpu->clock : 0.0, thread->branch_recoveries);
+    }
+    printCacheStats(&cpu->l1i);
+    printCacheStats(&cpu->l1d);
+    printPrefetchStats(&cpu->prefetcher, &cpu->l1d);
+    printf("MSHR : count = %d merged misses = %d full = %d average outstanding misses = %.3f\n", cpu->l1d.num_mshrs,
+           cpu->l1d.mshr_merges, cpu->l1d.mshr_full, cpu->clock ? (double)cpu->outstanding_misses / cpu->clock : 0.0);
+    if (cpu->bus_lock)
+    {
+        /* The shared levels are reported once for the whole system */
+        printCoherenceStats(&cpu->l1d);
         return;
     }
-    if (cpu->fetch.has_insn)
+    printCacheStats(&cpu->l2);
+    printf("MEM : reads = %d writes = %d latency = %d pages = %d\n", cpu->memory.reads, cpu->memory.writes,
+           cpu->memory.latency, cpu->data_memory->pages);
+}
+
+/*----------------------------------Fetch buffer utilities start-----------------------------------*/
+
+int isFetchBufferFull(APEX_CPU *cpu)
+{
+    return cpu->thread->fetch_buffer.count == FETCH_BUFFER_SIZE;
+}
+
+void addFetchBufferEntry(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int tail = (cpu->thread->fetch_buffer.head + cpu->thread->fetch_buffer.count) % FETCH_BUFFER_SIZE;
+    cpu->thread->fetch_buffer.entry[tail] = *stage;
+    cpu->thread->fetch_buffer.count++;
+}
+
+/* Drops every fetched instruction that has not reached DR1 yet, along with
+ * a pending I-cache miss. A HALT among them was on the wrong path, so fetch
+ * is enabled again. Fetch is being redirected, so a loop being recorded or
+ * streamed is dropped as well */
+void flush_fetch_buffer(APEX_CPU *cpu)
+{
+    cpu->thread->fetch_buffer.head = 0;
+    cpu->thread->fetch_buffer.count = 0;
+    cpu->thread->fetch_buffer.fusion_wait = 0;
+    cpu->thread->icache_cycles = 0;
+    cpu->thread->fetch.has_insn = TRUE;
+    cpu->thread->loop_buffer.state = LSD_IDLE;
+}
+
+/* FUSE_ kind of first followed by an instruction with next_opcode reading
+ * next_rs1. ADDL #0 is left to copy elimination */
+static int get_fusion_kind(const CPU_Stage *first, int next_opcode, int next_rs1)
+{
+    if (first->opcode == OPCODE_CMP && (next_opcode == OPCODE_BZ || next_opcode == OPCODE_BNZ))
+    {
+        return FUSE_CMP_BRANCH;
+    }
+    if (first->opcode == OPCODE_ADDL && first->imm != 0 && next_opcode == OPCODE_LOAD && next_rs1 == first->rd)
     {
-        /* This fetches new branch target instruction from next cycle */
-        if (cpu->fetch_from_next_cycle == TRUE)
-        {
-            cpu->fetch_from_next_cycle = FALSE;
-            if (ENABLE_DEBUG_MESSAGES)
-            {
-                print_stage_empty_state("Fetch", &cpu->fetch);
-            }
-            /* Skip this cycle*/
-            return;
-        }
+        return FUSE_ADDL_LOAD;
+    }
+    return FUSE_NONE;
+}
+
+/* A fusion head alone in the buffer waits one cycle for its partner when
+ * predecode of the next sequential instruction says the two fuse. Decode
+ * loses nothing since the pair then goes through as one */
+static int await_fusion_partner(APEX_CPU *cpu)
+{
+    const CPU_Stage *head = &cpu->thread->fetch_buffer.entry[cpu->thread->fetch_buffer.head];
+    int index = get_code_memory_index_from_pc(head->pc + 4);
 
-        /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
-        cpu->fetch.waitingForBranch = cpu->waitingForBranch;
+    if (cpu->thread->fetch_buffer.fusion_wait || cpu->thread->fetch_buffer.count != 1 || !cpu->thread->fetch.has_insn ||
+        cpu->thread->pc != head->pc + 4 || index >= cpu->thread->code_memory_size)
+    {
+        return 0;
+    }
+    const APEX_Instruction *next = &cpu->thread->code_memory[index];
+    cpu->thread->fetch_buffer.fusion_wait = get_fusion_kind(head, next->opcode, next->rs1) != FUSE_NONE;
+    return cpu->thread->fetch_buffer.fusion_wait;
+}
+
+/* Folds the next buffered instruction into DR1 when the two form a fusible
+ * pair. A CMP feeding the BZ/BNZ right after it becomes the branch with the
+ * CMP's sources, an ADDL bumping the base of the LOAD right after it becomes
+ * the LOAD carrying the ADDL */
+static void fuse_fetch_buffer(APEX_CPU *cpu)
+{
+    CPU_Stage *first = &cpu->thread->DR1;
+    CPU_Stage *next = &cpu->thread->fetch_buffer.entry[cpu->thread->fetch_buffer.head];
+
+    if (cpu->thread->fetch_buffer.count == 0 || next->pc != first->pc + 4)
+    {
+        return;
+    }
+    switch (get_fusion_kind(first, next->opcode, next->rs1))
+    {
+    case FUSE_CMP_BRANCH:
+    {
+        int rs1 = first->rs1;
+        int rs2 = first->rs2;
+        *first = *next;
+        first->rs1 = rs1;
+        first->rs2 = rs2;
+        first->fused = FUSE_CMP_BRANCH;
+        break;
+    }
+    case FUSE_ADDL_LOAD:
+    {
+        first->fused_rd = first->rd;
+        first->fused_imm = first->imm;
+        first->opcode = next->opcode;
+        strcpy(first->opcode_str, next->opcode_str);
+        first->rd = next->rd;
+        first->imm = next->imm;
+        first->fused = FUSE_ADDL_LOAD;
+        break;
+    }
+    default:
+        return;
+    }
+    first->has_insn = TRUE;
+    cpu->thread->fetch_buffer.head = (cpu->thread->fetch_buffer.head + 1) % FETCH_BUFFER_SIZE;
+    cpu->thread->fetch_buffer.count--;
+}
+
+/*----------------------------------Loop stream detector utilities start-----------------------------------*/
+
+/* PC of the first instruction a micro-op carries, and the PC fetch went to
+ * after it */
+static int first_pc(const CPU_Stage *stage)
+{
+    return stage->fused == FUSE_CMP_BRANCH ? stage->pc - 4 : stage->pc;
+}
+
+static int next_pc(const CPU_Stage *stage)
+{
+    if (stage->branch_prediction)
+    {
+        return stage->pred_target;
+    }
+    return stage->fused == FUSE_ADDL_LOAD ? stage->pc + 8 : stage->pc + 4;
+}
+
+/* Whether stage is a BZ/BNZ predicted taken back to the top of a body that
+ * fits the loop buffer */
+static int is_loop_branch(const CPU_Stage *stage)
+{
+    return (stage->opcode == OPCODE_BZ || stage->opcode == OPCODE_BNZ) && stage->branch_prediction &&
+           stage->imm < 0 && stage->pred_target == stage->pc + stage->imm && -stage->imm / 4 < LOOP_BUFFER_SIZE;
+}
 
-        /* Index into code memory using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.rs3 = current_ins->rs3;
-        cpu->fetch.imm = current_ins->imm;
+/* Watches the micro-ops DR1 gets from the fetch buffer. A loop branch starts
+ * recording at its target, and the loop is locked in once the same branch
+ * comes round again with the body recorded along the path fetch took. BZ/BNZ
+ * inside the body keep the prediction fetch gave them. What fetch brought
+ * in past the loop branch is then dropped, the loop buffer supplies it */
+static void detect_loop(APEX_CPU *cpu)
+{
+    Loop_Buffer *lb = &cpu->thread->loop_buffer;
+    const CPU_Stage *stage = &cpu->thread->DR1;
 
-        /* Update PC for next instruction */
-        int i = 0;
-        int flag = 1;
-        while (i < BTB_SIZE)
+    if (lb->state == LSD_RECORDING)
+    {
+        int expected = lb->count ? next_pc(&lb->entry[lb->count - 1]) : lb->start_pc;
+        if (first_pc(stage) != expected || lb->count == LOOP_BUFFER_SIZE)
         {
-            BTB_Entry *entry = cpu->btb.entry[i];
-            if (entry == NULL)
-            {
-                i++;
-                continue;
-            }
-            if (entry->pc_value == cpu->pc && entry->prediction == 1)
-            {
-                cpu->pc = entry->target_address;
-                cpu->fetch.branch_prediction = 1;
-                flag = 0;
-                break;
-            }
-            else
-            {
-                cpu->fetch.branch_prediction = 0;
-            }
-            i++;
+            lb->state = LSD_IDLE;
         }
-        if (flag)
+        else if (stage->pc == lb->branch_pc)
         {
-            cpu->fetch.branch_prediction = 0;
-            cpu->pc += 4;
+            lb->state = LSD_IDLE;
+            if (is_loop_branch(stage) && stage->pred_target == lb->start_pc)
+            {
+                lb->entry[lb->count++] = *stage;
+                flush_fetch_buffer(cpu);
+                restoreFetchHistory(cpu, stage->path_hist, stage->ras_top, stage->ras_count, stage->ras_value);
+                updatePathHistory(cpu, lb->start_pc);
+                cpu->thread->pc = lb->start_pc;
+                lb->next = 0;
+                lb->state = LSD_STREAMING;
+                cpu->loops_streamed++;
+                return;
+            }
         }
-        int arr_index = (cpu->fetch.pc / 4) - 1000;
-        cpu->pe[arr_index].pc_value = cpu->fetch.pc;
-        cpu->pe[arr_index].is_exec = 0;
-        /* Copy data from fetch latch to decode latch*/
-        cpu->DR1 = cpu->fetch;
-
-        if (ENABLE_DEBUG_MESSAGES)
+        else if (stage->opcode == OPCODE_JUMP || stage->opcode == OPCODE_JAL || stage->opcode == OPCODE_RET ||
+                 stage->opcode == OPCODE_HALT)
         {
-            print_stage_content("Fetch", &cpu->fetch);
+            lb->state = LSD_IDLE;
         }
-
-        /* Stop fetching new instructions if HALT is fetched */
-        if (cpu->fetch.opcode == OPCODE_HALT)
+        else
         {
-            cpu->fetch.has_insn = FALSE;
+            lb->entry[lb->count++] = *stage;
+            return;
         }
     }
-    else
+    if (lb->state == LSD_IDLE && is_loop_branch(stage))
     {
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_empty_state("Fetch", &cpu->fetch);
-        }
+        lb->start_pc = stage->pred_target;
+        lb->branch_pc = stage->pc;
+        lb->count = 0;
+        lb->state = LSD_RECORDING;
     }
 }
 
-/*
- * Decode Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
- */
-static void
-APEX_DR1(APEX_CPU *cpu)
+/* Feeds DR1 from the locked loop in place of fetch, so neither the I-cache
+ * nor the BTB is looked up. Branches go out with their recorded prediction
+ * and the fetch history they would have had, a wrong one is recovered like
+ * any mispredict and the redirect ends the streaming */
+static void stream_loop_buffer(APEX_CPU *cpu)
 {
-    if (cpu->DR1.has_insn)
+    Loop_Buffer *lb = &cpu->thread->loop_buffer;
+
+    cpu->lsd_cycles++;
+    if (ENABLE_DEBUG_MESSAGES)
     {
-        switch (cpu->DR1.opcode)
+        print_stage_empty_state("Fetch(LSD)", &cpu->thread->fetch);
+    }
+    if (cpu->thread->DR1.has_insn)
+    {
+        return;
+    }
+    cpu->thread->DR1 = lb->entry[lb->next];
+    cpu->thread->DR1.path_hist = cpu->thread->path_hist;
+    cpu->thread->DR1.itp_index = getITPIndex(cpu, cpu->thread->DR1.pc);
+    cpu->thread->DR1.ras_top = cpu->thread->ras.top;
+    cpu->thread->DR1.ras_count = cpu->thread->ras.count;
+    cpu->thread->DR1.ras_value = cpu->thread->ras.entry[cpu->thread->ras.top];
+    int arr_index = (cpu->thread->DR1.pc / 4) - 1000;
+    cpu->thread->pe[arr_index].pc_value = cpu->thread->DR1.pc;
+    cpu->thread->pe[arr_index].is_exec = 0;
+    cpu->thread->pc = next_pc(&cpu->thread->DR1);
+    if (cpu->thread->DR1.branch_prediction)
+    {
+        updatePathHistory(cpu, cpu->thread->pc);
+    }
+    lb->next = cpu->thread->DR1.pc == lb->branch_pc ? 0 : lb->next + 1;
+    cpu->lsd_uops++;
+}
+
+/*----------------------------------Loop stream detector utilities end-----------------------------------*/
+
+/* Hands the oldest buffered instruction to DR1 once DR1 has moved on */
+static void deliver_fetch_buffer(APEX_CPU *cpu)
+{
+    if (cpu->thread->DR1.has_insn)
+    {
+        return;
+    }
+    if (cpu->thread->fetch_buffer.count == 0 || (ENABLE_MACRO_FUSION && await_fusion_partner(cpu)))
+    {
+        cpu->decode_starved_cycles++;
+        return;
+    }
+    cpu->thread->fetch_buffer.fusion_wait = 0;
+    cpu->thread->DR1 = cpu->thread->fetch_buffer.entry[cpu->thread->fetch_buffer.head];
+    cpu->thread->DR1.has_insn = TRUE;
+    cpu->thread->DR1.fused = FUSE_NONE;
+    cpu->thread->fetch_buffer.head = (cpu->thread->fetch_buffer.head + 1) % FETCH_BUFFER_SIZE;
+    cpu->thread->fetch_buffer.count--;
+    if (ENABLE_MACRO_FUSION)
+    {
+        fuse_fetch_buffer(cpu);
+    }
+    if (ENABLE_LOOP_BUFFER)
+    {
+        detect_loop(cpu);
+    }
+}
+
+/*----------------------------------Fetch buffer utilities end-----------------------------------*/
+
+/* Fetches the instruction at the PC into the fetch buffer and moves the PC
+ * to where the predictors say the program goes next */
+static void fetch_instruction(APEX_CPU *cpu, int code_index)
+{
+    /* Store current PC in fetch latch */
+    cpu->thread->fetch.pc = cpu->thread->pc;
+    cpu->thread->fetch.waitingForBranch = cpu->thread->waitingForBranch;
+
+    /* Index into code memory using this pc and copy all instruction fields
+     * into fetch latch  */
+    const APEX_Instruction *current_ins = &cpu->thread->code_memory[code_index];
+    strcpy(cpu->thread->fetch.opcode_str, current_ins->opcode_str);
+    cpu->thread->fetch.opcode = current_ins->opcode;
+    cpu->thread->fetch.rd = current_ins->rd;
+    cpu->thread->fetch.rs1 = current_ins->rs1;
+    cpu->thread->fetch.rs2 = current_ins->rs2;
+    cpu->thread->fetch.rs3 = current_ins->rs3;
+    cpu->thread->fetch.imm = current_ins->imm;
+
+    /* Update PC for next instruction. Partial tags can alias, so a BTB hit
+     * is only trusted for an instruction that is actually a branch */
+    cpu->thread->fetch.branch_prediction = 0;
+    cpu->thread->fetch.pred_target = 0;
+    cpu->thread->fetch.path_hist = cpu->thread->path_hist;
+    cpu->thread->fetch.itp_index = getITPIndex(cpu, cpu->thread->pc);
+    if (current_ins->opcode == OPCODE_BZ || current_ins->opcode == OPCODE_BNZ)
+    {
+        BTB_Entry *entry = getBTBEntry(cpu->thread->pc, cpu);
+        if (entry != NULL && entry->prediction == 1)
+        {
+            cpu->thread->fetch.branch_prediction = 1;
+            cpu->thread->fetch.pred_target = entry->target_address;
+        }
+    }
+    else if (current_ins->opcode == OPCODE_RET)
+    {
+        if (cpu->thread->ras.count > 0)
+        {
+            cpu->thread->fetch.branch_prediction = 1;
+            cpu->thread->fetch.pred_target = popRAS(cpu);
+        }
+    }
+    else if (current_ins->opcode == OPCODE_JUMP || current_ins->opcode == OPCODE_JAL)
+    {
+        ITP_Entry *entry = getITPEntry(cpu, cpu->thread->fetch.itp_index, cpu->thread->pc);
+        if (entry != NULL)
+        {
+            cpu->thread->fetch.branch_prediction = 1;
+            cpu->thread->fetch.pred_target = entry->target_address;
+        }
+        if (current_ins->opcode == OPCODE_JAL)
+        {
+            pushRAS(cpu, cpu->thread->pc + 4);
+        }
+    }
+    cpu->thread->fetch.ras_top = cpu->thread->ras.top;
+    cpu->thread->fetch.ras_count = cpu->thread->ras.count;
+    cpu->thread->fetch.ras_value = cpu->thread->ras.entry[cpu->thread->ras.top];
+
+    if (cpu->thread->fetch.branch_prediction)
+    {
+        cpu->thread->pc = cpu->thread->fetch.pred_target;
+        updatePathHistory(cpu, cpu->thread->pc);
+    }
+    else
+    {
+        cpu->thread->pc += 4;
+    }
+    int arr_index = (cpu->thread->fetch.pc / 4) - 1000;
+    cpu->thread->pe[arr_index].pc_value = cpu->thread->fetch.pc;
+    cpu->thread->pe[arr_index].is_exec = 0;
+    /* Queue the fetched instruction for decode */
+    addFetchBufferEntry(cpu, &cpu->thread->fetch);
+
+    if (ENABLE_DEBUG_MESSAGES)
+    {
+        print_stage_content("Fetch", &cpu->thread->fetch);
+    }
+
+    /* Stop fetching new instructions if HALT is fetched */
+    if (cpu->thread->fetch.opcode == OPCODE_HALT)
+    {
+        cpu->thread->fetch.has_insn = FALSE;
+    }
+}
+
+/*----------------------------------Trace cache utilities start-----------------------------------*/
+
+static int is_cond_branch(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ;
+}
+
+/* Stores the trace being built, one of a single instruction saves nothing
+ * over plain fetch. The next retired instruction starts a new one */
+static void end_trace(APEX_CPU *cpu)
+{
+    Trace *trace = &cpu->thread->trace_fill.trace;
+    if (trace->count > 1)
+    {
+        trace->valid = TRUE;
+        trace->thread = cpu->tid;
+        cpu->tc[(trace->start_pc / 4) & (TC_SIZE - 1)] = *trace;
+        cpu->traces_built++;
+    }
+    trace->count = 0;
+    trace->branches = 0;
+    trace->outcomes = 0;
+}
+
+/* Adds a retired instruction to the trace being built. A branch's outcome
+ * is known once the instruction after it retires. Traces end when full,
+ * after a taken backward branch so loops start one at their top, and at
+ * JUMP, JAL, RET and HALT, which are left out of traces */
+static void fill_trace(APEX_CPU *cpu, int pc_value)
+{
+    Trace_Fill *fill = &cpu->thread->trace_fill;
+    Trace *trace = &fill->trace;
+    const APEX_Instruction *instr = &cpu->thread->code_memory[get_code_memory_index_from_pc(pc_value)];
+
+    if (trace->count > 0 && is_cond_branch(cpu->thread->code_memory[get_code_memory_index_from_pc(fill->last_pc)].opcode))
+    {
+        if (pc_value != fill->last_pc + 4)
+        {
+            trace->outcomes |= 1 << (trace->branches - 1);
+            if (pc_value < fill->last_pc)
+            {
+                end_trace(cpu);
+            }
+        }
+    }
+    if (instr->opcode == OPCODE_JUMP || instr->opcode == OPCODE_JAL || instr->opcode == OPCODE_RET ||
+        instr->opcode == OPCODE_HALT)
+    {
+        end_trace(cpu);
+        return;
+    }
+    if (trace->count == TRACE_LENGTH || (is_cond_branch(instr->opcode) && trace->branches == TRACE_BRANCHES))
+    {
+        end_trace(cpu);
+    }
+    if (trace->count == 0)
+    {
+        trace->start_pc = pc_value;
+    }
+    trace->count++;
+    if (is_cond_branch(instr->opcode))
+    {
+        trace->branches++;
+    }
+    fill->last_pc = pc_value;
+}
+
+/* Where fetch goes after the BZ/BNZ at pc_value, by the BTB */
+static int predict_branch_successor(APEX_CPU *cpu, int pc_value)
+{
+    BTB_Entry *entry = getBTBEntry(pc_value, cpu);
+    if (entry != NULL && entry->prediction == 1)
+    {
+        return entry->target_address;
+    }
+    return pc_value + 4;
+}
+
+/* Fetches the trace starting at the PC when the predictor takes the path it
+ * recorded. The I-cache is not accessed. Nothing is looked up while the
+ * fetch buffer could not take a whole trace. Returns the instructions
+ * fetched, 0 on a miss */
+static int fetch_trace(APEX_CPU *cpu)
+{
+    const Trace *trace = &cpu->tc[(cpu->thread->pc / 4) & (TC_SIZE - 1)];
+    int pc_value = cpu->thread->pc;
+    int branch = 0;
+
+    if (FETCH_BUFFER_SIZE - cpu->thread->fetch_buffer.count < TRACE_LENGTH)
+    {
+        return 0;
+    }
+    cpu->trace_lookups++;
+    if (!trace->valid || trace->start_pc != cpu->thread->pc || trace->thread != cpu->tid)
+    {
+        return 0;
+    }
+    for (int i = 0; i < trace->count - 1; i++)
+    {
+        const APEX_Instruction *instr = &cpu->thread->code_memory[get_code_memory_index_from_pc(pc_value)];
+        int next = pc_value + 4;
+        if (is_cond_branch(instr->opcode))
+        {
+            if ((trace->outcomes >> branch++) & 1)
+            {
+                next = pc_value + instr->imm;
+            }
+            if (predict_branch_successor(cpu, pc_value) != next)
+            {
+                return 0;
+            }
+        }
+        pc_value = next;
+    }
+
+    for (int i = 0; i < trace->count; i++)
+    {
+        fetch_instruction(cpu, get_code_memory_index_from_pc(cpu->thread->pc));
+    }
+    cpu->trace_hits++;
+    cpu->trace_insns += trace->count;
+    return trace->count;
+}
+
+/*----------------------------------Trace cache utilities end-----------------------------------*/
+
+/*----------------------------------Tag match utilities start-----------------------------------*/
+
+/* Bits of the slots below count, for one word of a match mask */
+static unsigned long long getSlotMask(int count)
+{
+    return count >= 64 ? ~0ULL : (1ULL << count) - 1;
+}
+
+static void matchTagsScalar(const int *tags, int count, int tag, unsigned long long *mask)
+{
+    memset(mask, 0, TAG_MASK_WORDS(count) * sizeof(*mask));
+    for (int i = 0; i < count; i++)
+    {
+        if (tags[i] == tag)
+        {
+            mask[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void matchTagsSSE2(const int *tags, int count, int tag, unsigned long long *mask)
+{
+    __m128i key = _mm_set1_epi32(tag);
+    memset(mask, 0, TAG_MASK_WORDS(count) * sizeof(*mask));
+    for (int i = 0; i < count; i += 4)
+    {
+        __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&tags[i]), key);
+        mask[i / 64] |= (unsigned long long)_mm_movemask_ps(_mm_castsi128_ps(equal)) << (i % 64);
+    }
+    if (count)
+    {
+        mask[(count - 1) / 64] &= getSlotMask((count - 1) % 64 + 1);
+    }
+}
+
+__attribute__((target("avx2"))) static void matchTagsAVX2(const int *tags, int count, int tag, unsigned long long *mask)
+{
+    __m256i key = _mm256_set1_epi32(tag);
+    memset(mask, 0, TAG_MASK_WORDS(count) * sizeof(*mask));
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&tags[i]), key);
+        mask[i / 64] |= (unsigned long long)_mm256_movemask_ps(_mm256_castsi256_ps(equal)) << (i % 64);
+    }
+    if (count)
+    {
+        mask[(count - 1) / 64] &= getSlotMask((count - 1) % 64 + 1);
+    }
+}
+#endif
+
+static void (*matchTagsImpl)(const int *, int, int, unsigned long long *) = matchTagsScalar;
+static const char *matchTagsName = "scalar";
+
+/* Picks the widest tag compare the host CPU supports */
+void initTagMatch(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (!ENABLE_SIMD_TAG_MATCH)
+    {
+        return;
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        matchTagsImpl = matchTagsAVX2;
+        matchTagsName = "AVX2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        matchTagsImpl = matchTagsSSE2;
+        matchTagsName = "SSE2";
+    }
+#endif
+}
+
+const char *getTagMatchName(void)
+{
+    return matchTagsName;
+}
+
+/* Sets bit i % 64 of mask[i / 64] when tags[i] == tag, for the first count
+ * slots. The array has to be padded to TAG_SLOTS(count), the mask has
+ * TAG_MASK_WORDS(count) words */
+static void matchTags(const int *tags, int count, int tag, unsigned long long *mask)
+{
+    matchTagsImpl(tags, count, tag, mask);
+}
+
+/* Whether slot i is set in a match mask */
+static int isSlotSet(const unsigned long long *mask, int i)
+{
+    return mask[i / 64] >> (i % 64) & 1;
+}
+
+/* Slots from first to last in LSQ order, both included */
+static void getLSQRange(int first, int last, unsigned long long *range)
+{
+    for (int word = 0; word < TAG_MASK_WORDS(LSQ_SIZE); word++)
+    {
+        int base = word * 64;
+        unsigned long long upto_last = last < base ? 0 : getSlotMask(last + 1 - base);
+        unsigned long long from_first = first < base ? ~0ULL : ~getSlotMask(first - base);
+        unsigned long long slots = first <= last ? upto_last & from_first : upto_last | from_first;
+        range[word] = slots & getSlotMask(LSQ_SIZE - base);
+    }
+}
+
+/* Oldest slot of a mask of LSQ slots, the first set bit from the head on
+ * going round. -1 when the mask is empty */
+static int getOldestLSQSlot(APEX_CPU *cpu, const unsigned long long *mask)
+{
+    int head = cpu->thread->lsq.head;
+    int words = TAG_MASK_WORDS(LSQ_SIZE);
+    for (int n = 0; n <= words; n++)
+    {
+        int word = (head / 64 + n) % words;
+        unsigned long long bits = mask[word];
+        if (n == 0)
+        {
+            bits &= ~getSlotMask(head % 64);
+        }
+        else if (n == words)
+        {
+            bits &= getSlotMask(head % 64);
+        }
+        if (bits)
+        {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return -1;
+}
+
+/*----------------------------------Tag match utilities end-----------------------------------*/
+
+/*----------------------------------Basic block vector utilities start-----------------------------------*/
+
+BBV_Profile *createBBVProfile(APEX_CPU *cpu)
+{
+    BBV_Profile *bbv = calloc(1, sizeof(BBV_Profile));
+    if (!bbv)
+    {
+        return NULL;
+    }
+    bbv->blocks = cpu->thread->code_memory_size;
+    bbv->capacity = 16;
+    bbv->vectors = calloc(bbv->capacity * bbv->blocks, sizeof(int));
+    bbv->cycles = calloc(bbv->capacity, sizeof(int));
+    if (!bbv->vectors || !bbv->cycles)
+    {
+        freeBBVProfile(bbv);
+        return NULL;
+    }
+    bbv->start_clock = cpu->clock;
+    return bbv;
+}
+
+void freeBBVProfile(BBV_Profile *bbv)
+{
+    free(bbv->vectors);
+    free(bbv->cycles);
+    free(bbv);
+}
+
+/* Counts a retired instruction in the vector of the current interval. A
+ * block starts at the first instruction and after every control transfer
+ * or taken branch */
+void recordBasicBlock(APEX_CPU *cpu, int pc_value)
+{
+    BBV_Profile *bbv = cpu->bbv;
+
+    if (!bbv->last_pc || pc_value != bbv->last_pc + 4 ||
+        is_control_transfer(cpu->thread->code_memory[get_code_memory_index_from_pc(bbv->last_pc)].opcode))
+    {
+        bbv->block_start = get_code_memory_index_from_pc(pc_value);
+    }
+    bbv->last_pc = pc_value;
+    bbv->vectors[bbv->intervals * bbv->blocks + bbv->block_start]++;
+    if (++bbv->insns < BBV_INTERVAL)
+    {
+        return;
+    }
+
+    bbv->cycles[bbv->intervals++] = cpu->clock + 1 - bbv->start_clock;
+    bbv->start_clock = cpu->clock + 1;
+    bbv->insns = 0;
+    if (bbv->intervals < bbv->capacity)
+    {
+        return;
+    }
+    /* Out of memory the profiling stops, the vectors recorded so far are
+     * still freed with the profile */
+    int *vectors = realloc(bbv->vectors, (size_t)2 * bbv->capacity * bbv->blocks * sizeof(int));
+    if (vectors)
+    {
+        bbv->vectors = vectors;
+    }
+    int *cycles = vectors ? realloc(bbv->cycles, (size_t)2 * bbv->capacity * sizeof(int)) : NULL;
+    if (!cycles)
+    {
+        bbv->failed = TRUE;
+        cpu->bbv = NULL;
+        return;
+    }
+    bbv->cycles = cycles;
+    bbv->capacity *= 2;
+    memset(bbv->vectors + bbv->intervals * bbv->blocks, 0,
+           (size_t)(bbv->capacity - bbv->intervals) * bbv->blocks * sizeof(int));
+}
+
+/*----------------------------------Basic block vector utilities end-----------------------------------*/
+
+/*
+ * Fetch Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+APEX_fetch(APEX_CPU *cpu)
+{
+    if (cpu->thread->waitingForBranch)
+    {
+        /* Target of an unpredicted control transfer is not known yet, drop
+         * whatever was fetched past it and leave a bubble until it resolves */
+        flush_fetch_buffer(cpu);
+        if (ENABLE_DEBUG_MESSAGES)
+        {
+            print_stage_empty_state("Fetch", &cpu->thread->fetch);
+        }
+        return;
+    }
+    /* This fetches new branch target instruction from next cycle */
+    if (cpu->thread->fetch_from_next_cycle == TRUE)
+    {
+        cpu->thread->fetch_from_next_cycle = FALSE;
+        flush_fetch_buffer(cpu);
+        if (ENABLE_DEBUG_MESSAGES)
+        {
+            print_stage_empty_state("Fetch", &cpu->thread->fetch);
+        }
+        /* Skip this cycle*/
+        return;
+    }
+    /* A drain lets what was already fetched through but brings in nothing new */
+    if (cpu->fetch_gated)
+    {
+        if (ENABLE_DEBUG_MESSAGES)
+        {
+            print_stage_empty_state("Fetch", &cpu->thread->fetch);
+        }
+        deliver_fetch_buffer(cpu);
+        return;
+    }
+    if (cpu->thread->loop_buffer.state == LSD_STREAMING)
+    {
+        stream_loop_buffer(cpu);
+        return;
+    }
+    if (cpu->thread->fetch.has_insn)
+    {
+        int code_index = get_code_memory_index_from_pc(cpu->thread->pc);
+        if (isFetchBufferFull(cpu) || code_index < 0 || code_index >= cpu->thread->code_memory_size)
+        {
+            /* Buffer is backed up, or fetch ran off the program on a wrong path */
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_empty_state("Fetch", &cpu->thread->fetch);
+            }
+            deliver_fetch_buffer(cpu);
+            return;
+        }
+
+        /* A trace starting at the PC brings in several basic blocks at once */
+        if (ENABLE_TRACE_CACHE && cpu->thread->icache_cycles == 0 && fetch_trace(cpu))
+        {
+            deliver_fetch_buffer(cpu);
+            return;
+        }
+
+        /* A new fetch starts with an I-cache lookup, a miss holds fetch for
+         * the extra latency of the lower levels */
+        if (cpu->thread->icache_cycles == 0)
+        {
+            /* Each core's and thread's program has its own region of the
+             * shared L2 */
+            int region = cpu->core_id * SMT_THREADS + cpu->tid;
+            lock_bus(cpu);
+            cpu->thread->icache_cycles = accessCache(&cpu->l1i, CODE_ADDRESS_SPACE + (region << 24) + code_index, FALSE);
+            unlock_bus(cpu);
+        }
+        cpu->thread->icache_cycles--;
+        if (cpu->thread->icache_cycles > 0)
+        {
+            cpu->icache_stall_cycles++;
+            if (ENABLE_DEBUG_MESSAGES)
+            {
+                print_stage_empty_state("Fetch(I-cache)", &cpu->thread->fetch);
+            }
+            deliver_fetch_buffer(cpu);
+            return;
+        }
+
+        fetch_instruction(cpu, code_index);
+    }
+    else
+    {
+        if (ENABLE_DEBUG_MESSAGES)
+        {
+            print_stage_empty_state("Fetch", &cpu->thread->fetch);
+        }
+    }
+    deliver_fetch_buffer(cpu);
+}
+
+/* Marks a renamed source valid when its producer's tag is on a bus */
+static void snoop_renamed_source(APEX_CPU *cpu, int ps)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (cpu->fBus[i].busy && cpu->fBus[i].tag == ps)
+        {
+            cpu->pr.reg_invalid[ps] = 0;
+        }
+    }
+}
+
+/* Whether the flags in CC register cc are written, or about to be with a
+ * result already reserved on a bus */
+static int flags_ready(APEX_CPU *cpu, int cc)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (cpu->fBus[i].busy && cpu->fBus[i].cc_tag == cc)
+        {
+            return 1;
+        }
+    }
+    return !cpu->ccf.reg[cc].invalid;
+}
+
+/* Renames the CMP half of a fused compare and branch. Its CC register
+ * becomes the flags producer the branch tests. 0 when none is free */
+static int rename_fused_cmp(APEX_CPU *cpu)
+{
+    setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, -1, cpu);
+    if (cpu->ccf.count == 0)
+    {
+        return 0;
+    }
+    snoop_renamed_source(cpu, cpu->thread->DR1.ps1);
+    snoop_renamed_source(cpu, cpu->thread->DR1.ps2);
+    renameFlags(cpu, -1);
+    cpu->thread->DR1.pd = -1;
+    cpu->thread->DR1.dest_arch_reg = -1;
+    cpu->thread->DR1.prev_phy_reg = -1;
+    return 1;
+}
+
+/* Renames the ADDL half of a fused ADDL+LOAD once the LOAD's source is read.
+ * Both halves need a register and the ADDL a CC register, so nothing is
+ * taken unless all are free */
+static int rename_fused_addl(APEX_CPU *cpu)
+{
+    if (cpu->pr.count < 2 || cpu->ccf.count == 0)
+    {
+        return 0;
+    }
+    int free = getFreeRegFromPR(cpu);
+    renameFlags(cpu, free);
+    cpu->thread->DR1.fused_pd = free;
+    cpu->thread->DR1.fused_prev_phy_reg = cpu->thread->rt.reg[cpu->thread->DR1.fused_rd];
+    cpu->thread->rt.reg[cpu->thread->DR1.fused_rd] = free;
+    return 1;
+}
+
+/*
+ * Decode Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+APEX_DR1(APEX_CPU *cpu)
+{
+    if (cpu->thread->DR1.has_insn)
+    {
+        if (cpu->thread->DR2.has_insn)
+        {
+            /* DR2 is stalled on a full IQ, LSQ, ROB or BIS */
+            print_stage_content("DR1", &cpu->thread->DR1);
+            return;
+        }
+        cpu->thread->DR1.cc_tag = cpu->thread->prev_cc;
+        cpu->thread->DR1.eliminated = 0;
+        cpu->thread->DR1.stall = 0;
+        cpu->thread->DR1.cc_pd = -1;
+        cpu->thread->DR1.cc_prev = -1;
+        switch (cpu->thread->DR1.opcode)
         {
         case OPCODE_MUL:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, cpu->DR1.rs2, -1, cpu);
-            int free = getFreeRegFromPR(cpu);
+            setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, -1, cpu);
+            int free = getFreeDestRegs(cpu);
             if (free != -1)
             {
-                cpu->DR1.prev_phy_reg = cpu->rt.reg[cpu->DR1.rd];
-                cpu->DR1.dest_arch_reg = cpu->DR1.rd;
-                cpu->rt.reg[cpu->DR1.rd] = free;
-                cpu->DR1.pd = free;
-                cpu->DR1.stall = 0;
+                cpu->thread->DR1.prev_phy_reg = cpu->thread->rt.reg[cpu->thread->DR1.rd];
+                cpu->thread->DR1.dest_arch_reg = cpu->thread->DR1.rd;
+                cpu->thread->rt.reg[cpu->thread->DR1.rd] = free;
+                cpu->thread->DR1.pd = free;
+                cpu->thread->DR1.stall = 0;
             }
             else
             {
-                cpu->DR1.stall = 1;
+                cpu->thread->DR1.stall = 1;
                 // stall nd break;
             }
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR1.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
 
@@ -522,44 +1656,49 @@ APEX_DR1(APEX_CPU *cpu)
         case OPCODE_OR:
         case OPCODE_AND:
         case OPCODE_LDR:
+        case OPCODE_FADD:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, cpu->DR1.rs2, -1, cpu);
-            int free = getFreeRegFromPR(cpu);
+            if (eliminateInRename(cpu))
+            {
+                break;
+            }
+            setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, -1, cpu);
+            int free = getFreeDestRegs(cpu);
             if (free != -1)
             {
-                cpu->DR1.prev_phy_reg = cpu->rt.reg[cpu->DR1.rd];
-                cpu->DR1.dest_arch_reg = cpu->DR1.rd;
-                cpu->rt.reg[cpu->DR1.rd] = free;
-                cpu->DR1.pd = free;
-                cpu->DR1.stall = 0;
+                cpu->thread->DR1.prev_phy_reg = cpu->thread->rt.reg[cpu->thread->DR1.rd];
+                cpu->thread->DR1.dest_arch_reg = cpu->thread->DR1.rd;
+                cpu->thread->rt.reg[cpu->thread->DR1.rd] = free;
+                cpu->thread->DR1.pd = free;
+                cpu->thread->DR1.stall = 0;
             }
             else
             {
-                cpu->DR1.stall = 1;
+                cpu->thread->DR1.stall = 1;
                 // stall nd break;
             }
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR1.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
             break;
@@ -571,96 +1710,93 @@ APEX_DR1(APEX_CPU *cpu)
         case OPCODE_SUBL:
         case OPCODE_LOAD:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, -1, -1, cpu);
-            int free = getFreeRegFromPR(cpu);
+            if (eliminateInRename(cpu))
+            {
+                break;
+            }
+            setSrcRegWithPR(cpu->thread->DR1.rs1, -1, -1, cpu);
+            if (cpu->thread->DR1.fused == FUSE_ADDL_LOAD && !rename_fused_addl(cpu))
+            {
+                cpu->thread->DR1.stall = 1;
+                break;
+            }
+            int free = getFreeDestRegs(cpu);
             if (free != -1)
             {
-                cpu->DR1.prev_phy_reg = cpu->rt.reg[cpu->DR1.rd];
-                cpu->rt.reg[cpu->DR1.rd] = free;
-                cpu->DR1.dest_arch_reg = cpu->DR1.rd;
-                cpu->DR1.pd = free;
-                cpu->DR1.stall = 0;
+                cpu->thread->DR1.prev_phy_reg = cpu->thread->rt.reg[cpu->thread->DR1.rd];
+                cpu->thread->rt.reg[cpu->thread->DR1.rd] = free;
+                cpu->thread->DR1.dest_arch_reg = cpu->thread->DR1.rd;
+                cpu->thread->DR1.pd = free;
+                cpu->thread->DR1.stall = 0;
             }
             else
             {
-                cpu->DR1.stall = 1;
+                cpu->thread->DR1.stall = 1;
                 // stall nd break;
             }
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
             }
 
-            cpu->DR1.imm = cpu->DR1.imm;
+            cpu->thread->DR1.imm = cpu->thread->DR1.imm;
             break;
             /*Must do: check if the forwarding bus has any valid src tag or data and update the IQ so that as soon as it enters into the issue queue it is ready to be processed*/
         }
         case OPCODE_MOVC:
         {
-            int free = getFreeRegFromPR(cpu);
-            if (free != -1)
-            {
-                cpu->DR1.prev_phy_reg = cpu->rt.reg[cpu->DR1.rd];
-                cpu->rt.reg[cpu->DR1.rd] = free;
-                cpu->DR1.dest_arch_reg = cpu->DR1.rd;
-                cpu->DR1.pd = free;
-                cpu->DR1.stall = 0;
-            }
-            else
-            {
-                cpu->DR1.stall = 1;
-                // stall nd break;
-            }
+            eliminateInRename(cpu);
             break;
         }
         case OPCODE_NOP:
+        case OPCODE_FENCE:
         {
             break;
         }
         case OPCODE_STR:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, cpu->DR1.rs2, cpu->DR1.rs3, cpu);
+            setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, cpu->thread->DR1.rs3, cpu);
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps3)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps3)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps3].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps3] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR1.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
-                if (cpu->fBus[1].tag == cpu->DR1.ps3)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps3)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps3].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps3] = 0;
                 }
             }
 
@@ -669,135 +1805,176 @@ APEX_DR1(APEX_CPU *cpu)
         }
         case OPCODE_STORE:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, cpu->DR1.rs2, -1, cpu);
+            setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, -1, cpu);
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR1.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
             break;
         }
         case OPCODE_CMP:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, cpu->DR1.rs2, -1, cpu);
-            int free = getFreeRegFromPR(cpu);
+            setSrcRegWithPR(cpu->thread->DR1.rs1, cpu->thread->DR1.rs2, -1, cpu);
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR1.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR1.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
-            cpu->DR1.dest_arch_reg = cpu->DR1.rd;
-            cpu->DR1.prev_phy_reg = cpu->rt.reg[cpu->DR1.rd];
-            cpu->DR1.pd = free;
+            /* CMP only writes a CC register, rd is not written */
+            cpu->thread->DR1.dest_arch_reg = -1;
+            cpu->thread->DR1.prev_phy_reg = -1;
+            cpu->thread->DR1.pd = -1;
+            cpu->thread->DR1.stall = cpu->ccf.count == 0;
+            if (!cpu->thread->DR1.stall)
+            {
+                renameFlags(cpu, -1);
+            }
             break;
             /*Must do: check if the forwarding bus has any valid src tag or data and update the IQ so that as soon as it enters into the issue queue it is ready to be processed*/
         }
         case OPCODE_JUMP:
+        case OPCODE_RET:
+        {
+            setSrcRegWithPR(cpu->thread->DR1.rs1, -1, -1, cpu);
+            if (cpu->fBus[0].busy)
+            {
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
+                {
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
+                }
+            }
+
+            if (cpu->fBus[1].busy)
+            {
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
+                {
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
+                }
+            }
+            cpu->thread->DR1.branch_reg = cpu->thread->prev_cc;
+            if (!cpu->thread->DR1.branch_prediction)
+            {
+                cpu->thread->waitingForBranch = 1;
+            }
+            break;
+            /*Must do: check if the forwarding bus has any valid src tag or data and update the IQ so that as soon as it enters into the issue queue it is ready to be processed*/
+        }
+        case OPCODE_JAL:
         {
-            setSrcRegWithPR(cpu->DR1.rs1, -1, -1, cpu);
+            setSrcRegWithPR(cpu->thread->DR1.rs1, -1, -1, cpu);
+            int free = getFreeDestRegs(cpu);
+            if (free != -1)
+            {
+                cpu->thread->DR1.prev_phy_reg = cpu->thread->rt.reg[cpu->thread->DR1.rd];
+                cpu->thread->rt.reg[cpu->thread->DR1.rd] = free;
+                cpu->thread->DR1.dest_arch_reg = cpu->thread->DR1.rd;
+                cpu->thread->DR1.pd = free;
+                cpu->thread->DR1.stall = 0;
+            }
+            else
+            {
+                cpu->thread->DR1.stall = 1;
+                // stall nd break;
+            }
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR1.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR1.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR1.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps1] = 0;
                 }
             }
-            cpu->waitingForBranch = 1;
+            cpu->thread->DR1.branch_reg = cpu->thread->prev_cc;
+            if (!cpu->thread->DR1.stall && !cpu->thread->DR1.branch_prediction)
+            {
+                cpu->thread->waitingForBranch = 1;
+            }
             break;
             /*Must do: check if the forwarding bus has any valid src tag or data and update the IQ so that as soon as it enters into the issue queue it is ready to be processed*/
         }
         case OPCODE_BZ:
         case OPCODE_BNZ:
         {
-            // prediction
-            cpu->DR1.branch_reg = cpu->prev_cc;
-            if (cpu->fBus[0].busy)
-            {
-                if (cpu->fBus[0].tag == cpu->DR1.branch_reg && cpu->fBus[0].isDataFwd)
-                {
-                    cpu->pr.PR_File[cpu->DR1.branch_reg].reg_invalid = 0;
-                }
-            }
-
-            if (cpu->fBus[1].busy)
+            if (cpu->thread->DR1.fused == FUSE_CMP_BRANCH && !rename_fused_cmp(cpu))
             {
-                if (cpu->fBus[1].tag == cpu->DR1.branch_reg && cpu->fBus[1].isDataFwd)
-                {
-                    cpu->pr.PR_File[cpu->DR1.branch_reg].reg_invalid = 0;
-                }
+                cpu->thread->DR1.stall = 1;
+                break;
             }
-            if (cpu->pr.PR_File[cpu->DR1.branch_reg].reg_invalid == 0)
+            // prediction
+            cpu->thread->DR1.branch_reg = cpu->thread->prev_cc;
+            if (!cpu->ccf.reg[cpu->thread->DR1.branch_reg].invalid)
             {
-                if (cpu->pr.PR_File[cpu->DR1.branch_reg].cc_flag == 1 ^ cpu->DR1.opcode == OPCODE_BZ)
+                if ((cpu->ccf.reg[cpu->thread->DR1.branch_reg].flag == 1) != (cpu->thread->DR1.opcode == OPCODE_BZ))
                 {
-                    if (cpu->DR1.branch_prediction)
+                    if (cpu->thread->DR1.branch_prediction)
                     {
-                        updateBTBEntry(cpu->DR1.pc, 0, cpu);
-                        cpu->fetch_from_next_cycle = TRUE;
-                        cpu->pc = cpu->DR1.pc + 4;
+                        updateBTBEntry(cpu->thread->DR1.pc, 0, cpu);
+                        restoreFetchHistory(cpu, cpu->thread->DR1.path_hist, cpu->thread->DR1.ras_top, cpu->thread->DR1.ras_count, cpu->thread->DR1.ras_value);
+                        cpu->thread->fetch_from_next_cycle = TRUE;
+                        cpu->thread->pc = cpu->thread->DR1.pc + 4;
                     }
                 }
                 else
                 {
-                    if (!cpu->DR1.branch_prediction)
+                    if (!cpu->thread->DR1.branch_prediction)
                     {
-                        cpu->DR1.branch_prediction = 1;
-                        cpu->DR1.waitingForBranch = 1;
-                        cpu->waitingForBranch = 1;
+                        cpu->thread->DR1.branch_prediction = 1;
+                        cpu->thread->DR1.waitingForBranch = 1;
+                        cpu->thread->waitingForBranch = 1;
                     }
                 }
             }
-            else if (!cpu->DR1.branch_prediction && cpu->DR1.imm < 0)
+            else if (!cpu->thread->DR1.branch_prediction && cpu->thread->DR1.imm < 0)
             {
-                cpu->DR1.branch_prediction = 1;
-                cpu->DR1.waitingForBranch = 1;
-                cpu->waitingForBranch = 1;
+                cpu->thread->DR1.branch_prediction = 1;
+                cpu->thread->DR1.waitingForBranch = 1;
+                cpu->thread->waitingForBranch = 1;
             }
             break;
         }
@@ -806,20 +1983,22 @@ APEX_DR1(APEX_CPU *cpu)
             break;
         }
         }
-        print_stage_content("DR1", &cpu->DR1);
-        if (cpu->DR1.stall)
+        print_stage_content("DR1", &cpu->thread->DR1);
+        if (cpu->thread->DR1.stall)
         {
+            /* Only a shortage of free physical registers stalls DR1 */
+            cpu->rename_blocked_cycles++;
             return;
         }
-        cpu->DR2 = cpu->DR1;
-        cpu->DR1.has_insn = FALSE;
+        cpu->thread->DR2 = cpu->thread->DR1;
+        cpu->thread->DR1.has_insn = FALSE;
         /*If the IQ is full stall the fetch and DR2 stage}*/
     }
     else
     {
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_empty_state("DR1", &cpu->DR1);
+            print_stage_empty_state("DR1", &cpu->thread->DR1);
         }
     }
 }
@@ -827,12 +2006,24 @@ APEX_DR1(APEX_CPU *cpu)
 static void
 APEX_DR2(APEX_CPU *cpu)
 {
-    if (cpu->DR2.has_insn)
+    if (cpu->thread->DR2.has_insn)
     {
 
-        if (isIQFull(cpu) || isLSQFull(cpu) || isROBFull(cpu) || ((cpu->DR2.opcode == OPCODE_BNZ || cpu->DR2.opcode == OPCODE_BZ) && isBISFull(cpu)))
+        int opcode = cpu->thread->DR2.opcode;
+        int is_load = is_load_opcode(opcode);
+        int is_store = opcode == OPCODE_STORE || opcode == OPCODE_STR;
+        if (opcode == OPCODE_FENCE && (!isLSQEmpty(cpu) || cpu->thread->sb.count))
+        {
+            /* Everything younger waits until every older load and store
+             * has been performed */
+            cpu->fence_stall_cycles++;
+            print_stage_content("DR2", &cpu->thread->DR2);
+            return;
+        }
+        if ((!cpu->thread->DR2.eliminated && isIQFull(cpu)) || (is_load && isLoadQueueFull(cpu)) || (is_store && isStoreQueueFull(cpu)) ||
+            isROBFull(cpu) || (is_control_transfer(opcode) && isBISFull(cpu)))
         {
-            print_stage_content("DR2", &cpu->DR2);
+            print_stage_content("DR2", &cpu->thread->DR2);
             return;
         }
         int fu_type = 0;
@@ -844,13 +2035,28 @@ APEX_DR2(APEX_CPU *cpu)
         int src2_valid = 0;
         int src2_value = 0;
         int dest = 0;
+        int cc_src = -1;
+        int cc_src_valid = 1;
 
-        int rob_index = (cpu->rob.tail + 1) % ROB_SIZE;
-        int lsq_index = (cpu->lsq.tail + 1) % LSQ_SIZE;
+        int rob_index = (cpu->thread->rob.tail + 1) % ROB_SIZE;
+        int lsq_index = (cpu->thread->lsq.tail + 1) % LSQ_SIZE;
 
         int instruction_type = R2R;
 
-        switch (cpu->DR2.opcode)
+        if (cpu->thread->DR2.eliminated)
+        {
+            /* Already complete, it only has to retire in order */
+            addROBEntry(1, instruction_type, cpu->thread->DR2.pc, cpu->thread->DR2.pd, cpu->thread->DR2.prev_phy_reg, cpu->thread->DR2.dest_arch_reg, lsq_index, 0, cpu);
+            cpu->thread->rob.eliminated[rob_index] = 1;
+            cpu->thread->rob.isExecuted[rob_index] = 1;
+            cpu->thread->rob.cc_dest[rob_index] = cpu->thread->DR2.cc_pd;
+            cpu->thread->rob.cc_prev[rob_index] = cpu->thread->DR2.cc_prev;
+            print_stage_content("DR2", &cpu->thread->DR2);
+            cpu->thread->DR2.has_insn = FALSE;
+            return;
+        }
+
+        switch (cpu->thread->DR2.opcode)
         {
         case OPCODE_ADD:
         case OPCODE_DIV:
@@ -860,36 +2066,36 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
-            dest = cpu->DR2.pd;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
+            dest = cpu->thread->DR2.pd;
             break;
         }
 
@@ -898,36 +2104,36 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
             fu_type = MUL_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
-            dest = cpu->DR2.pd;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
+            dest = cpu->thread->DR2.pd;
             break;
         }
 
@@ -937,25 +2143,25 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
             src2_valid = 1;
-            dest = cpu->DR2.pd;
+            dest = cpu->thread->DR2.pd;
             break;
         }
 
@@ -966,36 +2172,36 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR1.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR1.ps2] = 0;
                 }
             }
             fu_type = LOP_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
-            dest = cpu->DR2.pd;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
+            dest = cpu->thread->DR2.pd;
 
             break;
         }
@@ -1005,7 +2211,7 @@ APEX_DR2(APEX_CPU *cpu)
             fu_type = INT_U;
             src1_valid = 1;
             src2_valid = 1;
-            dest = cpu->DR2.pd;
+            dest = cpu->thread->DR2.pd;
             break;
         }
 
@@ -1019,11 +2225,31 @@ APEX_DR2(APEX_CPU *cpu)
         }
 
         case OPCODE_NOP:
+        case OPCODE_FENCE:
         {
             fu_type = INT_U;
             src1_valid = 1;
             src2_valid = 1;
             instruction_type = NOP;
+            cpu->fences += opcode == OPCODE_FENCE;
+            break;
+        }
+
+        case OPCODE_FADD:
+        {
+            /* The IQ only computes the address, the LSQ entry performs the
+             * read-modify-write and reads the addend itself then */
+            snoop_renamed_source(cpu, cpu->thread->DR2.ps1);
+            fu_type = INT_U;
+            src1_tag = cpu->thread->DR2.ps1;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = 1;
+            dest = lsq_index;
+            instruction_type = LOAD;
+
+            addLSQEntry(1, 1, 0, 0, cpu->thread->DR2.pd, 1, cpu->thread->DR2.ps2, 0, rob_index, cpu);
+            cpu->thread->lsq.is_atomic[lsq_index] = TRUE;
             break;
         }
 
@@ -1032,39 +2258,39 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
             dest = lsq_index;
             instruction_type = LOAD;
 
-            addLSQEntry(1, 1, 0, 0, cpu->DR2.pd, 1, 0, 0, rob_index, cpu);
+            addLSQEntry(1, 1, 0, 0, cpu->thread->DR2.pd, 1, 0, 0, rob_index, cpu);
             break;
         }
 
@@ -1073,28 +2299,28 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
             src2_valid = 1;
             dest = lsq_index;
             instruction_type = LOAD;
 
-            addLSQEntry(1, 1, 0, 0, cpu->DR2.pd, 1, 0, 0, rob_index, cpu);
+            addLSQEntry(1, 1, 0, 0, cpu->thread->DR2.pd, 1, 0, 0, rob_index, cpu);
             break;
         }
 
@@ -1103,35 +2329,35 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
             dest = lsq_index;
             instruction_type = STORE;
 
@@ -1144,140 +2370,150 @@ APEX_DR2(APEX_CPU *cpu)
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps2)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
-                if (cpu->fBus[0].tag == cpu->DR2.ps3)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps3)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps3].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps3] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
 
-                if (cpu->fBus[1].tag == cpu->DR2.ps2)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps2)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps2] = 0;
                 }
-                if (cpu->fBus[1].tag == cpu->DR2.ps3)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps3)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps3].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps3] = 0;
                 }
             }
 
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src2_tag = cpu->DR2.ps2;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
-            src2_valid = !cpu->pr.PR_File[cpu->DR2.ps2].reg_invalid;
-            src2_value = cpu->pr.PR_File[cpu->DR2.ps2].phy_Reg;
-            int src3_valid = !cpu->pr.PR_File[cpu->DR2.ps3].reg_invalid;
-            int src3_value = cpu->pr.PR_File[cpu->DR2.ps3].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src2_tag = cpu->thread->DR2.ps2;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+            src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+            src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
+            int src3_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps3];
+            int src3_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps3];
             dest = lsq_index;
             instruction_type = STORE;
 
-            addLSQEntry(1, 0, 0, 0, dest, src3_valid, cpu->DR2.ps3, src3_value, rob_index, cpu);
+            addLSQEntry(1, 0, 0, 0, dest, src3_valid, cpu->thread->DR2.ps3, src3_value, rob_index, cpu);
             break;
         }
 
         case OPCODE_JUMP:
+        case OPCODE_RET:
+        case OPCODE_JAL:
         {
 
             if (cpu->fBus[0].busy)
             {
-                if (cpu->fBus[0].tag == cpu->DR2.ps1)
+                if (cpu->fBus[0].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
 
             if (cpu->fBus[1].busy)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.ps1)
+                if (cpu->fBus[1].tag == cpu->thread->DR2.ps1)
                 {
-                    cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid = 0;
+                    cpu->pr.reg_invalid[cpu->thread->DR2.ps1] = 0;
                 }
             }
             fu_type = INT_U;
-            src1_tag = cpu->DR2.ps1;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.ps1].reg_invalid;
-            src1_value = cpu->pr.PR_File[cpu->DR2.ps1].phy_Reg;
+            src1_tag = cpu->thread->DR2.ps1;
+            src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+            src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
             src2_valid = 1;
             instruction_type = NOP;
-
+            if (cpu->thread->DR2.opcode == OPCODE_JAL)
+            {
+                dest = cpu->thread->DR2.pd;
+                instruction_type = R2R;
+            }
+            cpu->new_bis = 1;
             break;
         }
 
         case OPCODE_BZ:
         case OPCODE_BNZ:
         {
-            if (cpu->fBus[0].busy)
-            {
-                if (cpu->fBus[0].tag == cpu->DR2.branch_reg && cpu->fBus[0].isDataFwd)
-                {
-                    cpu->pr.PR_File[cpu->DR2.branch_reg].reg_invalid = 0;
-                }
-            }
-
-            if (cpu->fBus[1].busy)
+            if (!cpu->ccf.reg[cpu->thread->DR2.branch_reg].invalid)
             {
-                if (cpu->fBus[1].tag == cpu->DR2.branch_reg && cpu->fBus[1].isDataFwd)
+                if ((cpu->ccf.reg[cpu->thread->DR2.branch_reg].flag == 1) != (cpu->thread->DR2.opcode == OPCODE_BZ))
                 {
-                    cpu->pr.PR_File[cpu->DR2.branch_reg].reg_invalid = 0;
-                }
-            }
-            if (cpu->pr.PR_File[cpu->DR2.branch_reg].reg_invalid == 0)
-            {
-                if (cpu->pr.PR_File[cpu->DR2.branch_reg].cc_flag == 1 ^ cpu->DR2.opcode == OPCODE_BZ)
-                {
-                    if (cpu->DR2.branch_prediction)
+                    if (cpu->thread->DR2.branch_prediction)
                     {
-                        updateBTBEntry(cpu->DR2.pc, 0, cpu);
-                        cpu->fetch_from_next_cycle = TRUE;
-                        cpu->pc = cpu->DR2.pc + 4;
-                        cpu->DR1.has_insn = FALSE;
+                        updateBTBEntry(cpu->thread->DR2.pc, 0, cpu);
+                        restoreFetchHistory(cpu, cpu->thread->DR2.path_hist, cpu->thread->DR2.ras_top, cpu->thread->DR2.ras_count, cpu->thread->DR2.ras_value);
+                        cpu->thread->fetch_from_next_cycle = TRUE;
+                        cpu->thread->pc = cpu->thread->DR2.pc + 4;
+                        cpu->thread->DR1.has_insn = FALSE;
                     }
                 }
                 else
                 {
-                    if (cpu->DR2.branch_prediction)
+                    if (cpu->thread->DR2.branch_prediction)
                     {
-                        BTB_Entry *entry = getBTBEntry(cpu->DR2.pc, cpu);
-                        if (entry != NULL)
+                        /* Fetch already went to the target if it followed the
+                         * BTB, a hit now may be another thread's entry */
+                        if (cpu->thread->DR2.pred_target)
                         {
-                            cpu->DR2.waitingForBranch = 0;
-                            cpu->waitingForBranch = 0;
+                            cpu->thread->DR2.waitingForBranch = 0;
+                            cpu->thread->waitingForBranch = 0;
                         }
                         else
                         {
-                            cpu->DR2.waitingForBranch = 1;
-                            cpu->waitingForBranch = 1;
-                            cpu->DR1.has_insn = FALSE;
+                            cpu->thread->DR2.waitingForBranch = 1;
+                            cpu->thread->waitingForBranch = 1;
+                            cpu->thread->DR1.has_insn = FALSE;
                         }
                     }
                     else
                     {
-                        cpu->DR1.has_insn = FALSE;
-                        cpu->DR2.waitingForBranch = 1;
-                        cpu->waitingForBranch = 1;
+                        cpu->thread->DR1.has_insn = FALSE;
+                        cpu->thread->DR2.waitingForBranch = 1;
+                        cpu->thread->waitingForBranch = 1;
                     }
                 }
             }
+            /* The branch has no data operands, only the flags it tests */
             fu_type = INT_U;
-            src1_tag = cpu->DR2.branch_reg;
-            src1_valid = !cpu->pr.PR_File[cpu->DR2.branch_reg].reg_invalid;
+            src1_valid = 1;
             src2_valid = 1;
+            cc_src = cpu->thread->DR2.branch_reg;
+            cc_src_valid = flags_ready(cpu, cc_src);
+            if (cpu->thread->DR2.fused == FUSE_CMP_BRANCH)
+            {
+                /* Waits on the CMP's sources and produces its flags */
+                cc_src = -1;
+                cc_src_valid = 1;
+                snoop_renamed_source(cpu, cpu->thread->DR2.ps1);
+                snoop_renamed_source(cpu, cpu->thread->DR2.ps2);
+                src1_tag = cpu->thread->DR2.ps1;
+                src2_tag = cpu->thread->DR2.ps2;
+                src1_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps1];
+                src1_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps1];
+                src2_valid = !cpu->pr.reg_invalid[cpu->thread->DR2.ps2];
+                src2_value = cpu->pr.phy_Reg[cpu->thread->DR2.ps2];
+            }
             instruction_type = BRANCH;
             cpu->new_bis = 1;
             break;
@@ -1290,32 +2526,92 @@ APEX_DR2(APEX_CPU *cpu)
         }
         if (cpu->new_bis)
         {
-            addBISEntry(cpu, cpu->DR2.pc, rob_index, 0);
+            addBISEntry(cpu, cpu->thread->DR2.pc, rob_index, 0);
+            saveBISCheckpoint(cpu, &cpu->thread->DR2);
             cpu->new_bis = 0;
         }
-        addROBEntry(1, instruction_type, cpu->DR2.pc, dest, cpu->DR2.prev_phy_reg, cpu->DR2.dest_arch_reg, lsq_index, 0, cpu);
-        addIQEntry(1, fu_type, cpu->DR2.imm, src1_valid, src1_tag, src1_value, src2_valid, src2_tag, src2_value, dest, cpu->DR2.waitingForBranch, cpu->bis.tail, cpu->DR2.pc, cpu->DR2.opcode, cpu->DR2.branch_prediction, cpu->DR2.opcode_str, cpu->DR2.rs1, cpu->DR2.rs2, cpu->DR2.rs3, cpu->DR2.rd, cpu);
-        print_stage_content("DR2", &cpu->DR2);
-        cpu->DR2.has_insn = FALSE;
+        if (instruction_type == LOAD || instruction_type == STORE)
+        {
+            saveLSQCheckpoint(cpu, &cpu->thread->DR2);
+        }
+        if (ENABLE_VALUE_PREDICTION && instruction_type == LOAD && opcode != OPCODE_FADD)
+        {
+            predictLoadValue(cpu);
+        }
+        addROBEntry(1, instruction_type, cpu->thread->DR2.pc, dest, cpu->thread->DR2.prev_phy_reg, cpu->thread->DR2.dest_arch_reg, lsq_index, 0, cpu);
+        cpu->thread->rob.fused[rob_index] = cpu->thread->DR2.fused;
+        cpu->thread->rob.fused_dest_phy_reg[rob_index] = cpu->thread->DR2.fused_pd;
+        cpu->thread->rob.fused_prev_phy_reg[rob_index] = cpu->thread->DR2.fused_prev_phy_reg;
+        cpu->thread->rob.fused_arch_reg[rob_index] = cpu->thread->DR2.fused_rd;
+        cpu->thread->rob.cc_dest[rob_index] = cpu->thread->DR2.cc_pd;
+        cpu->thread->rob.cc_prev[rob_index] = cpu->thread->DR2.cc_prev;
+        if (instruction_type == LOAD || instruction_type == STORE)
+        {
+            /* The IQ is shared, its LSQ index also says whose LSQ */
+            dest += cpu->tid * LSQ_SIZE;
+        }
+        addIQEntry(1, fu_type, cpu->thread->DR2.imm, src1_valid, src1_tag, src1_value, src2_valid, src2_tag, src2_value, dest, cpu->thread->DR2.waitingForBranch, cpu->thread->bis.tail, cpu->thread->DR2.pc, cpu->thread->DR2.opcode, cpu->thread->DR2.branch_prediction, cpu->thread->DR2.rs1, cpu->thread->DR2.rs2, cpu->thread->DR2.rs3, cpu->thread->DR2.rd, cpu);
+        cpu->iq.rob_index[cpu->iq.tail] = rob_index;
+        cpu->iq.fused[cpu->iq.tail] = cpu->thread->DR2.fused;
+        cpu->iq.fused_pd[cpu->iq.tail] = cpu->thread->DR2.fused_pd;
+        cpu->iq.fused_imm[cpu->iq.tail] = cpu->thread->DR2.fused_imm;
+        cpu->iq.cc_src[cpu->iq.tail] = cc_src;
+        cpu->iq.cc_src_valid[cpu->iq.tail] = cc_src_valid;
+        cpu->iq.cc_dest[cpu->iq.tail] = cpu->thread->DR2.cc_pd;
+        rankIQEntry(cpu, cpu->iq.tail);
+        print_stage_content("DR2", &cpu->thread->DR2);
+        cpu->thread->DR2.has_insn = FALSE;
     }
     else
     {
         if (ENABLE_DEBUG_MESSAGES)
         {
-            print_stage_empty_state("DR2", &cpu->DR2);
+            print_stage_empty_state("DR2", &cpu->thread->DR2);
         }
     }
 }
 
+/* Hands a bus result to the LSQ it is for. An address names its LSQ entry,
+ * a register value can be store data in any thread's LSQ */
+static void snoopLSQ(APEX_CPU *cpu, int tag, int data)
+{
+    if (tag < 0)
+    {
+        updateLSQEntry(cpu, tag, data);
+        return;
+    }
+    for (int i = 0; i < cpu->num_threads; i++)
+    {
+        switch_thread(cpu, i);
+        updateLSQEntry(cpu, tag, data);
+    }
+}
+
 static void APEX_LSQ(APEX_CPU *cpu)
 {
-    if (cpu->fBus[0].busy)
+    /* A bus only reserved for next cycle's result carries no data yet, and
+     * loads may forward store data as soon as it is marked valid */
+    if (cpu->fBus[0].busy && cpu->fBus[0].isDataFwd)
     {
-        updateLSQEntry(cpu, cpu->fBus[0].tag, cpu->fBus[0].data);
+        snoopLSQ(cpu, cpu->fBus[0].tag, cpu->fBus[0].data);
     }
-    if (cpu->fBus[1].busy)
+    if (cpu->fBus[1].busy && cpu->fBus[1].isDataFwd)
+    {
+        snoopLSQ(cpu, cpu->fBus[1].tag, cpu->fBus[1].data);
+    }
+    cpu->outstanding_misses += getOutstandingMisses(&cpu->l1d, cpu->clock);
+    if (cpu->clock % SSIT_CLEAR_INTERVAL == 0)
+    {
+        clearStoreSets(cpu);
+    }
+    /* The threads take turns at the first go on the D-cache ports */
+    int port_free = TRUE;
+    int write_port_free = TRUE;
+    for (int i = 0; i < cpu->num_threads; i++)
     {
-        updateLSQEntry(cpu, cpu->fBus[1].tag, cpu->fBus[1].data);
+        switch_thread(cpu, (cpu->clock + i) % cpu->num_threads);
+        execute_loads(cpu, &port_free);
+        APEX_D_cache(cpu, &write_port_free);
     }
 }
 
@@ -1329,137 +2625,241 @@ static void APEX_IQ(APEX_CPU *cpu)
     {
         updateIQEntry(cpu, cpu->fBus[1].tag, cpu->fBus[1].isDataFwd, cpu->fBus[1].data);
     }
-    int index = 0;
-    int loop = 1;
-    while (loop)
+    for (int i = 0; i < 2; i++)
     {
-        index = getIQEntry_Index(cpu, index);
-        if (index == -1)
+        if (cpu->fBus[i].busy && cpu->fBus[i].cc_tag != -1)
         {
-            return;
+            updateIQFlags(cpu, cpu->fBus[i].cc_tag);
         }
+    }
+    int index = selectIQEntry(cpu);
+    if (index == -1)
+    {
+        return;
+    }
+    cpu->I_Queue.thread = cpu->iq.thread[index];
+    cpu->insn_issued++;
+    cpu->issue_wait_cycles += cpu->clock - cpu->iq.dispatch_cycle[index];
+    cpu->ready_wait_cycles += cpu->clock - cpu->iq.ready_cycle[index];
+    if (cpu->clock - cpu->iq.ready_cycle[index] > cpu->max_ready_wait)
+    {
+        cpu->max_ready_wait = cpu->clock - cpu->iq.ready_cycle[index];
+    }
 
-        int fu_type = cpu->iq.entry[index]->fu_type;
-        int opcode = cpu->iq.entry[index]->opcode;
-        switch (fu_type)
+    int fu_type = cpu->iq.fu_type[index];
+    int opcode = cpu->iq.opcode[index];
+    switch (fu_type)
+    {
+    case INT_U:
+    {
+        cpu->I_Queue.rs1 = cpu->iq.rs1[index];
+        cpu->I_Queue.rs2 = cpu->iq.rs2[index];
+        cpu->I_Queue.rs3 = cpu->iq.rs3[index];
+        cpu->I_Queue.rd = cpu->iq.rd[index];
+        cpu->I_Queue.rs1_value = cpu->iq.src1_value[index];
+        cpu->I_Queue.rs2_value = cpu->iq.src2_value[index];
+        cpu->I_Queue.ps1 = cpu->iq.src1_tag[index];
+        cpu->I_Queue.ps2 = cpu->iq.src2_tag[index];
+        cpu->I_Queue.imm = cpu->iq.literal[index];
+        cpu->I_Queue.has_insn = TRUE;
+        cpu->I_Queue.pd = cpu->iq.dest[index];
+        cpu->I_Queue.pc = cpu->iq.pc_value[index];
+        cpu->I_Queue.branch_prediction = cpu->iq.prediction[index];
+        cpu->I_Queue.opcode = opcode;
+        strcpy(cpu->I_Queue.opcode_str, get_opcode_str(cpu->I_Queue.opcode));
+        cpu->I_Queue.fused = cpu->iq.fused[index];
+        cpu->I_Queue.fused_pd = cpu->iq.fused_pd[index];
+        cpu->I_Queue.fused_imm = cpu->iq.fused_imm[index];
+        cpu->I_Queue.cc_pd = cpu->iq.cc_dest[index];
+        if (opcode == OPCODE_BZ || opcode == OPCODE_BNZ)
         {
-        case INT_U:
+            /* A fused compare tests the flags it produces itself */
+            cpu->I_Queue.branch_reg = cpu->I_Queue.fused ? cpu->I_Queue.cc_pd : cpu->iq.cc_src[index];
+        }
+        /* Only a register result is reserved under its tag, memory
+         * instructions put an LSQ tag on the bus and the rest no data */
+        int tag = NO_DATA_TAG;
+        if (cpu->I_Queue.fused == FUSE_ADDL_LOAD)
         {
-
-            if (cpu->INT_FU.has_insn || (cpu->fBus[0].busy && cpu->fBus[1].busy))
-            {
-                index++;
-                continue;
-            }
-            cpu->I_Queue.rs1 = cpu->iq.entry[index]->rs1;
-            cpu->I_Queue.rs2 = cpu->iq.entry[index]->rs2;
-            cpu->I_Queue.rs3 = cpu->iq.entry[index]->rs3;
-            cpu->I_Queue.rd = cpu->iq.entry[index]->rd;
-            cpu->I_Queue.rs1_value = cpu->iq.entry[index]->src1_value;
-            cpu->I_Queue.rs2_value = cpu->iq.entry[index]->src2_value;
-            cpu->I_Queue.imm = cpu->iq.entry[index]->literal;
-            cpu->I_Queue.has_insn = TRUE;
-            cpu->I_Queue.pd = cpu->iq.entry[index]->dest;
-            cpu->I_Queue.pc = cpu->iq.entry[index]->pc_value;
-            cpu->I_Queue.branch_prediction = cpu->iq.entry[index]->prediction;
-            cpu->I_Queue.opcode = opcode;
-            strcpy(cpu->I_Queue.opcode_str, cpu->iq.entry[index]->opcode_str);
-            int tag = 0;
-            if (opcode == OPCODE_BZ || opcode == OPCODE_BNZ)
-            {
-                cpu->I_Queue.branch_reg = cpu->iq.entry[index]->src1_tag;
-                tag = cpu->I_Queue.branch_reg;
-            }
-            else
-            {
-                tag = cpu->I_Queue.pd;
-            }
-            cpu->I_Queue.waitingForBranch = cpu->iq.entry[index]->waitingForBranch;
-            cpu->INT_FU = cpu->I_Queue;
-            if (!cpu->fBus[0].busy)
-            {
-                cpu->fBus[0].tag = tag;
-                cpu->fBus[0].busy = 1;
-            }
-            else if (!cpu->fBus[1].busy)
-            {
-                cpu->fBus[1].tag = tag;
-                cpu->fBus[1].busy = 1;
-            }
-            break;
+            tag = cpu->I_Queue.fused_pd;
         }
-
-        case LOP_U:
+        else if (opcode == OPCODE_ADD || opcode == OPCODE_SUB || opcode == OPCODE_DIV || opcode == OPCODE_ADDL ||
+                 opcode == OPCODE_SUBL || opcode == OPCODE_MOVC || opcode == OPCODE_JAL)
         {
-            if (cpu->LOP_FU.has_insn)
-            {
-                index++;
-                continue;
-            }
-            cpu->I_Queue.rs1 = cpu->iq.entry[index]->rs1;
-            cpu->I_Queue.rs2 = cpu->iq.entry[index]->rs2;
-            cpu->I_Queue.rs3 = cpu->iq.entry[index]->rs3;
-            cpu->I_Queue.rd = cpu->iq.entry[index]->rd;
-            cpu->I_Queue.rs1_value = cpu->iq.entry[index]->src1_value;
-            cpu->I_Queue.rs2_value = cpu->iq.entry[index]->src2_value;
-            cpu->I_Queue.imm = cpu->iq.entry[index]->literal;
-            cpu->I_Queue.has_insn = TRUE;
-            cpu->I_Queue.pd = cpu->iq.entry[index]->dest;
-            cpu->I_Queue.pc = cpu->iq.entry[index]->pc_value;
-            cpu->I_Queue.opcode = cpu->iq.entry[index]->opcode;
-            strcpy(cpu->I_Queue.opcode_str, cpu->iq.entry[index]->opcode_str);
-            cpu->LOP_FU = cpu->I_Queue;
-            if (!cpu->fBus[0].busy)
-            {
-                cpu->fBus[0].tag = cpu->I_Queue.pd;
-                cpu->fBus[0].busy = 1;
-            }
-            else if (!cpu->fBus[1].busy)
-            {
-                cpu->fBus[1].tag = cpu->I_Queue.pd;
-                cpu->fBus[1].busy = 1;
-            }
-            break;
+            tag = cpu->I_Queue.pd;
         }
-
-        case MUL_U:
+        cpu->I_Queue.waitingForBranch = cpu->iq.waitingForBranch[index];
+        cpu->I_Queue.bis_index = cpu->iq.bis_index[index];
+        cpu->I_Queue.rob_index = cpu->iq.rob_index[index];
+        cpu->INT_FU = cpu->I_Queue;
+        if (tag == NO_DATA_TAG && cpu->I_Queue.cc_pd == -1)
         {
-            if (cpu->MUL1_FU.has_insn)
-            {
-                index++;
-                continue;
-            }
-            cpu->I_Queue.rs1 = cpu->iq.entry[index]->rs1;
-            cpu->I_Queue.rs2 = cpu->iq.entry[index]->rs2;
-            cpu->I_Queue.rs3 = cpu->iq.entry[index]->rs3;
-            cpu->I_Queue.rd = cpu->iq.entry[index]->rd;
-            cpu->I_Queue.rs1_value = cpu->iq.entry[index]->src1_value;
-            cpu->I_Queue.rs2_value = cpu->iq.entry[index]->src2_value;
-            cpu->I_Queue.imm = cpu->iq.entry[index]->literal;
-            cpu->I_Queue.has_insn = TRUE;
-            cpu->I_Queue.pd = cpu->iq.entry[index]->dest;
-            cpu->I_Queue.pc = cpu->iq.entry[index]->pc_value;
-            cpu->I_Queue.opcode = cpu->iq.entry[index]->opcode;
-            strcpy(cpu->I_Queue.opcode_str, cpu->iq.entry[index]->opcode_str);
-            cpu->MUL1_FU = cpu->I_Queue;
             break;
         }
+        if (!cpu->fBus[0].busy)
+        {
+            cpu->fBus[0].tag = tag;
+            cpu->fBus[0].cc_tag = cpu->I_Queue.cc_pd;
+            cpu->fBus[0].busy = 1;
+        }
+        else if (!cpu->fBus[1].busy)
+        {
+            cpu->fBus[1].tag = tag;
+            cpu->fBus[1].cc_tag = cpu->I_Queue.cc_pd;
+            cpu->fBus[1].busy = 1;
+        }
+        break;
+    }
 
-        default:
+    case LOP_U:
+    {
+        cpu->I_Queue.rs1 = cpu->iq.rs1[index];
+        cpu->I_Queue.rs2 = cpu->iq.rs2[index];
+        cpu->I_Queue.rs3 = cpu->iq.rs3[index];
+        cpu->I_Queue.rd = cpu->iq.rd[index];
+        cpu->I_Queue.rs1_value = cpu->iq.src1_value[index];
+        cpu->I_Queue.rs2_value = cpu->iq.src2_value[index];
+        cpu->I_Queue.ps1 = cpu->iq.src1_tag[index];
+        cpu->I_Queue.ps2 = cpu->iq.src2_tag[index];
+        cpu->I_Queue.imm = cpu->iq.literal[index];
+        cpu->I_Queue.has_insn = TRUE;
+        cpu->I_Queue.pd = cpu->iq.dest[index];
+        cpu->I_Queue.pc = cpu->iq.pc_value[index];
+        cpu->I_Queue.opcode = cpu->iq.opcode[index];
+        strcpy(cpu->I_Queue.opcode_str, get_opcode_str(cpu->I_Queue.opcode));
+        cpu->I_Queue.rob_index = cpu->iq.rob_index[index];
+        cpu->I_Queue.cc_pd = -1;
+        cpu->LOP_FU = cpu->I_Queue;
+        if (!cpu->fBus[0].busy)
         {
-            break;
+            cpu->fBus[0].tag = cpu->I_Queue.pd;
+            cpu->fBus[0].busy = 1;
         }
+        else if (!cpu->fBus[1].busy)
+        {
+            cpu->fBus[1].tag = cpu->I_Queue.pd;
+            cpu->fBus[1].busy = 1;
         }
         break;
     }
+
+    case MUL_U:
+    {
+        cpu->I_Queue.rs1 = cpu->iq.rs1[index];
+        cpu->I_Queue.rs2 = cpu->iq.rs2[index];
+        cpu->I_Queue.rs3 = cpu->iq.rs3[index];
+        cpu->I_Queue.rd = cpu->iq.rd[index];
+        cpu->I_Queue.rs1_value = cpu->iq.src1_value[index];
+        cpu->I_Queue.rs2_value = cpu->iq.src2_value[index];
+        cpu->I_Queue.ps1 = cpu->iq.src1_tag[index];
+        cpu->I_Queue.ps2 = cpu->iq.src2_tag[index];
+        cpu->I_Queue.imm = cpu->iq.literal[index];
+        cpu->I_Queue.has_insn = TRUE;
+        cpu->I_Queue.pd = cpu->iq.dest[index];
+        cpu->I_Queue.pc = cpu->iq.pc_value[index];
+        cpu->I_Queue.opcode = cpu->iq.opcode[index];
+        strcpy(cpu->I_Queue.opcode_str, get_opcode_str(cpu->I_Queue.opcode));
+        cpu->I_Queue.rob_index = cpu->iq.rob_index[index];
+        cpu->I_Queue.cc_pd = cpu->iq.cc_dest[index];
+        cpu->MUL1_FU = cpu->I_Queue;
+        break;
+    }
+
+    default:
+    {
+        break;
+    }
+    }
     shiftIQElements(cpu, index);
 }
 
+/* MUL3 broadcasts its tag a cycle before MUL4 has the product, so a consumer
+ * woken by it leaves the IQ without the value and picks it up from the bus on
+ * its way into the function unit */
+static void
+snoop_operands(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (!cpu->fBus[i].busy || !cpu->fBus[i].isDataFwd)
+        {
+            continue;
+        }
+        if (cpu->fBus[i].tag == stage->ps1)
+        {
+            stage->rs1_value = cpu->fBus[i].data;
+        }
+        if (cpu->fBus[i].tag == stage->ps2)
+        {
+            stage->rs2_value = cpu->fBus[i].data;
+        }
+    }
+}
+
+/* Sends the flags in CC register cc out on bus along with a result, which
+ * wakes the branches waiting on them */
+static void publish_flags(APEX_CPU *cpu, FB *bus, int cc)
+{
+    bus->cc = cpu->ccf.reg[cc].flag;
+    bus->cc_tag = cc;
+    cpu->ccf.reg[cc].invalid = 0;
+}
+
+/* Puts a result computed in INT_FU on a free bus, with the flags already in
+ * CC register cc unless that is -1. 0 when both buses are taken */
+static int broadcast_result(APEX_CPU *cpu, int tag, int data, int cc)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (!cpu->fBus[i].busy)
+        {
+            cpu->fBus[i].tag = tag;
+            cpu->fBus[i].data = data;
+            cpu->fBus[i].busy = 1;
+            cpu->fBus[i].isDataFwd = 1;
+            if (cc != -1)
+            {
+                publish_flags(cpu, &cpu->fBus[i], cc);
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Compare half of a fused CMP+BZ/BNZ, writes the flags the branch then
+ * resolves on. 0 when there is no bus for them yet */
+static int execute_fused_cmp(APEX_CPU *cpu)
+{
+    int cc = cpu->INT_FU.rs1_value == cpu->INT_FU.rs2_value;
+    cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = cc;
+    return broadcast_result(cpu, NO_DATA_TAG, cc, cpu->INT_FU.cc_pd);
+}
+
+/* Fused ADDL+LOAD: the incremented base goes out on the bus as the ADDL's
+ * result and the load address goes straight into the LSQ entry */
+static void execute_fused_addl(APEX_CPU *cpu)
+{
+    int base = cpu->INT_FU.rs1_value + cpu->INT_FU.fused_imm;
+    cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = base == 0;
+    if (!broadcast_result(cpu, cpu->INT_FU.fused_pd, base, cpu->INT_FU.cc_pd))
+    {
+        return;
+    }
+    cpu->pr.phy_Reg[cpu->INT_FU.fused_pd] = base;
+    cpu->pr.reg_invalid[cpu->INT_FU.fused_pd] = 0;
+    cpu->INT_FU.result_buffer = base + cpu->INT_FU.imm;
+    cpu->INT_FU.has_insn = FALSE;
+    updateLSQEntry(cpu, (cpu->INT_FU.pd + 1) * (-1), cpu->INT_FU.result_buffer);
+}
+
 static void
 APEX_INT_FU(APEX_CPU *cpu)
 {
     if (cpu->INT_FU.has_insn)
     {
+        switch_thread(cpu, cpu->INT_FU.thread);
+        snoop_operands(cpu, &cpu->INT_FU);
         print_stage_content("INT_FU", &cpu->INT_FU);
         if (cpu->fBus[0].busy && cpu->fBus[1].busy)
         {
@@ -1471,120 +2871,126 @@ APEX_INT_FU(APEX_CPU *cpu)
         case OPCODE_ADD:
         {
             cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value + cpu->INT_FU.rs2_value; // recieved from IQ or DR2(need to confirm)
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;       // PR write
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;       // PR write
             if (cpu->INT_FU.result_buffer == 0)
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 1;
             }
             else
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 0;
             }
             if (!cpu->fBus[0].busy)
             {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[0], cpu->INT_FU.cc_pd);
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].isDataFwd = 1;
                 cpu->fBus[0].busy = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
 
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
 
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[1], cpu->INT_FU.cc_pd);
                 cpu->fBus[1].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             break;
         }
         case OPCODE_DIV:
         {
-            cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value / cpu->INT_FU.rs2_value;
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->INT_FU.result_buffer = divide(cpu->INT_FU.rs1_value, cpu->INT_FU.rs2_value);
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             if (cpu->INT_FU.result_buffer == 0)
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 1;
             }
             else
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 0;
             }
             if (!cpu->fBus[0].busy)
             {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[0], cpu->INT_FU.cc_pd);
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[1], cpu->INT_FU.cc_pd);
                 cpu->fBus[1].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             break;
         }
         case OPCODE_SUB:
         {
             cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value - cpu->INT_FU.rs2_value;
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             if (cpu->INT_FU.result_buffer == 0)
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 1;
             }
             else
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 0;
             }
             if (!cpu->fBus[0].busy)
             {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[0], cpu->INT_FU.cc_pd);
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[1], cpu->INT_FU.cc_pd);
                 cpu->fBus[1].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             break;
         }
         case OPCODE_SUBL:
@@ -1592,115 +2998,92 @@ APEX_INT_FU(APEX_CPU *cpu)
             cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value - cpu->INT_FU.imm;
             if (cpu->INT_FU.result_buffer == 0)
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 1;
             }
             else
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 0;
             }
             if (!cpu->fBus[0].busy)
             {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[0], cpu->INT_FU.cc_pd);
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[1], cpu->INT_FU.cc_pd);
                 cpu->fBus[1].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             break;
         }
         case OPCODE_ADDL:
         {
             cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value + cpu->INT_FU.imm;
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             if (cpu->INT_FU.result_buffer == 0)
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 1;
             }
             else
             {
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
+                cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = 0;
             }
             if (!cpu->fBus[0].busy)
             {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[0], cpu->INT_FU.cc_pd);
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
+                publish_flags(cpu, &cpu->fBus[1], cpu->INT_FU.cc_pd);
                 cpu->fBus[1].data = cpu->INT_FU.result_buffer;
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
 
             break;
         }
-        case OPCODE_CMP: // need to discuss
+        case OPCODE_CMP:
         {
-            
-            if (cpu->INT_FU.rs1_value == cpu->INT_FU.rs2_value)
-            {
-                cpu->INT_FU.result_buffer = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 1;
-            }
-            else
-            {
-                cpu->INT_FU.result_buffer = 0;
-                cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag = 0;
-            }
-
-            if (!cpu->fBus[0].busy)
-            {
-                cpu->fBus[0].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
-                cpu->fBus[0].data = cpu->INT_FU.result_buffer;
-                cpu->fBus[0].tag = cpu->INT_FU.pd;
-                cpu->fBus[0].busy = 1;
-                cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
-                cpu->INT_FU.has_insn = FALSE;
-            }
-            else if (!cpu->fBus[1].busy) // check for forw
+            cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value == cpu->INT_FU.rs2_value;
+            cpu->ccf.reg[cpu->INT_FU.cc_pd].flag = cpu->INT_FU.result_buffer;
+            if (broadcast_result(cpu, NO_DATA_TAG, cpu->INT_FU.result_buffer, cpu->INT_FU.cc_pd))
             {
-                cpu->fBus[1].cc = cpu->pr.PR_File[cpu->INT_FU.pd].cc_flag;
-                cpu->fBus[1].data = cpu->INT_FU.result_buffer;
-                cpu->fBus[1].tag = cpu->INT_FU.pd;
-                cpu->fBus[1].busy = 1;
-                cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             break;
@@ -1708,62 +3091,90 @@ APEX_INT_FU(APEX_CPU *cpu)
         case OPCODE_BZ:
         case OPCODE_BNZ:
         {
-            cpu->conditional_pc = cpu->INT_FU.pc + cpu->INT_FU.imm;
-            int i = cpu->bis.head;
-            int tail = cpu->bis.tail;
-            while (i <= tail)
+            if (cpu->INT_FU.fused == FUSE_CMP_BRANCH && !execute_fused_cmp(cpu))
             {
-                BIS_Entry *entry = cpu->bis.entry[i];
-                if (entry != NULL && entry->pc_value == cpu->INT_FU.pc)
-                {
-                    entry->is_exec = 1;
-                    break;
-                }
-                i++;
+                break;
             }
-            if (cpu->pr.PR_File[cpu->INT_FU.branch_reg].cc_flag == 1 ^ cpu->INT_FU.opcode == OPCODE_BZ)
+            cpu->conditional_pc = cpu->INT_FU.pc + cpu->INT_FU.imm;
+            cpu->thread->bis.entry[cpu->INT_FU.bis_index]->is_exec = 1;
+            if ((cpu->ccf.reg[cpu->INT_FU.branch_reg].flag == 1) != (cpu->INT_FU.opcode == OPCODE_BZ))
             {
                 if (cpu->INT_FU.branch_prediction)
                 {
-                    flush_instructions(cpu, cpu->INT_FU.pc);
+                    flush_instructions(cpu, cpu->INT_FU.bis_index);
                     updateBTBEntry(cpu->INT_FU.pc, 0, cpu);
+                    cpu->thread->pc = cpu->INT_FU.pc + 4;
                 }
-                if(cpu->waitingForBranch)
+                /* Only the branch fetch stalled on may redirect it, an older
+                 * branch resolving late would drop a younger one's path */
+                if (cpu->INT_FU.waitingForBranch && cpu->thread->waitingForBranch)
                 {
-                    cpu->waitingForBranch = 0;
-                    cpu->pc = cpu->INT_FU.pc + 4;
+                    cpu->thread->waitingForBranch = 0;
+                    cpu->thread->pc = cpu->INT_FU.pc + 4;
                 }
             }
             else
             {
                 BTB_Entry *entry = getBTBEntry(cpu->INT_FU.pc, cpu);
-                if (cpu->INT_FU.branch_prediction)
+                int pred_target = cpu->thread->bis.entry[cpu->INT_FU.bis_index]->pred_target;
+                if (cpu->INT_FU.branch_prediction && pred_target && pred_target != cpu->conditional_pc)
+                {
+                    /* Fetch followed a target trained by another thread's
+                     * branch at the same pc. The entry is retrained to ours */
+                    flush_instructions(cpu, cpu->INT_FU.bis_index);
+                    cpu->thread->pc = cpu->conditional_pc;
+                    updatePathHistory(cpu, cpu->thread->pc);
+                    cpu->thread->fetch_from_next_cycle = TRUE;
+                    if (entry != NULL)
+                    {
+                        entry->target_address = cpu->conditional_pc;
+                        updateBTBEntry(cpu->INT_FU.pc, 1, cpu);
+                    }
+                    else
+                    {
+                        addBTBEntry(cpu->INT_FU.pc, cpu->conditional_pc, cpu);
+                    }
+                }
+                else if (cpu->INT_FU.branch_prediction)
                 {
                     if (entry != NULL)
                     {
-                        if (!entry->prediction)
+                        /* Only a fetch that did not follow the BTB needs the
+                         * redirect. The entry itself may have been retrained
+                         * since by another thread running the same code */
+                        if (!pred_target)
                         {
+                            entry->target_address = cpu->conditional_pc;
                             updateBTBEntry(cpu->INT_FU.pc, 1, cpu);
-                            cpu->waitingForBranch = 0;
-                            cpu->pc = cpu->conditional_pc;
+                            cpu->thread->waitingForBranch = 0;
+                            cpu->thread->pc = cpu->conditional_pc;
+                            updatePathHistory(cpu, cpu->thread->pc);
                         }
                     }
                     else
                     {
-                        cpu->waitingForBranch = 0;
-                        cpu->pc = cpu->conditional_pc;
-                        cpu->fetch_from_next_cycle = TRUE;
+                        /* A fetch that followed an entry evicted since is
+                         * already on the target */
+                        if (!pred_target)
+                        {
+                            cpu->thread->waitingForBranch = 0;
+                            cpu->thread->pc = cpu->conditional_pc;
+                            updatePathHistory(cpu, cpu->thread->pc);
+                            cpu->thread->fetch_from_next_cycle = TRUE;
+                        }
                         addBTBEntry(cpu->INT_FU.pc, cpu->conditional_pc, cpu);
                     }
                 }
                 else
                 {
-                    flush_instructions(cpu, cpu->INT_FU.pc);
-                    cpu->pc = cpu->conditional_pc;
-                    cpu->waitingForBranch = 0;
-                    cpu->fetch_from_next_cycle = TRUE;
+                    flush_instructions(cpu, cpu->INT_FU.bis_index);
+                    cpu->thread->pc = cpu->conditional_pc;
+                    updatePathHistory(cpu, cpu->thread->pc);
+                    cpu->thread->waitingForBranch = 0;
+                    cpu->thread->fetch_from_next_cycle = TRUE;
                     if (entry != NULL)
                     {
+                        entry->target_address = cpu->conditional_pc;
                         updateBTBEntry(cpu->INT_FU.pc, 1, cpu);
                     }
                     else
@@ -1772,8 +3183,9 @@ APEX_INT_FU(APEX_CPU *cpu)
                     }
                 }
             }
-            cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-            cpu->pe[arr_index].is_exec = 1;
+            cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+            cpu->thread->pe[arr_index].is_exec = 1;
+            cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
             cpu->INT_FU.has_insn = FALSE;
             break;
         }
@@ -1800,8 +3212,14 @@ APEX_INT_FU(APEX_CPU *cpu)
             }
             break;
         }
+        case OPCODE_FADD:
         case OPCODE_LOAD:
         {
+            if (cpu->INT_FU.fused == FUSE_ADDL_LOAD)
+            {
+                execute_fused_addl(cpu);
+                break;
+            }
             cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value + cpu->INT_FU.imm;
             if (!cpu->fBus[0].busy)
             {
@@ -1830,9 +3248,10 @@ APEX_INT_FU(APEX_CPU *cpu)
                 cpu->fBus[0].tag = cpu->INT_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
@@ -1841,19 +3260,20 @@ APEX_INT_FU(APEX_CPU *cpu)
                 cpu->fBus[1].tag = cpu->INT_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->INT_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
                 cpu->INT_FU.has_insn = FALSE;
             }
 
-            cpu->pr.PR_File[cpu->INT_FU.pd].phy_Reg = cpu->INT_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
             break;
         }
 
         case OPCODE_STORE:
         {
-            cpu->INT_FU.result_buffer = cpu->INT_FU.rs1_value + cpu->INT_FU.imm;
+            cpu->INT_FU.result_buffer = cpu->INT_FU.rs2_value + cpu->INT_FU.imm;
             if (!cpu->fBus[0].busy)
             {
                 cpu->fBus[0].data = cpu->INT_FU.result_buffer;
@@ -1894,21 +3314,66 @@ APEX_INT_FU(APEX_CPU *cpu)
             break;
         }
         case OPCODE_JUMP:
+        case OPCODE_JAL:
+        case OPCODE_RET:
         {
-            cpu->conditional_pc = cpu->INT_FU.pc + cpu->INT_FU.imm + cpu->INT_FU.rs1_value;
-            cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-            cpu->pe[arr_index].is_exec = 1;
-            cpu->pc = cpu->conditional_pc;
-            cpu->fetch_from_next_cycle = TRUE;
-            cpu->waitingForBranch = 0;
+            cpu->conditional_pc = cpu->INT_FU.rs1_value + cpu->INT_FU.imm;
+            BIS_Entry *bis_entry = cpu->thread->bis.entry[cpu->INT_FU.bis_index];
+            bis_entry->is_exec = 1;
+            if (cpu->INT_FU.opcode == OPCODE_JAL)
+            {
+                /* Link register receives the return address */
+                cpu->INT_FU.result_buffer = cpu->INT_FU.pc + 4;
+                cpu->pr.phy_Reg[cpu->INT_FU.pd] = cpu->INT_FU.result_buffer;
+                if (!cpu->fBus[0].busy)
+                {
+                    cpu->fBus[0].data = cpu->INT_FU.result_buffer;
+                    cpu->fBus[0].tag = cpu->INT_FU.pd;
+                    cpu->fBus[0].busy = 1;
+                    cpu->fBus[0].isDataFwd = 1;
+                }
+                else
+                {
+                    cpu->fBus[1].data = cpu->INT_FU.result_buffer;
+                    cpu->fBus[1].tag = cpu->INT_FU.pd;
+                    cpu->fBus[1].busy = 1;
+                    cpu->fBus[1].isDataFwd = 1;
+                }
+                cpu->pr.reg_invalid[cpu->INT_FU.pd] = 0;
+            }
+            if (cpu->INT_FU.opcode != OPCODE_RET)
+            {
+                updateITPEntry(cpu, bis_entry->itp_index, cpu->INT_FU.pc, cpu->conditional_pc);
+            }
+            if (cpu->INT_FU.branch_prediction)
+            {
+                if (bis_entry->pred_target != cpu->conditional_pc)
+                {
+                    flush_instructions(cpu, cpu->INT_FU.bis_index);
+                    cpu->thread->pc = cpu->conditional_pc;
+                    updatePathHistory(cpu, cpu->thread->pc);
+                }
+            }
+            else
+            {
+                cpu->thread->pc = cpu->conditional_pc;
+                updatePathHistory(cpu, cpu->thread->pc);
+                cpu->thread->fetch_from_next_cycle = TRUE;
+                cpu->thread->waitingForBranch = 0;
+            }
+            cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+            cpu->thread->pe[arr_index].is_exec = 1;
+            cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
             cpu->INT_FU.has_insn = FALSE;
             break;
         }
         case OPCODE_NOP:
+        case OPCODE_FENCE:
         case OPCODE_HALT:
         {
-            cpu->pe[arr_index].pc_value = cpu->INT_FU.pc;
-            cpu->pe[arr_index].is_exec = 1;
+            cpu->thread->pe[arr_index].pc_value = cpu->INT_FU.pc;
+            cpu->thread->pe[arr_index].is_exec = 1;
+            cpu->thread->rob.isExecuted[cpu->INT_FU.rob_index] = 1;
             cpu->INT_FU.has_insn = FALSE;
             break;
         }
@@ -1928,6 +3393,8 @@ APEX_LOP_FU(APEX_CPU *cpu)
 {
     if (cpu->LOP_FU.has_insn)
     {
+        switch_thread(cpu, cpu->LOP_FU.thread);
+        snoop_operands(cpu, &cpu->LOP_FU);
         print_stage_content("LOP_FU", &cpu->LOP_FU);
         if (cpu->fBus[0].busy && cpu->fBus[1].busy)
         {
@@ -1939,7 +3406,7 @@ APEX_LOP_FU(APEX_CPU *cpu)
         case OPCODE_XOR:
         {
             cpu->LOP_FU.result_buffer = cpu->LOP_FU.rs1_value ^ cpu->LOP_FU.rs2_value;
-            cpu->pr.PR_File[cpu->LOP_FU.pd].phy_Reg = cpu->LOP_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->LOP_FU.pd] = cpu->LOP_FU.result_buffer;
 
             if (!cpu->fBus[0].busy)
             {
@@ -1947,9 +3414,10 @@ APEX_LOP_FU(APEX_CPU *cpu)
                 cpu->fBus[0].tag = cpu->LOP_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
@@ -1958,9 +3426,10 @@ APEX_LOP_FU(APEX_CPU *cpu)
                 cpu->fBus[1].tag = cpu->LOP_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
 
@@ -1969,16 +3438,17 @@ APEX_LOP_FU(APEX_CPU *cpu)
         case OPCODE_OR:
         {
             cpu->LOP_FU.result_buffer = cpu->LOP_FU.rs1_value | cpu->LOP_FU.rs2_value;
-            cpu->pr.PR_File[cpu->LOP_FU.pd].phy_Reg = cpu->LOP_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->LOP_FU.pd] = cpu->LOP_FU.result_buffer;
             if (!cpu->fBus[0].busy)
             {
                 cpu->fBus[0].data = cpu->LOP_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->LOP_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
@@ -1987,9 +3457,10 @@ APEX_LOP_FU(APEX_CPU *cpu)
                 cpu->fBus[1].tag = cpu->LOP_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
             break;
@@ -1997,16 +3468,17 @@ APEX_LOP_FU(APEX_CPU *cpu)
         case OPCODE_AND:
         {
             cpu->LOP_FU.result_buffer = cpu->LOP_FU.rs1_value & cpu->LOP_FU.rs2_value;
-            cpu->pr.PR_File[cpu->LOP_FU.pd].phy_Reg = cpu->LOP_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->LOP_FU.pd] = cpu->LOP_FU.result_buffer;
             if (!cpu->fBus[0].busy)
             {
                 cpu->fBus[0].data = cpu->LOP_FU.result_buffer;
                 cpu->fBus[0].tag = cpu->LOP_FU.pd;
                 cpu->fBus[0].busy = 1;
                 cpu->fBus[0].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
             else if (!cpu->fBus[1].busy) // check for forw
@@ -2015,9 +3487,10 @@ APEX_LOP_FU(APEX_CPU *cpu)
                 cpu->fBus[1].tag = cpu->LOP_FU.pd;
                 cpu->fBus[1].busy = 1;
                 cpu->fBus[1].isDataFwd = 1;
-                cpu->pr.PR_File[cpu->LOP_FU.pd].reg_invalid = 0;
-                cpu->pe[arr_index].pc_value = cpu->LOP_FU.pc;
-                cpu->pe[arr_index].is_exec = 1;
+                cpu->pr.reg_invalid[cpu->LOP_FU.pd] = 0;
+                cpu->thread->pe[arr_index].pc_value = cpu->LOP_FU.pc;
+                cpu->thread->pe[arr_index].is_exec = 1;
+                cpu->thread->rob.isExecuted[cpu->LOP_FU.rob_index] = 1;
                 cpu->LOP_FU.has_insn = FALSE;
             }
             break;
@@ -2038,6 +3511,7 @@ APEX_MUL1_FU(APEX_CPU *cpu)
 {
     if (cpu->MUL1_FU.has_insn)
     {
+        snoop_operands(cpu, &cpu->MUL1_FU);
         print_stage_content("MUL1_FU", &cpu->MUL1_FU);
         if (cpu->MUL1_FU.opcode == OPCODE_MUL)
         {
@@ -2083,6 +3557,7 @@ APEX_MUL3_FU(APEX_CPU *cpu)
 {
     if (cpu->MUL3_FU.has_insn)
     {
+        switch_thread(cpu, cpu->MUL3_FU.thread);
         print_stage_content("MUL3_FU", &cpu->MUL3_FU);
         if (cpu->fBus[0].busy && cpu->fBus[1].busy)
         {
@@ -2096,6 +3571,7 @@ APEX_MUL3_FU(APEX_CPU *cpu)
         if (!cpu->fBus[0].busy)
         {
             cpu->fBus[0].tag = cpu->MUL3_FU.pd;
+            cpu->fBus[0].cc_tag = cpu->MUL3_FU.cc_pd;
             cpu->fBus[0].busy = 1;
             cpu->fBus[0].isDataFwd = 0;
             cpu->MUL3_FU.has_insn = FALSE;
@@ -2103,8 +3579,9 @@ APEX_MUL3_FU(APEX_CPU *cpu)
         else if (!cpu->fBus[1].busy) // check for forw
         {
             cpu->fBus[1].tag = cpu->MUL3_FU.pd;
+            cpu->fBus[1].cc_tag = cpu->MUL3_FU.cc_pd;
             cpu->fBus[1].busy = 1;
-            cpu->fBus[0].isDataFwd = 0;
+            cpu->fBus[1].isDataFwd = 0;
             cpu->MUL3_FU.has_insn = FALSE;
         }
         cpu->MUL4_FU = cpu->MUL3_FU;
@@ -2125,6 +3602,7 @@ APEX_MUL4_FU(APEX_CPU *cpu)
 {
     if (cpu->MUL4_FU.has_insn)
     {
+        switch_thread(cpu, cpu->MUL4_FU.thread);
         print_stage_content("MUL4_FU", &cpu->MUL4_FU);
         if (cpu->fBus[0].busy && cpu->fBus[1].busy)
         {
@@ -2134,38 +3612,40 @@ APEX_MUL4_FU(APEX_CPU *cpu)
         if (cpu->MUL4_FU.opcode == OPCODE_MUL)
         {
             cpu->MUL4_FU.result_buffer = cpu->MUL4_FU.rs1_value * cpu->MUL4_FU.rs2_value;
-            cpu->pr.PR_File[cpu->MUL4_FU.pd].phy_Reg = cpu->MUL4_FU.result_buffer;
+            cpu->pr.phy_Reg[cpu->MUL4_FU.pd] = cpu->MUL4_FU.result_buffer;
         }
         if (cpu->MUL4_FU.result_buffer == 0)
         {
-            cpu->pr.PR_File[cpu->MUL4_FU.pd].cc_flag = 1;
+            cpu->ccf.reg[cpu->MUL4_FU.cc_pd].flag = 1;
         }
         else
         {
-            cpu->pr.PR_File[cpu->MUL4_FU.pd].cc_flag = 0;
+            cpu->ccf.reg[cpu->MUL4_FU.cc_pd].flag = 0;
         }
         if (!cpu->fBus[0].busy)
         {
-            cpu->fBus[0].cc = cpu->pr.PR_File[cpu->MUL4_FU.pd].cc_flag;
+            publish_flags(cpu, &cpu->fBus[0], cpu->MUL4_FU.cc_pd);
             cpu->fBus[0].data = cpu->MUL4_FU.result_buffer;
             cpu->fBus[0].tag = cpu->MUL4_FU.pd;
             cpu->fBus[0].busy = 1;
             cpu->fBus[0].isDataFwd = 1;
-            cpu->pr.PR_File[cpu->MUL4_FU.pd].reg_invalid = 0;
-            cpu->pe[arr_index].pc_value = cpu->MUL4_FU.pc;
-            cpu->pe[arr_index].is_exec = 1;
+            cpu->pr.reg_invalid[cpu->MUL4_FU.pd] = 0;
+            cpu->thread->pe[arr_index].pc_value = cpu->MUL4_FU.pc;
+            cpu->thread->pe[arr_index].is_exec = 1;
+            cpu->thread->rob.isExecuted[cpu->MUL4_FU.rob_index] = 1;
             cpu->MUL4_FU.has_insn = FALSE;
         }
         else if (!cpu->fBus[1].busy) // check for forw
         {
-            cpu->fBus[1].cc = cpu->pr.PR_File[cpu->MUL4_FU.pd].cc_flag;
+            publish_flags(cpu, &cpu->fBus[1], cpu->MUL4_FU.cc_pd);
             cpu->fBus[1].data = cpu->MUL4_FU.result_buffer;
             cpu->fBus[1].tag = cpu->MUL4_FU.pd;
             cpu->fBus[1].busy = 1;
             cpu->fBus[1].isDataFwd = 1;
-            cpu->pr.PR_File[cpu->MUL4_FU.pd].reg_invalid = 0;
-            cpu->pe[arr_index].pc_value = cpu->MUL4_FU.pc;
-            cpu->pe[arr_index].is_exec = 1;
+            cpu->pr.reg_invalid[cpu->MUL4_FU.pd] = 0;
+            cpu->thread->pe[arr_index].pc_value = cpu->MUL4_FU.pc;
+            cpu->thread->pe[arr_index].is_exec = 1;
+            cpu->thread->rob.isExecuted[cpu->MUL4_FU.rob_index] = 1;
             cpu->MUL4_FU.has_insn = FALSE;
         }
     }
@@ -2178,112 +3658,155 @@ APEX_MUL4_FU(APEX_CPU *cpu)
     }
 }
 
-int do_commit(APEX_CPU *cpu)
+/* Architectural flags now come from the retiring CC register, the one it
+ * replaced in the rename state can be reused */
+static void retire_flags(APEX_CPU *cpu, int rob_index)
 {
-    ROB_Entry *entry = getROBHead(cpu);
-    if (entry == NULL)
+    if (cpu->thread->rob.cc_dest[rob_index] == -1)
+    {
+        return;
+    }
+    cpu->thread->regs[8] = cpu->ccf.reg[cpu->thread->rob.cc_dest[rob_index]].flag;
+    releaseCC(cpu, cpu->thread->rob.cc_prev[rob_index]);
+}
+
+/* Passes each instruction of a retiring micro-op, in program order, to what
+ * is built from the retired PC stream */
+static void retire_pc(APEX_CPU *cpu, int pc_value)
+{
+    if (ENABLE_TRACE_CACHE)
+    {
+        fill_trace(cpu, pc_value);
+    }
+    if (cpu->bbv)
+    {
+        recordBasicBlock(cpu, pc_value);
+    }
+}
+
+/* Retires the ROB head if it is ready. Returns 0 when the head cannot retire
+ * this cycle, 1 when it retired and 2 when the retired instruction is a HALT */
+static int commit_instruction(APEX_CPU *cpu, int *stores)
+{
+    int head = getROBHead(cpu);
+    if (head == -1)
     {
-        print_stage_empty_state("Commitment", &cpu->commit);
         return 0;
     }
-    cpu->commit.pc = entry->pc_value;
-    switch (entry->instruction_type)
+    cpu->commit.pc = cpu->thread->rob.pc_value[head];
+    switch (cpu->thread->rob.instruction_type[head])
     {
     case R2R:
     {
-        int arr_index = (entry->pc_value / 4) - 1000;
-        int is_executed = cpu->pe[arr_index].is_exec;
-        int isInvalid = cpu->pr.PR_File[entry->dest_phy_reg].reg_invalid;
-        if (isInvalid || !is_executed)
+        /* Keyed by ROB entry, not PC, since a younger copy of the same PC
+         * can be fetched before this one retires */
+        int is_executed = cpu->thread->rob.isExecuted[head];
+        if (!is_executed)
         {
-            print_stage_empty_state("Commitment", &cpu->commit);
             return 0;
         }
-        else if (!isInvalid && is_executed)
+        /* A CMP has only a CC register */
+        if (cpu->thread->rob.dest_phy_reg[head] != -1)
         {
-            cpu->regs[entry->dest_arch_reg] = cpu->pr.PR_File[entry->dest_phy_reg].phy_Reg;
-            cpu->pr.PR_File[entry->prev_phy_reg].reg_invalid = 1;
-            cpu->regs[8] = cpu->pr.PR_File[entry->dest_phy_reg].cc_flag;
-            enqueueFreeList(entry->prev_phy_reg, cpu);
+            if (cpu->pr.reg_invalid[cpu->thread->rob.dest_phy_reg[head]])
+            {
+                return 0;
+            }
+            cpu->thread->regs[cpu->thread->rob.dest_arch_reg[head]] = cpu->pr.phy_Reg[cpu->thread->rob.dest_phy_reg[head]];
+            releasePR(cpu, cpu->thread->rob.prev_phy_reg[head]);
         }
+        retire_flags(cpu, head);
         break;
     }
 
     case LOAD:
     {
-        if (entry->lsq_index == cpu->lsq.head)
+        /* Loads execute out of the LSQ, they only retire here. Memory
+         * instructions commit in order, so the load is the LSQ head */
+        int lsq_index = cpu->thread->rob.lsq_index[head];
+        if (!cpu->thread->lsq.is_done[lsq_index])
         {
-            APEX_D_cache(cpu);
-            if (entry->lsq_index == cpu->lsq.head)
-            {
-                print_stage_empty_state("Commitment(D-cache)", &cpu->commit);
-                return 0;
-            }
-            cpu->regs[entry->dest_arch_reg] = cpu->pr.PR_File[entry->dest_phy_reg].phy_Reg;
-            cpu->pr.PR_File[entry->prev_phy_reg].reg_invalid = 1;
-            enqueueFreeList(entry->prev_phy_reg, cpu);
+            return 0;
+        }
+        if (cpu->thread->rob.fused[head] == FUSE_ADDL_LOAD)
+        {
+            cpu->thread->regs[cpu->thread->rob.fused_arch_reg[head]] = cpu->pr.phy_Reg[cpu->thread->rob.fused_dest_phy_reg[head]];
+            releasePR(cpu, cpu->thread->rob.fused_prev_phy_reg[head]);
+            retire_flags(cpu, head);
+            cpu->addl_loads_fused++;
+            cpu->insn_completed++;
         }
+        /* The ROB holds the LSQ index for loads, the LSQ holds the PR */
+        int dest_phy_reg = cpu->thread->lsq.dest_reg_address[lsq_index];
+        cpu->thread->regs[cpu->thread->rob.dest_arch_reg[head]] = cpu->pr.phy_Reg[dest_phy_reg];
+        releasePR(cpu, cpu->thread->rob.prev_phy_reg[head]);
+        removeLSQHead(cpu);
         break;
     }
 
     case STORE:
     {
-        if (entry->lsq_index == cpu->lsq.head)
+        /* The store moves to the store buffer with its address and data,
+         * so a D-cache miss never holds up retirement. Memory instructions
+         * commit in order, so it is the LSQ head */
+        int lsq_index = cpu->thread->rob.lsq_index[head];
+        if (*stores == COMMIT_STORE_WIDTH || !cpu->thread->lsq.mem_valid_bit[lsq_index] || !cpu->thread->lsq.src_valid_bit[lsq_index])
         {
-            APEX_D_cache(cpu);
-            if (entry->lsq_index == cpu->lsq.head)
-            {
-                print_stage_empty_state("Commitment(D-cache)", &cpu->commit);
-                return 0;
-            }
+            return 0;
+        }
+        if (cpu->thread->sb.count == STORE_BUFFER_SIZE)
+        {
+            cpu->store_buffer_full_cycles++;
+            return 0;
         }
+        int tail = (cpu->thread->sb.head + cpu->thread->sb.count++) % STORE_BUFFER_SIZE;
+        cpu->thread->sb.mem_address[tail] = cpu->thread->lsq.mem_address[lsq_index];
+        cpu->thread->sb.value[tail] = cpu->thread->lsq.src_value[lsq_index];
+        cpu->thread->sb.pc_value[tail] = cpu->thread->lsq.pc_value[lsq_index];
+        cpu->thread->sb.mem_cycles[tail] = -1;
+        removeLSQHead(cpu);
+        (*stores)++;
         break;
     }
 
     case HALT:
     case NOP:
     {
-        int arr_index = (entry->pc_value / 4) - 1000;
-        int is_executed = cpu->pe[arr_index].is_exec;
+        int is_executed = cpu->thread->rob.isExecuted[head];
         if (!is_executed)
         {
-            print_stage_empty_state("Commitment", &cpu->commit);
             return 0;
         }
         break;
     }
     case BRANCH:
     {
-        int i = cpu->bis.head;
-        int tail = cpu->bis.tail;
-        while (i <= tail)
+        /* Branches commit in order, so the committing branch owns the BIS head */
+        BIS_Entry *bis_entry = cpu->thread->bis.entry[cpu->thread->bis.head];
+        if (!bis_entry->is_exec)
         {
-            BIS_Entry *bis_entry = cpu->bis.entry[i];
-            if (bis_entry->pc_value == entry->pc_value)
-            {
-                if (!bis_entry->is_exec)
-                {
-                    print_stage_empty_state("Commitment", &cpu->commit);
-                    return 0;
-                }
-                else
-                {
-                    bis_entry->is_exec = 0;
-                    break;
-                }
-            }
-            i++;
+            return 0;
+        }
+        if (cpu->thread->rob.fused[head] == FUSE_CMP_BRANCH)
+        {
+            retire_flags(cpu, head);
+            cpu->cmp_branches_fused++;
+            cpu->insn_completed++;
         }
         break;
     }
     }
-    APEX_Instruction *instr = &cpu->code_memory[get_code_memory_index_from_pc(entry->pc_value)];
+    APEX_Instruction *instr = &cpu->thread->code_memory[get_code_memory_index_from_pc(cpu->thread->rob.pc_value[head])];
+    if (cpu->thread->rob.pc_value[head] && is_control_transfer(instr->opcode))
+    {
+        removeBISHead(cpu);
+    }
     cpu->commit.rd = instr->rd;
     cpu->commit.rs1 = instr->rs1;
     cpu->commit.rs2 = instr->rs2;
     cpu->commit.rs3 = instr->rs3;
     cpu->commit.imm = instr->imm;
-    if(!entry->pc_value)
+    if(!cpu->thread->rob.pc_value[head])
     {
         strcpy(cpu->commit.opcode_str, "NOP");
         cpu->commit.opcode = OPCODE_NOP;
@@ -2293,64 +3816,365 @@ int do_commit(APEX_CPU *cpu)
         cpu->commit.opcode = instr->opcode;
     }
     
+    if (cpu->thread->rob.pc_value[head])
+    {
+        if (cpu->thread->rob.fused[head] == FUSE_CMP_BRANCH)
+        {
+            retire_pc(cpu, cpu->thread->rob.pc_value[head] - 4);
+        }
+        retire_pc(cpu, cpu->thread->rob.pc_value[head]);
+        if (cpu->thread->rob.fused[head] == FUSE_ADDL_LOAD)
+        {
+            retire_pc(cpu, cpu->thread->rob.pc_value[head] + 4);
+        }
+    }
     print_stage_content("Commitment", &cpu->commit);
     removeROBHead(cpu);
-    if (entry->instruction_type == HALT)
+    cpu->insn_completed++;
+    if (cpu->thread->rob.instruction_type[head] == HALT)
     {
-        return 1;
+        return 2;
     }
-    return 0;
+    return 1;
 }
 
-void APEX_D_cache(APEX_CPU *cpu)
+/* Retires up to COMMIT_WIDTH instructions, each thread in its own program
+ * order and stopping at its first one that is not ready. The threads share
+ * the width, the one going first alternates every cycle. Returns 1 once
+ * every thread's HALT has retired */
+int do_commit(APEX_CPU *cpu)
 {
-    int head = cpu->lsq.head;
-    int tail = cpu->lsq.tail;
-    LSQ_Entry *entry = cpu->lsq.entry[head];
-    if (!entry->mem_valid_bit)
+    int retired = 0;
+    int stores = 0;
+
+    for (int i = 0; i < cpu->num_threads; i++)
     {
-        return;
+        int tid = (cpu->clock + i) % cpu->num_threads;
+        if (cpu->threads[tid].halted)
+        {
+            continue;
+        }
+        switch_thread(cpu, tid);
+        int completed = cpu->insn_completed;
+        int status = 0;
+        while (retired < COMMIT_WIDTH)
+        {
+            status = commit_instruction(cpu, &stores);
+            if (status == 0)
+            {
+                break;
+            }
+            retired++;
+            if (status == 2)
+            {
+                break;
+            }
+        }
+        cpu->threads[tid].insn_completed += cpu->insn_completed - completed;
+        if (status == 2)
+        {
+            cpu->threads[tid].halted = TRUE;
+            cpu->threads_halted++;
+        }
     }
-    int lost = entry->lost;
-    if (lost)
+    if (!retired)
     {
-        int pr = entry->dest_reg_address;
-        cpu->pr.PR_File[pr].phy_Reg = cpu->data_memory[entry->mem_address];
-        return;
+        print_stage_empty_state("Commitment", &cpu->commit);
     }
-    else
+    cpu->retire_histogram[retired]++;
+    if (cpu->threads_halted < cpu->num_threads)
     {
-        cpu->data_memory[entry->mem_address] = entry->src_value;
-        return;
+        return FALSE;
     }
-    if (head == tail)
+    /* The program ends once its stores are in memory */
+    for (int i = 0; i < cpu->num_threads; i++)
+    {
+        if (cpu->threads[i].sb.count)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Drains the store buffer. The oldest store that has not started takes the
+ * D-cache write port if it is free, a miss holds an MSHR while the stores
+ * behind it start. Memory is written in program order, so other cores never
+ * see a younger store before an older one */
+void APEX_D_cache(APEX_CPU *cpu, int *port_free)
+{
+    Store_Buffer *sb = &cpu->thread->sb;
+    for (int n = 0; n < sb->count; n++)
+    {
+        int i = (sb->head + n) % STORE_BUFFER_SIZE;
+        if (sb->mem_cycles[i] == -1)
+        {
+            if (!*port_free)
+            {
+                break;
+            }
+            lock_bus(cpu);
+            sb->mem_cycles[i] = accessCacheNonBlocking(&cpu->l1d, sb->mem_address[i], TRUE, cpu->clock);
+            if (sb->mem_cycles[i] != -1)
+            {
+                observePrefetcher(&cpu->prefetcher, &cpu->l1d, sb->pc_value[i], sb->mem_address[i], cpu->clock);
+            }
+            unlock_bus(cpu);
+            if (sb->mem_cycles[i] == -1)
+            {
+                break;
+            }
+            *port_free = FALSE;
+        }
+        if (sb->mem_cycles[i] > 0)
+        {
+            sb->mem_cycles[i]--;
+        }
+    }
+    while (sb->count && sb->mem_cycles[sb->head] == 0)
+    {
+        lock_bus(cpu);
+        writeDataMemory(cpu->data_memory, sb->mem_address[sb->head], sb->value[sb->head]);
+        unlock_bus(cpu);
+        sb->head = (sb->head + 1) % STORE_BUFFER_SIZE;
+        sb->count--;
+    }
+}
+
+/* Youngest store buffer entry writing address, -1 for none */
+static int
+getBufferedStore(APEX_CPU *cpu, int address)
+{
+    for (int n = cpu->thread->sb.count - 1; n >= 0; n--)
+    {
+        int i = (cpu->thread->sb.head + n) % STORE_BUFFER_SIZE;
+        if (cpu->thread->sb.mem_address[i] == address)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Looks for the youngest store older than the load at load_index that writes
+ * the load's address. Returns its index, -1 when memory has the value, or -2
+ * when the load has to wait for an older store of its store set to compute
+ * its address or for an older atomic. Other unknown store addresses are
+ * speculated past and flagged in *speculative */
+static int
+getForwardingStore(APEX_CPU *cpu, int load_index, int *speculative)
+{
+    int match = -1;
+    *speculative = FALSE;
+    if (load_index == cpu->thread->lsq.head)
+    {
+        return -1;
+    }
+    unsigned long long same_address[TAG_MASK_WORDS(LSQ_SIZE)];
+    matchTags(cpu->thread->lsq.mem_address, LSQ_SIZE, cpu->thread->lsq.mem_address[load_index], same_address);
+    for (int i = cpu->thread->lsq.head; i != load_index; i = (i + 1) % LSQ_SIZE)
+    {
+        if (cpu->thread->lsq.is_atomic[i] && !cpu->thread->lsq.is_done[i])
+        {
+            return -2;
+        }
+        if (cpu->thread->lsq.lost[i])
+        {
+            continue;
+        }
+        if (!cpu->thread->lsq.mem_valid_bit[i])
+        {
+            if (cpu->thread->lsq.store_set[load_index] && cpu->thread->lsq.store_set[i] == cpu->thread->lsq.store_set[load_index])
+            {
+                return -2;
+            }
+            *speculative = TRUE;
+            continue;
+        }
+        if (isSlotSet(same_address, i))
+        {
+            match = i;
+        }
+    }
+    return match;
+}
+
+/* Performs the read-modify-write of the atomic at index once it heads both
+ * the LSQ and the ROB and the store buffer is empty, so it never runs on a
+ * wrong path and everything older has been performed. The line is taken
+ * for writing, which
+ * invalidates every other core's copy, and the bus is held across the read
+ * and the write. Returns TRUE when the access started */
+static int
+execute_atomic(APEX_CPU *cpu, int index)
+{
+    if (index != cpu->thread->lsq.head || cpu->thread->lsq.rob_index[index] != cpu->thread->rob.head || !cpu->thread->lsq.mem_valid_bit[index] ||
+        cpu->thread->sb.count)
+    {
+        return FALSE;
+    }
+    lock_bus(cpu);
+    int latency = accessCacheNonBlocking(&cpu->l1d, cpu->thread->lsq.mem_address[index], TRUE, cpu->clock);
+    if (latency != -1)
+    {
+        cpu->thread->lsq.src_value[index] = readDataMemory(cpu->data_memory, cpu->thread->lsq.mem_address[index]);
+        writeDataMemory(cpu->data_memory, cpu->thread->lsq.mem_address[index],
+                        cpu->thread->lsq.src_value[index] + cpu->pr.phy_Reg[cpu->thread->lsq.src_tag[index]]);
+    }
+    unlock_bus(cpu);
+    if (latency == -1)
+    {
+        return FALSE;
+    }
+    cpu->thread->lsq.mem_cycles[index] = latency;
+    cpu->atomics_executed++;
+    return TRUE;
+}
+
+/* Loads leave the LSQ for memory as soon as their address is known, rather
+ * than waiting for the ROB head. Older stores with unknown addresses are
+ * assumed not to alias unless the store set predictor says otherwise, and
+ * updateLSQEntry replays the load if that was wrong. A matching older store
+ * supplies the data directly. One load starts per cycle on the
+ * single D-cache port, finished loads write back on a free forwarding bus */
+static void
+execute_loads(APEX_CPU *cpu, int *port_free)
+{
+    if (isLSQEmpty(cpu))
     {
-        cpu->lsq.head = -1;
-        cpu->lsq.tail = -1;
         return;
     }
-    cpu->lsq.head = (head + 1) % LSQ_SIZE;
-    return;
+    for (int i = cpu->thread->lsq.head;; i = (i + 1) % LSQ_SIZE)
+    {
+        if (cpu->thread->lsq.lost[i] && !cpu->thread->lsq.is_done[i])
+        {
+            if (cpu->thread->lsq.is_atomic[i])
+            {
+                if (cpu->thread->lsq.mem_cycles[i] == -1 && *port_free && execute_atomic(cpu, i))
+                {
+                    *port_free = FALSE;
+                }
+            }
+            else if (cpu->thread->lsq.mem_cycles[i] == -1 && cpu->thread->lsq.mem_valid_bit[i])
+            {
+                int speculative;
+                int store = getForwardingStore(cpu, i, &speculative);
+                int buffered = store == -1 ? getBufferedStore(cpu, cpu->thread->lsq.mem_address[i]) : -1;
+                if (store >= 0 && cpu->thread->lsq.src_valid_bit[store])
+                {
+                    cpu->thread->lsq.src_value[i] = cpu->thread->lsq.src_value[store];
+                    cpu->thread->lsq.fwd_index[i] = store;
+                    cpu->thread->lsq.mem_cycles[i] = 1;
+                    cpu->loads_forwarded++;
+                    cpu->loads_speculated += speculative;
+                }
+                else if (buffered != -1)
+                {
+                    /* Older than every store in the LSQ, like memory */
+                    cpu->thread->lsq.src_value[i] = cpu->thread->sb.value[buffered];
+                    cpu->thread->lsq.fwd_index[i] = -1;
+                    cpu->thread->lsq.mem_cycles[i] = 1;
+                    cpu->loads_forwarded++;
+                    cpu->loads_buffer_forwarded++;
+                    cpu->loads_speculated += speculative;
+                }
+                else if (store == -1 && *port_free)
+                {
+                    /* With every MSHR busy a miss waits, but a later hit can
+                     * still use the port */
+                    lock_bus(cpu);
+                    int latency = accessCacheNonBlocking(&cpu->l1d, cpu->thread->lsq.mem_address[i], FALSE, cpu->clock);
+                    if (latency != -1)
+                    {
+                        observePrefetcher(&cpu->prefetcher, &cpu->l1d, cpu->thread->lsq.pc_value[i], cpu->thread->lsq.mem_address[i], cpu->clock);
+                        *port_free = FALSE;
+                        cpu->thread->lsq.fwd_index[i] = -1;
+                        cpu->loads_speculated += speculative;
+                        cpu->thread->lsq.mem_cycles[i] = latency;
+                        cpu->thread->lsq.src_value[i] = readDataMemory(cpu->data_memory, cpu->thread->lsq.mem_address[i]);
+                    }
+                    unlock_bus(cpu);
+                }
+            }
+            if (cpu->thread->lsq.mem_cycles[i] > 0)
+            {
+                cpu->thread->lsq.mem_cycles[i]--;
+            }
+            /* Dependents of a predicted load already have its value, it
+             * only has to be checked, not broadcast */
+            if (cpu->thread->lsq.mem_cycles[i] == 0 && (cpu->thread->lsq.value_predicted[i] || !(cpu->fBus[0].busy && cpu->fBus[1].busy)))
+            {
+                int pr = cpu->thread->lsq.dest_reg_address[i];
+                cpu->pr.phy_Reg[pr] = cpu->thread->lsq.src_value[i];
+                cpu->pr.reg_invalid[pr] = 0;
+                cpu->thread->lsq.is_done[i] = TRUE;
+                cpu->loads_executed++;
+                if (ENABLE_VALUE_PREDICTION && !cpu->thread->lsq.is_atomic[i])
+                {
+                    trainValuePredictor(cpu, cpu->thread->lsq.pc_value[i], cpu->thread->lsq.src_value[i]);
+                }
+                if (cpu->thread->lsq.value_predicted[i] && cpu->thread->lsq.predicted_value[i] != cpu->thread->lsq.src_value[i])
+                {
+                    /* Everything younger in the LSQ is squashed with it */
+                    recover_value_misprediction(cpu, i);
+                    return;
+                }
+                if (!cpu->thread->lsq.value_predicted[i])
+                {
+                    int bus = cpu->fBus[0].busy ? 1 : 0;
+                    cpu->fBus[bus].data = cpu->thread->lsq.src_value[i];
+                    cpu->fBus[bus].tag = pr;
+                    cpu->fBus[bus].busy = 1;
+                    cpu->fBus[bus].isDataFwd = 1;
+                    /* The LSQ snooped the buses before the loads ran, so
+                     * stores waiting on the load take its value here */
+                    updateLSQEntry(cpu, pr, cpu->thread->lsq.src_value[i]);
+                }
+            }
+        }
+        if (i == cpu->thread->lsq.tail)
+        {
+            break;
+        }
+    }
 }
 
 /*Intialise PR and RT with default setup*/
 static void
 intialize_PR_RT(APEX_CPU *cpu)
 {
-
-    while (cpu->pr.head < 8)
+    memset(&cpu->thread->rt, 0, sizeof(cpu->thread->rt));
+    memset(&cpu->thread->ren, 0, sizeof(cpu->thread->ren));
+    memset(cpu->thread->const_map, -1, sizeof(cpu->thread->const_map));
+    memset(&cpu->pr, 0, sizeof(cpu->pr));
+    memset(&cpu->ccf, 0, sizeof(cpu->ccf));
+
+    /* The architectural registers start out in P0..P7 */
+    for (int i = 0; i < REG_FILE_SIZE; i++)
+    {
+        cpu->thread->rt.reg[i] = i;
+        cpu->pr.phy_Reg[i] = cpu->thread->regs[i];
+        cpu->pr.cc_reg[i] = -1;
+        cpu->thread->ren.pr_map[0] |= 1ULL << i;
+        cpu->thread->ren.pr_refs[i] = 1;
+    }
+    for (int i = REG_FILE_SIZE; i < PR_FILE_SIZE; i++)
     {
-        cpu->rt.reg[cpu->pr.head] = cpu->pr.head;
-        cpu->pr.PR_File[cpu->pr.head].cc_flag = -1;
-        cpu->pr.PR_File[cpu->pr.head].free = cpu->pr.head;
-        cpu->pr.head++;
+        cpu->pr.free_map[i / 64] |= 1ULL << (i % 64);
     }
-    int head = cpu->pr.head;
-    while (head < 15)
+    cpu->pr.count = PR_FILE_SIZE - REG_FILE_SIZE;
+
+    /* The two pinned CC registers are always valid, the architectural
+     * flags are the committed zero flag */
+    cpu->ccf.reg[CC_ZERO_CLEAR].flag = 0;
+    cpu->ccf.reg[CC_ZERO_SET].flag = 1;
+    for (int i = CC_ZERO_SET + 1; i < CC_FILE_SIZE; i++)
     {
-        cpu->pr.PR_File[head].free = head;
-        head++;
+        cpu->ccf.free_map |= 1U << i;
     }
+    cpu->ccf.count = CC_FILE_SIZE - 2;
+    cpu->ccf.alloc_seq = 1;
+    cpu->thread->prev_cc = cpu->thread->regs[REG_FILE_SIZE] ? CC_ZERO_SET : CC_ZERO_CLEAR;
 }
 
 static void initialize_bus(APEX_CPU *cpu)
@@ -2360,6 +4184,7 @@ static void initialize_bus(APEX_CPU *cpu)
         cpu->fBus[i].data = 0;
         cpu->fBus[i].tag = 0;
         cpu->fBus[i].cc = 0;
+        cpu->fBus[i].cc_tag = -1;
         cpu->fBus[i].isDataFwd = FALSE;
         cpu->fBus[i].busy = 0;
     }
@@ -2385,35 +4210,63 @@ APEX_cpu_init(const char *filename)
     {
         return NULL;
     }
+    cpu->thread = &cpu->threads[0];
 
     /* Initialize PC, Registers and all pipeline stages */
-    cpu->pc = 4000;
-    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
+    cpu->thread->pc = 4000;
+    memset(cpu->thread->regs, 0, sizeof(int) * REG_FILE_SIZE);
+    cpu->data_memory = createDataMemory();
+    if (!cpu->data_memory)
+    {
+        free(cpu);
+        return NULL;
+    }
     cpu->single_step = ENABLE_SINGLE_STEP;
 
-    cpu->pr.head = 0;
-    cpu->pr.tail = 14;
     initialize_bus(cpu);
     intialize_PR_RT(cpu);
+    cpu->select_policy = ISSUE_SELECT_POLICY;
+    cpu->fetch_policy = FETCH_POLICY;
+    cpu->num_threads = 1;
 
     cpu->iq.tail = -1;
 
-    cpu->lsq.head = -1;
-    cpu->lsq.tail = -1;
-
-    cpu->rob.head = -1;
-    cpu->rob.tail = -1;
-
-    cpu->btb.tail = -1;
-
-    cpu->bis.head = -1;
-    cpu->bis.tail = -1;
+    cpu->thread->lsq.head = -1;
+    cpu->thread->lsq.tail = -1;
+
+    cpu->thread->rob.head = -1;
+    cpu->thread->rob.tail = -1;
+
+    cpu->thread->bis.head = -1;
+    cpu->thread->bis.tail = -1;
+
+    cpu->memory.latency = MEM_LATENCY;
+    initTagMatch();
+    cpu->store_sets.next_ssid = 1;
+    initPrefetcher(&cpu->prefetcher, L1D_PREFETCHER, PREFETCH_DEGREE);
+    if (!initCache(&cpu->l2, "L2", L2_SIZE, L2_ASSOC, L2_LINE_SIZE, L2_HIT_LATENCY,
+                   L2_REPLACEMENT, L2_WRITE_BACK, L2_WRITE_ALLOCATE, NULL, &cpu->memory) ||
+        !initCache(&cpu->l1d, "L1D", L1D_SIZE, L1D_ASSOC, L1D_LINE_SIZE, L1D_HIT_LATENCY,
+                   L1D_REPLACEMENT, L1D_WRITE_BACK, L1D_WRITE_ALLOCATE, &cpu->l2, &cpu->memory) ||
+        !initMSHRs(&cpu->l1d, L1D_MSHRS) ||
+        !initCache(&cpu->l1i, "L1I", L1I_SIZE, L1I_ASSOC, L1I_LINE_SIZE, L1I_HIT_LATENCY,
+                   L1I_REPLACEMENT, FALSE, FALSE, &cpu->l2, &cpu->memory))
+    {
+        freeCache(&cpu->l1d);
+        freeCache(&cpu->l2);
+        freeDataMemory(cpu->data_memory);
+        free(cpu);
+        return NULL;
+    }
 
     /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    cpu->thread->code_memory = create_code_memory(filename, &cpu->thread->code_memory_size);
+    if (!cpu->thread->code_memory)
     {
+        freeCache(&cpu->l1i);
+        freeCache(&cpu->l1d);
+        freeCache(&cpu->l2);
+        freeDataMemory(cpu->data_memory);
         free(cpu);
         return NULL;
     }
@@ -2422,26 +4275,70 @@ APEX_cpu_init(const char *filename)
     {
         fprintf(stderr,
                 "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
+                cpu->thread->code_memory_size);
+        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->thread->pc);
         fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
         printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
                "imm");
 
-        for (i = 0; i < cpu->code_memory_size; ++i)
+        for (i = 0; i < cpu->thread->code_memory_size; ++i)
         {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->thread->code_memory[i].opcode_str,
+                   cpu->thread->code_memory[i].rd, cpu->thread->code_memory[i].rs1,
+                   cpu->thread->code_memory[i].rs2, cpu->thread->code_memory[i].imm);
         }
     }
 
-    cpu->pe = malloc(sizeof(PE) * instruction_size);
+    cpu->thread->pe = malloc(sizeof(PE) * instruction_size);
     /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
+    cpu->thread->fetch.has_insn = TRUE;
     return cpu;
 }
 
+/* Adds a hardware thread running the program in filename. It starts with
+ * architectural registers of its own, mapped onto fresh physical registers,
+ * and an empty ROB, LSQ and front end. Returns FALSE if it cannot be added */
+int
+APEX_cpu_add_thread(APEX_CPU *cpu, const char *filename)
+{
+    if (cpu->num_threads == SMT_THREADS || cpu->pr.count < REG_FILE_SIZE)
+    {
+        return FALSE;
+    }
+    int size;
+    APEX_Instruction *code_memory = create_code_memory(filename, &size);
+    if (!code_memory)
+    {
+        return FALSE;
+    }
+
+    int running = cpu->tid;
+    switch_thread(cpu, cpu->num_threads++);
+    cpu->thread->pc = 4000;
+    memset(cpu->thread->regs, 0, sizeof(cpu->thread->regs));
+    cpu->thread->code_memory = code_memory;
+    cpu->thread->code_memory_size = size;
+    cpu->thread->pe = malloc(sizeof(PE) * instruction_size);
+    for (int i = 0; i < REG_FILE_SIZE; i++)
+    {
+        int reg = getFreeRegFromPR(cpu);
+        cpu->pr.phy_Reg[reg] = 0;
+        cpu->pr.reg_invalid[reg] = 0;
+        cpu->thread->rt.reg[i] = reg;
+    }
+    cpu->thread->prev_cc = CC_ZERO_CLEAR;
+    memset(cpu->thread->const_map, -1, sizeof(cpu->thread->const_map));
+    cpu->thread->lsq.head = -1;
+    cpu->thread->lsq.tail = -1;
+    cpu->thread->rob.head = -1;
+    cpu->thread->rob.tail = -1;
+    cpu->thread->bis.head = -1;
+    cpu->thread->bis.tail = -1;
+    cpu->thread->fetch.has_insn = TRUE;
+    switch_thread(cpu, running);
+    return TRUE;
+}
+
 /*----------------------------------Issue Queue utilities start-----------------------------------*/
 
 void addIQEntry(
@@ -2460,7 +4357,6 @@ void addIQEntry(
     int pc_value,
     int opcode,
     int prediction,
-    char opcode_str[128],
     int rs1,
     int rs2,
     int rs3,
@@ -2472,30 +4368,33 @@ void addIQEntry(
     {
         return;
     }
-    IQ_Entry *entry = malloc(sizeof(IQ_Entry));
-    entry->allocated_bit = allocated_bit;
-    entry->fu_type = fu_type;
-    entry->literal = literal;
-    entry->src1_valid_bit = src1_valid_bit;
-    entry->src1_tag = src1_tag;
-    entry->src1_value = src1_value;
-    entry->src2_valid_bit = src2_valid_bit;
-    entry->src2_tag = src2_tag;
-    entry->src2_value = src2_value;
-    entry->bis_index = bis_index;
-    entry->dest = dest;
-    entry->pc_value = pc_value;
-    entry->opcode = opcode;
-    entry->prediction = prediction;
-    entry->rs1 = rs1;
-    entry->rs2 = rs2;
-    entry->rs3 = rs3;
-    entry->rd = rd;
-
-    strcpy(entry->opcode_str, opcode_str);
-
     int tail = ++cpu->iq.tail;
-    cpu->iq.entry[tail] = entry;
+    cpu->iq.allocated_bit[tail] = allocated_bit;
+    cpu->iq.fu_type[tail] = fu_type;
+    cpu->iq.literal[tail] = literal;
+    cpu->iq.src1_valid_bit[tail] = src1_valid_bit;
+    cpu->iq.src1_tag[tail] = src1_tag;
+    cpu->iq.src1_value[tail] = src1_value;
+    cpu->iq.src2_valid_bit[tail] = src2_valid_bit;
+    cpu->iq.src2_tag[tail] = src2_tag;
+    cpu->iq.src2_value[tail] = src2_value;
+    cpu->iq.waitingForBranch[tail] = waitingForBranch;
+    cpu->iq.bis_index[tail] = bis_index;
+    cpu->iq.dest[tail] = dest;
+    cpu->iq.pc_value[tail] = pc_value;
+    cpu->iq.opcode[tail] = opcode;
+    cpu->iq.prediction[tail] = prediction;
+    cpu->iq.rs1[tail] = rs1;
+    cpu->iq.rs2[tail] = rs2;
+    cpu->iq.rs3[tail] = rs3;
+    cpu->iq.rd[tail] = rd;
+    cpu->iq.cc_src[tail] = -1;
+    cpu->iq.cc_src_valid[tail] = 1;
+    cpu->iq.cc_dest[tail] = -1;
+    cpu->iq.seq[tail] = cpu->iq_seq++;
+    cpu->iq.dispatch_cycle[tail] = cpu->clock;
+    cpu->iq.ready_cycle[tail] = -1;
+    cpu->iq.thread[tail] = cpu->tid;
 }
 
 int isIQFull(APEX_CPU *cpu)
@@ -2529,7 +4428,7 @@ int getIQEntry_Index(APEX_CPU *cpu, int index)
     while (i <= tail)
     {
 
-        if (isIQEntryReady(cpu->iq.entry[i]))
+        if (isIQEntryReady(cpu, i))
         {
             return i;
         }
@@ -2538,66 +4437,239 @@ int getIQEntry_Index(APEX_CPU *cpu, int index)
     return -1;
 }
 
-IQ_Entry *getIQEntry(APEX_CPU *cpu)
+/* Whether FU of the entry at index can take it this cycle. An INT_FU
+ * result also needs a bus to reserve */
+static int canIssueIQEntry(APEX_CPU *cpu, int index)
 {
-    if (isIQEmpty(cpu))
+    switch (cpu->iq.fu_type[index])
     {
-        return NULL;
+    case INT_U:
+        return !cpu->INT_FU.has_insn && !(cpu->fBus[0].busy && cpu->fBus[1].busy);
+    case LOP_U:
+        return !cpu->LOP_FU.has_insn;
+    case MUL_U:
+        return !cpu->MUL1_FU.has_insn;
+    default:
+        return 0;
+    }
+}
+
+/* Whether the waiting entry at consumer needs a result of the one at
+ * producer. Threads never share a result */
+static int dependsOnIQEntry(APEX_CPU *cpu, int consumer, int producer)
+{
+    int tag = -1;
+    int fused_tag = -1;
+    if (cpu->iq.thread[consumer] != cpu->iq.thread[producer])
+    {
+        return 0;
+    }
+    if (is_load_opcode(cpu->iq.opcode[producer]))
+    {
+        /* The IQ holds the load's LSQ index, the LSQ its register */
+        int tid = cpu->iq.dest[producer] / LSQ_SIZE;
+        LSQ *lsq = &cpu->threads[tid].lsq;
+        tag = lsq->dest_reg_address[cpu->iq.dest[producer] % LSQ_SIZE];
+        if (cpu->iq.fused[producer] == FUSE_ADDL_LOAD)
+        {
+            fused_tag = cpu->iq.fused_pd[producer];
+        }
+    }
+    else if (writes_register(cpu->iq.opcode[producer]))
+    {
+        tag = cpu->iq.dest[producer];
+    }
+    if (tag != -1 && !cpu->iq.src1_valid_bit[consumer] && (cpu->iq.src1_tag[consumer] == tag || cpu->iq.src1_tag[consumer] == fused_tag))
+    {
+        return 1;
+    }
+    if (tag != -1 && !cpu->iq.src2_valid_bit[consumer] && (cpu->iq.src2_tag[consumer] == tag || cpu->iq.src2_tag[consumer] == fused_tag))
+    {
+        return 1;
+    }
+    return cpu->iq.cc_dest[producer] != -1 && !cpu->iq.cc_src_valid[consumer] && cpu->iq.cc_src[consumer] == cpu->iq.cc_dest[producer];
+}
+
+/* Passes a longer dependence chain from consumer on to every entry it
+ * waits on, and from those to what they wait on in turn */
+static void extendIQPath(APEX_CPU *cpu, int consumer)
+{
+    for (int i = consumer - 1; i >= 0; i--)
+    {
+        if (cpu->iq.rank[i] <= cpu->iq.rank[consumer] && dependsOnIQEntry(cpu, consumer, i))
+        {
+            cpu->iq.rank[i] = cpu->iq.rank[consumer] + 1;
+            extendIQPath(cpu, i);
+        }
+    }
+}
+
+/* Ranks the entry just dispatched at index under the active select policy,
+ * higher issues first. Under the dependence policies it ranks 0 until
+ * something younger waits on it, and raises the entries it waits on. A
+ * consumer only leaves the IQ after its producers or in a flush, so the
+ * ranks hold until then */
+void rankIQEntry(APEX_CPU *cpu, int index)
+{
+    cpu->iq.rank[index] = 0;
+    switch (cpu->select_policy)
+    {
+    case SELECT_DEPENDENTS:
+    {
+        for (int i = 0; i < index; i++)
+        {
+            cpu->iq.rank[i] += dependsOnIQEntry(cpu, index, i);
+        }
+        break;
+    }
+    case SELECT_CRITICAL_PATH:
+    {
+        extendIQPath(cpu, index);
+        break;
+    }
+    case SELECT_LOAD_FIRST:
+    {
+        cpu->iq.rank[index] = is_load_opcode(cpu->iq.opcode[index]);
+        break;
+    }
+    case SELECT_BRANCH_FIRST:
+    {
+        cpu->iq.rank[index] = is_control_transfer(cpu->iq.opcode[index]);
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+}
+
+/* Picks the IQ entry to issue this cycle, -1 when none is ready with a free
+ * FU. Also stamps the cycle each entry first becomes ready */
+int selectIQEntry(APEX_CPU *cpu)
+{
+    int best = -1;
+    for (int i = 0; i <= cpu->iq.tail; i++)
+    {
+        if (!isIQEntryReady(cpu, i))
+        {
+            continue;
+        }
+        if (cpu->iq.ready_cycle[i] == -1)
+        {
+            cpu->iq.ready_cycle[i] = cpu->clock;
+        }
+        if (!canIssueIQEntry(cpu, i))
+        {
+            continue;
+        }
+        if (best == -1 || cpu->iq.rank[i] > cpu->iq.rank[best] ||
+            (cpu->iq.rank[i] == cpu->iq.rank[best] && cpu->iq.seq[i] < cpu->iq.seq[best]))
+        {
+            best = i;
+        }
+    }
+    return best;
+}
+
+const char *getSelectPolicyName(int policy)
+{
+    switch (policy)
+    {
+    case SELECT_DEPENDENTS:
+        return "dependents";
+    case SELECT_CRITICAL_PATH:
+        return "critical-path";
+    case SELECT_LOAD_FIRST:
+        return "load-first";
+    case SELECT_BRANCH_FIRST:
+        return "branch-first";
+    default:
+        return "oldest";
     }
-    int tail = cpu->iq.tail;
-    int i = 0;
-    while (i <= tail)
+}
+
+/* SELECT_ policy called name, -1 for an unknown name */
+int getSelectPolicy(const char *name)
+{
+    for (int policy = SELECT_OLDEST; policy <= SELECT_BRANCH_FIRST; policy++)
     {
-        IQ_Entry *entry = cpu->iq.entry[i];
-        if (isIQEntryReady(entry))
+        if (strcmp(name, getSelectPolicyName(policy)) == 0)
         {
-            shiftIQElements(cpu, i);
-            return entry;
+            return policy;
         }
-        i++;
     }
-    return NULL;
+    return -1;
 }
 
-int isIQEntryReady(IQ_Entry *entry)
+int isIQEntryReady(APEX_CPU *cpu, int index)
 {
-    return entry->allocated_bit && entry->src1_valid_bit && entry->src2_valid_bit;
+    return cpu->iq.allocated_bit[index] && cpu->iq.src1_valid_bit[index] && cpu->iq.src2_valid_bit[index] &&
+           cpu->iq.cc_src_valid[index];
 }
 
+/* Removes the entry at pos, every younger entry moves down a slot in each
+ * field array */
 void shiftIQElements(APEX_CPU *cpu, int pos)
 {
-    int tail = cpu->iq.tail;
-    while (pos < tail)
+    IQ *iq = &cpu->iq;
+    int *fields[] = {iq->src1_tag, iq->src2_tag, iq->allocated_bit, iq->src1_valid_bit, iq->src2_valid_bit,
+                     iq->cc_src, iq->cc_src_valid, iq->fu_type, iq->seq, iq->ready_cycle, iq->thread,
+                     iq->opcode, iq->dest, iq->cc_dest, iq->fused, iq->fused_pd, iq->src1_value,
+                     iq->src2_value, iq->literal, iq->fused_imm, iq->waitingForBranch, iq->bis_index,
+                     iq->pc_value, iq->prediction, iq->rs1, iq->rs2, iq->rs3, iq->rd, iq->rob_index,
+                     iq->dispatch_cycle, iq->rank};
+    int num_fields = sizeof(fields) / sizeof(fields[0]);
+    for (int i = 0; i < num_fields; i++)
     {
-        cpu->iq.entry[pos] = cpu->iq.entry[pos + 1];
-        pos++;
+        memmove(&fields[i][pos], &fields[i][pos + 1], (iq->tail - pos) * sizeof(int));
     }
-    cpu->iq.tail--;
+    iq->tail--;
 }
 
 void updateIQEntry(APEX_CPU *cpu, int src_tag, int isDataAvailable, int src_value)
 {
-    int tail = cpu->iq.tail;
-    int i = 0;
-    while (i <= tail)
+    unsigned long long src1[TAG_MASK_WORDS(IQ_SIZE)];
+    unsigned long long src2[TAG_MASK_WORDS(IQ_SIZE)];
+    matchTags(cpu->iq.src1_tag, cpu->iq.tail + 1, src_tag, src1);
+    matchTags(cpu->iq.src2_tag, cpu->iq.tail + 1, src_tag, src2);
+    for (int word = 0; word < TAG_MASK_WORDS(cpu->iq.tail + 1); word++)
     {
-        if (cpu->iq.entry[i]->src1_tag == src_tag)
+        for (unsigned long long mask = src1[word] | src2[word]; mask; mask &= mask - 1)
         {
-            cpu->iq.entry[i]->src1_valid_bit = 1;
-            if (isDataAvailable)
+            int i = word * 64 + __builtin_ctzll(mask);
+            if (isSlotSet(src1, i))
             {
-                cpu->iq.entry[i]->src1_value = src_value;
+                cpu->iq.src1_valid_bit[i] = 1;
+                if (isDataAvailable)
+                {
+                    cpu->iq.src1_value[i] = src_value;
+                }
             }
-        }
-        if (cpu->iq.entry[i]->src2_tag == src_tag)
-        {
-            cpu->iq.entry[i]->src2_valid_bit = 1;
-            if (isDataAvailable)
+            if (isSlotSet(src2, i))
             {
-                cpu->iq.entry[i]->src2_value = src_value;
+                cpu->iq.src2_valid_bit[i] = 1;
+                if (isDataAvailable)
+                {
+                    cpu->iq.src2_value[i] = src_value;
+                }
             }
         }
-        i++;
+    }
+}
+
+/* Wakes the branches waiting on the flags of CC register cc_tag, matching
+ * the CC tags of all entries at once like updateIQEntry */
+void updateIQFlags(APEX_CPU *cpu, int cc_tag)
+{
+    unsigned long long match[TAG_MASK_WORDS(IQ_SIZE)];
+    matchTags(cpu->iq.cc_src, cpu->iq.tail + 1, cc_tag, match);
+    for (int word = 0; word < TAG_MASK_WORDS(cpu->iq.tail + 1); word++)
+    {
+        for (unsigned long long mask = match[word]; mask; mask &= mask - 1)
+        {
+            cpu->iq.cc_src_valid[word * 64 + __builtin_ctzll(mask)] = 1;
+        }
     }
 }
 
@@ -2621,26 +4693,38 @@ void addLSQEntry(
     {
         return;
     }
-    LSQ_Entry *entry = malloc(sizeof(LSQ_Entry));
-    entry->established_bit = established_bit;
-    entry->lost = lost;
-    entry->mem_valid_bit = mem_valid_bit;
-    entry->mem_address = mem_address;
-    entry->dest_reg_address = dest_reg_address;
-    entry->src_valid_bit = src_valid_bit;
-    entry->src_tag = src_tag;
-    entry->src_value = src_value;
-    entry->rob_index = rob_index;
+    if (lost)
+    {
+        cpu->thread->lsq.loads++;
+    }
+    else
+    {
+        cpu->thread->lsq.stores++;
+    }
 
-    int tail = cpu->lsq.tail;
-    int head = cpu->lsq.head;
+    int tail = cpu->thread->lsq.tail;
+    int head = cpu->thread->lsq.head;
     if (head == -1)
     {
-        cpu->lsq.head = 0;
+        cpu->thread->lsq.head = 0;
     }
     tail = (tail + 1) % LSQ_SIZE;
-    cpu->lsq.entry[tail] = entry;
-    cpu->lsq.tail = tail;
+    cpu->thread->lsq.tail = tail;
+    cpu->thread->lsq.established_bit[tail] = established_bit;
+    cpu->thread->lsq.lost[tail] = lost;
+    cpu->thread->lsq.mem_valid_bit[tail] = mem_valid_bit;
+    cpu->thread->lsq.mem_address[tail] = mem_address;
+    cpu->thread->lsq.dest_reg_address[tail] = dest_reg_address;
+    cpu->thread->lsq.src_valid_bit[tail] = src_valid_bit;
+    cpu->thread->lsq.src_tag[tail] = src_tag;
+    cpu->thread->lsq.tag[tail] = lost ? -1 : src_tag;
+    cpu->thread->lsq.src_value[tail] = src_value;
+    cpu->thread->lsq.rob_index[tail] = rob_index;
+    cpu->thread->lsq.mem_cycles[tail] = -1;
+    cpu->thread->lsq.is_done[tail] = FALSE;
+    cpu->thread->lsq.fwd_index[tail] = -1;
+    cpu->thread->lsq.value_predicted[tail] = FALSE;
+    cpu->thread->lsq.is_atomic[tail] = FALSE;
 }
 
 int getLSQEntry(APEX_CPU *cpu)
@@ -2649,24 +4733,24 @@ int getLSQEntry(APEX_CPU *cpu)
     {
         return -2;
     }
-    int head = cpu->lsq.head;
-    int tail = cpu->lsq.tail;
+    int head = cpu->thread->lsq.head;
+    int tail = cpu->thread->lsq.tail;
 
     if (head == tail)
     {
-        cpu->lsq.head = -1;
-        cpu->lsq.tail = -1;
+        cpu->thread->lsq.head = -1;
+        cpu->thread->lsq.tail = -1;
         return -1;
     }
     head = (head + 1) % LSQ_SIZE;
-    cpu->lsq.head = head;
+    cpu->thread->lsq.head = head;
     return head;
 }
 
 int isLSQFull(APEX_CPU *cpu)
 {
-    int head = cpu->lsq.head;
-    int tail = cpu->lsq.tail;
+    int head = cpu->thread->lsq.head;
+    int tail = cpu->thread->lsq.tail;
     if ((head == tail + 1) || (head == 0 && tail == LSQ_SIZE - 1))
     {
         return 1;
@@ -2674,10 +4758,91 @@ int isLSQFull(APEX_CPU *cpu)
     return 0;
 }
 
+/* Like the ROB, the load and store queues are split evenly between the
+ * threads */
+int isLoadQueueFull(APEX_CPU *cpu)
+{
+    return cpu->thread->lsq.loads == getThreadShare(cpu, LOAD_QUEUE_SIZE);
+}
+
+int isStoreQueueFull(APEX_CPU *cpu)
+{
+    return cpu->thread->lsq.stores == getThreadShare(cpu, STORE_QUEUE_SIZE);
+}
+
+/* Records the PC, store set and recovery state of the memory instruction
+ * just added at the LSQ tail */
+void saveLSQCheckpoint(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int tail = cpu->thread->lsq.tail;
+    cpu->thread->lsq.pc_value[tail] = stage->pc;
+    cpu->thread->lsq.store_set[tail] = getStoreSet(cpu, stage->pc);
+    cpu->thread->lsq.cc_tag[tail] = stage->cc_tag;
+    cpu->thread->lsq.path_hist[tail] = stage->path_hist;
+    cpu->thread->lsq.ras_top[tail] = stage->ras_top;
+    cpu->thread->lsq.ras_count[tail] = stage->ras_count;
+    cpu->thread->lsq.ras_value[tail] = stage->ras_value;
+    memcpy(cpu->thread->lsq.rt[tail], cpu->thread->rt.reg, sizeof(cpu->thread->lsq.rt[tail]));
+    if (!is_load_opcode(stage->opcode))
+    {
+        return;
+    }
+    /* A replay re-executes the load, so the snapshot is from before its
+     * own rename. A fused ADDL is replayed along with it. The registers
+     * they replaced move from the rename table to the ROB entry, so only
+     * their destinations were not held yet */
+    Rename_State *ren = &cpu->thread->lsq.ren[tail];
+    memcpy(ren, &cpu->thread->ren, sizeof(*ren));
+    cpu->thread->lsq.rt[tail][stage->dest_arch_reg] = stage->prev_phy_reg;
+    dropPRRef(ren, stage->pd);
+    if (stage->fused == FUSE_ADDL_LOAD)
+    {
+        cpu->thread->lsq.rt[tail][stage->fused_rd] = stage->fused_prev_phy_reg;
+        dropPRRef(ren, stage->fused_pd);
+        dropCCRef(ren, stage->cc_pd);
+    }
+}
+
+/* Position of an LSQ entry counted from the LSQ head */
+static int getLSQAge(APEX_CPU *cpu, int lsq_index)
+{
+    return (lsq_index - cpu->thread->lsq.head + LSQ_SIZE) % LSQ_SIZE;
+}
+
+void removeLSQHead(APEX_CPU *cpu)
+{
+    int head = cpu->thread->lsq.head;
+    if (cpu->thread->lsq.lost[head])
+    {
+        cpu->thread->lsq.loads--;
+    }
+    else
+    {
+        /* The store is in memory now, loads that forwarded from it no
+         * longer point at a live entry */
+        for (int i = head; i != cpu->thread->lsq.tail;)
+        {
+            i = (i + 1) % LSQ_SIZE;
+            if (cpu->thread->lsq.fwd_index[i] == head)
+            {
+                cpu->thread->lsq.fwd_index[i] = -1;
+            }
+        }
+        cpu->thread->lsq.stores--;
+    }
+    if (head == cpu->thread->lsq.tail)
+    {
+        cpu->thread->lsq.head = -1;
+        cpu->thread->lsq.tail = -1;
+        return;
+    }
+    cpu->thread->lsq.head = (head + 1) % LSQ_SIZE;
+}
+
 int isLSQEmpty(APEX_CPU *cpu)
 {
-    int head = cpu->lsq.head;
-    int tail = cpu->lsq.tail;
+    int head = cpu->thread->lsq.head;
+    int tail = cpu->thread->lsq.tail;
     if (head == -1 && tail == -1)
     {
         return 1;
@@ -2689,33 +4854,73 @@ void updateLSQEntry(APEX_CPU *cpu, int src_tag, int src_value)
 {
     if (src_tag < 0)
     {
+        /* The tag names the thread's LSQ as well as the entry */
         int index = (src_tag * -1) - 1;
-        LSQ_Entry *entry = cpu->lsq.entry[index];
-        cpu->lsq.entry[index]->mem_address = src_value;
-        entry->mem_valid_bit = 1;
+        if (index / LSQ_SIZE >= cpu->num_threads)
+        {
+            return;
+        }
+        switch_thread(cpu, index / LSQ_SIZE);
+        index %= LSQ_SIZE;
+        /* The slot may have been squashed since the address was computed */
+        if (isLSQEmpty(cpu) || getLSQAge(cpu, index) > getLSQAge(cpu, cpu->thread->lsq.tail))
+        {
+            return;
+        }
+        cpu->thread->lsq.mem_address[index] = src_value;
+        cpu->thread->lsq.mem_valid_bit[index] = 1;
+        if (cpu->thread->lsq.lost[index] || index == cpu->thread->lsq.tail)
+        {
+            return;
+        }
+        /* A younger load that already read this address from memory or from
+         * a store older than this one has the wrong value */
+        unsigned long long mask[TAG_MASK_WORDS(LSQ_SIZE)];
+        unsigned long long younger[TAG_MASK_WORDS(LSQ_SIZE)];
+        matchTags(cpu->thread->lsq.mem_address, LSQ_SIZE, src_value, mask);
+        getLSQRange((index + 1) % LSQ_SIZE, cpu->thread->lsq.tail, younger);
+        for (int word = 0; word < TAG_MASK_WORDS(LSQ_SIZE); word++)
+        {
+            mask[word] &= younger[word];
+        }
+        for (int i; (i = getOldestLSQSlot(cpu, mask)) != -1;)
+        {
+            mask[i / 64] &= ~(1ULL << (i % 64));
+            if (!cpu->thread->lsq.lost[i] || cpu->thread->lsq.mem_cycles[i] == -1)
+            {
+                continue;
+            }
+            if (cpu->thread->lsq.fwd_index[i] == -1 || getLSQAge(cpu, cpu->thread->lsq.fwd_index[i]) < getLSQAge(cpu, index))
+            {
+                cpu->ordering_violations++;
+                trainStoreSets(cpu, cpu->thread->lsq.pc_value[i], cpu->thread->lsq.pc_value[index]);
+                replay_load(cpu, i);
+                return;
+            }
+        }
         return;
     }
     else
     {
-        int i = cpu->lsq.head;
-        if (i == -1)
+        if (isLSQEmpty(cpu))
         {
             return;
         }
-        int tail = cpu->lsq.tail;
-        while (i <= tail)
+        /* Several stores may be waiting on the same producer. A store can
+         * already be marked valid by DR2 from a bus reservation, its value
+         * only arrives now */
+        unsigned long long mask[TAG_MASK_WORDS(LSQ_SIZE)];
+        unsigned long long live[TAG_MASK_WORDS(LSQ_SIZE)];
+        matchTags(cpu->thread->lsq.tag, LSQ_SIZE, src_tag, mask);
+        getLSQRange(cpu->thread->lsq.head, cpu->thread->lsq.tail, live);
+        for (int word = 0; word < TAG_MASK_WORDS(LSQ_SIZE); word++)
         {
-            LSQ_Entry *entry = cpu->lsq.entry[i];
-            if (entry->lost == 0)
+            for (mask[word] &= live[word]; mask[word]; mask[word] &= mask[word] - 1)
             {
-                if (entry->src_tag == src_tag)
-                {
-                    entry->src_valid_bit = 1;
-                    entry->src_value = src_value;
-                    return;
-                }
+                int i = word * 64 + __builtin_ctzll(mask[word]);
+                cpu->thread->lsq.src_valid_bit[i] = 1;
+                cpu->thread->lsq.src_value[i] = src_value;
             }
-            i++;
         }
     }
 }
@@ -2734,413 +4939,871 @@ void addROBEntry(
     int mem_error_code,
     APEX_CPU *cpu)
 {
-    if (isROBFull(cpu))
+    if (isROBFull(cpu))
+    {
+        printf("ROB full");
+        return;
+    }
+    int tail = cpu->thread->rob.tail;
+    tail = (tail + 1) % ROB_SIZE;
+    cpu->thread->rob.tail = tail;
+    cpu->thread->rob.established_bit[tail] = established_bit;
+    cpu->thread->rob.instruction_type[tail] = instruction_type;
+    cpu->thread->rob.pc_value[tail] = pc_value;
+    cpu->thread->rob.dest_phy_reg[tail] = dest_phy_reg;
+    cpu->thread->rob.prev_phy_reg[tail] = prev_phy_reg;
+    cpu->thread->rob.dest_arch_reg[tail] = dest_arch_reg;
+    cpu->thread->rob.lsq_index[tail] = lsq_index;
+    cpu->thread->rob.mem_error_code[tail] = mem_error_code;
+    cpu->thread->rob.isExecuted[tail] = 0;
+    cpu->thread->rob.eliminated[tail] = 0;
+    cpu->thread->rob.fused[tail] = FUSE_NONE;
+    cpu->thread->rob.cc_dest[tail] = -1;
+    cpu->thread->rob.cc_prev[tail] = -1;
+}
+
+/* Index of the ROB head, -1 when the ROB is empty */
+int getROBHead(APEX_CPU *cpu)
+{
+    if (isROBEmpty(cpu))
+    {
+        return -1;
+    }
+
+    return cpu->thread->rob.head;
+}
+
+void removeROBHead(APEX_CPU *cpu)
+{
+    if (isROBEmpty(cpu))
+    {
+        return;
+    }
+
+    int head = cpu->thread->rob.head;
+    int tail = cpu->thread->rob.tail;
+
+    if (head == tail && head != -1)
+    {
+        cpu->thread->rob.head = -1;
+        cpu->thread->rob.tail = -1;
+        return;
+    }
+    head = (head + 1) % ROB_SIZE;
+    cpu->thread->rob.head = head;
+    return;
+}
+
+/* The running thread's ROB holds its share of the entries, the threads
+ * split the ROB evenly */
+int isROBFull(APEX_CPU *cpu)
+{
+    int head = cpu->thread->rob.head;
+    int tail = cpu->thread->rob.tail;
+    int count = head == -1 ? tail + 1 : (tail - head + ROB_SIZE) % ROB_SIZE + 1;
+    return count == getThreadShare(cpu, ROB_SIZE);
+}
+
+int isROBEmpty(APEX_CPU *cpu)
+{
+    int head = cpu->thread->rob.head;
+    int tail = cpu->thread->rob.tail;
+    if (head == -1 && tail == -1)
+    {
+        return 1;
+    }
+    if (head == -1 && tail != -1)
+    {
+        cpu->thread->rob.head = 0;
+    }
+    return 0;
+}
+
+void updateROBEntry(APEX_CPU *cpu, int rob_index, int mem_error_code)
+{
+    if (rob_index >= cpu->thread->rob.head && rob_index <= cpu->thread->rob.tail)
+    {
+        cpu->thread->rob.mem_error_code[rob_index] = mem_error_code;
+    }
+}
+
+/*----------------------------------Reorder buffer queue utilities end-----------------------------------*/
+
+/*----------------------------------Branch target buffer utilities start-----------------------------------*/
+static int getBTBSet(int pc_value)
+{
+    return (pc_value >> 2) & (BTB_SETS - 1);
+}
+
+static int getBTBTag(int pc_value)
+{
+    return ((pc_value >> 2) / BTB_SETS) & ((1 << BTB_TAG_BITS) - 1);
+}
+
+/* True LRU: every valid way younger than the touched one ages by one and the
+ * touched way becomes the youngest */
+void touchBTBEntry(APEX_CPU *cpu, int set, int way)
+{
+    BTB_Entry *ways = cpu->btb.set[set];
+    int age = ways[way].lru_age;
+    for (int i = 0; i < BTB_WAYS; i++)
+    {
+        if (ways[i].valid && ways[i].lru_age < age)
+        {
+            ways[i].lru_age++;
+        }
+    }
+    ways[way].lru_age = 0;
+}
+
+/* Picks the way to fill in a set, an invalid way first and the least recently
+ * used one otherwise. Not-taken entries are kept so loop exits keep their slot */
+int BTBReplacement(APEX_CPU *cpu, int set)
+{
+    BTB_Entry *ways = cpu->btb.set[set];
+    int victim = 0;
+    for (int i = 0; i < BTB_WAYS; i++)
+    {
+        if (!ways[i].valid)
+        {
+            return i;
+        }
+        if (ways[i].lru_age > ways[victim].lru_age)
+        {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+void addBTBEntry(int pc_value, int target_address, APEX_CPU *cpu)
+{
+    int set = getBTBSet(pc_value);
+    int way = BTBReplacement(cpu, set);
+    BTB_Entry *entry = &cpu->btb.set[set][way];
+    if (!entry->valid)
+    {
+        /* A fresh way starts out as the oldest so the touch below ages the rest */
+        entry->lru_age = BTB_WAYS;
+    }
+    entry->valid = 1;
+    entry->tag = getBTBTag(pc_value);
+    entry->target_address = target_address;
+    entry->prediction = 1;
+    touchBTBEntry(cpu, set, way);
+}
+
+void updateBTBEntry(int pc_value, int prediction, APEX_CPU *cpu)
+{
+    BTB_Entry *entry = getBTBEntry(pc_value, cpu);
+    if (entry != NULL)
+    {
+        entry->prediction = prediction;
+    }
+}
+
+BTB_Entry *getBTBEntry(int pc_value, APEX_CPU *cpu)
+{
+    int set = getBTBSet(pc_value);
+    int tag = getBTBTag(pc_value);
+    for (int way = 0; way < BTB_WAYS; way++)
+    {
+        BTB_Entry *entry = &cpu->btb.set[set][way];
+        if (entry->valid && entry->tag == tag)
+        {
+            touchBTBEntry(cpu, set, way);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/*----------------------------------Branch target buffer utilities end-----------------------------------*/
+
+/*----------------------------------Branch Instruction stack utilities start-----------------------------------*/
+
+void addBISEntry(APEX_CPU *cpu, int pc_value, int rob_index, int is_exec)
+{
+    if (isBISFull(cpu))
+    {
+        return;
+    }
+    BIS_Entry *entry = malloc(sizeof(BIS_Entry));
+    entry->rob_index = rob_index;
+    entry->pc_value = pc_value;
+    entry->is_exec = is_exec;
+    int tail = cpu->thread->bis.tail;
+    int head = cpu->thread->bis.head;
+    if (head == -1)
+    {
+        cpu->thread->bis.head = 0;
+    }
+    tail = (tail + 1) % BIS_SIZE;
+    cpu->thread->bis.entry[tail] = entry;
+    cpu->thread->bis.tail = tail;
+}
+
+/* Records the speculative state of the branch just added at the BIS tail so
+ * a flush at this branch can put it back in one step. DR2 runs ahead of DR1,
+ * so the rename state is exactly the one right after the branch */
+void saveBISCheckpoint(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    BIS_Entry *entry = cpu->thread->bis.entry[cpu->thread->bis.tail];
+    entry->pred_target = stage->pred_target;
+    entry->itp_index = stage->itp_index;
+    entry->cc_tag = stage->branch_reg;
+    entry->path_hist = stage->path_hist;
+    entry->ras_top = stage->ras_top;
+    entry->ras_count = stage->ras_count;
+    entry->ras_value = stage->ras_value;
+    memcpy(entry->rt, cpu->thread->rt.reg, sizeof(entry->rt));
+    memcpy(&entry->ren, &cpu->thread->ren, sizeof(entry->ren));
+}
+
+void removeBISHead(APEX_CPU *cpu)
+{
+    int head = cpu->thread->bis.head;
+    int tail = cpu->thread->bis.tail;
+    if (head == -1)
+    {
+        return;
+    }
+    free(cpu->thread->bis.entry[head]);
+    cpu->thread->bis.entry[head] = NULL;
+    if (head == tail)
+    {
+        cpu->thread->bis.head = -1;
+        cpu->thread->bis.tail = -1;
+        return;
+    }
+    cpu->thread->bis.head = (head + 1) % BIS_SIZE;
+}
+
+int isBISFull(APEX_CPU *cpu)
+{
+    int head = cpu->thread->bis.head;
+    int tail = cpu->thread->bis.tail;
+    if ((head == tail + 1) || (head == 0 && tail == BIS_SIZE - 1))
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/*----------------------------------Branch Instruction stack utilities end-----------------------------------*/
+
+/*----------------------------------Indirect target predictor and RAS utilities start-----------------------------------*/
+
+int is_control_transfer(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_JUMP || opcode == OPCODE_JAL || opcode == OPCODE_RET;
+}
+
+int getITPIndex(APEX_CPU *cpu, int pc_value)
+{
+    return ((pc_value >> 2) ^ cpu->thread->path_hist) & (ITP_SIZE - 1);
+}
+
+ITP_Entry *getITPEntry(APEX_CPU *cpu, int index, int pc_value)
+{
+    ITP_Entry *entry = &cpu->itp[index];
+    if (entry->valid && entry->pc_value == pc_value)
+    {
+        return entry;
+    }
+    return NULL;
+}
+
+void updateITPEntry(APEX_CPU *cpu, int index, int pc_value, int target_address)
+{
+    ITP_Entry *entry = &cpu->itp[index];
+    entry->valid = 1;
+    entry->pc_value = pc_value;
+    entry->target_address = target_address;
+}
+
+/* Folds a taken target into the path history used to index the ITP */
+void updatePathHistory(APEX_CPU *cpu, int target_address)
+{
+    cpu->thread->path_hist = ((cpu->thread->path_hist << 2) ^ (target_address >> 2)) & ((1 << ITP_HIST_BITS) - 1);
+}
+
+/* The RAS is circular, so an overflow overwrites the oldest return address */
+void pushRAS(APEX_CPU *cpu, int return_address)
+{
+    cpu->thread->ras.top = (cpu->thread->ras.top + 1) % RAS_SIZE;
+    cpu->thread->ras.entry[cpu->thread->ras.top] = return_address;
+    if (cpu->thread->ras.count < RAS_SIZE)
     {
-        printf("ROB full");
-        return;
+        cpu->thread->ras.count++;
     }
-    ROB_Entry *entry = malloc(sizeof(ROB_Entry));
-    entry->established_bit = established_bit;
-    entry->instruction_type = instruction_type;
-    entry->pc_value = pc_value;
-    entry->dest_phy_reg = dest_phy_reg;
-    entry->prev_phy_reg = prev_phy_reg;
-    entry->dest_arch_reg = dest_arch_reg;
-    entry->lsq_index = lsq_index;
-    entry->mem_error_code = mem_error_code;
-    entry->isExecuted = 0;
-
-    int tail = cpu->rob.tail;
-    tail = (tail + 1) % ROB_SIZE;
-    cpu->rob.entry[tail] = entry;
-    cpu->rob.tail = tail;
 }
 
-ROB_Entry *getROBHead(APEX_CPU *cpu)
+int popRAS(APEX_CPU *cpu)
 {
-    if (isROBEmpty(cpu))
-    {
-        return NULL;
-    }
+    int return_address = cpu->thread->ras.entry[cpu->thread->ras.top];
+    cpu->thread->ras.top = (cpu->thread->ras.top + RAS_SIZE - 1) % RAS_SIZE;
+    cpu->thread->ras.count--;
+    return return_address;
+}
 
-    return cpu->rob.entry[cpu->rob.head];
+/* Repairs the path history and RAS after wrong-path fetch. Restoring the top
+ * pointer and the entry under it undoes any wrong-path push or pop */
+void restoreFetchHistory(APEX_CPU *cpu, int path_hist, int ras_top, int ras_count, int ras_value)
+{
+    cpu->thread->path_hist = path_hist;
+    cpu->thread->ras.top = ras_top;
+    cpu->thread->ras.count = ras_count;
+    cpu->thread->ras.entry[ras_top] = ras_value;
 }
 
-void removeROBHead(APEX_CPU *cpu)
+/*----------------------------------Indirect target predictor and RAS utilities end-----------------------------------*/
+
+/*----------------------------------Store set predictor utilities start-----------------------------------*/
+
+static int getSSITIndex(int pc_value)
 {
-    if (isROBEmpty(cpu))
-    {
-        return;
-    }
+    return (pc_value / 4) & (SSIT_SIZE - 1);
+}
 
-    int head = cpu->rob.head;
-    int tail = cpu->rob.tail;
+int getStoreSet(APEX_CPU *cpu, int pc_value)
+{
+    return cpu->store_sets.ssit[getSSITIndex(pc_value)];
+}
 
-    if (head == tail && head != -1)
+/* Puts the load and the store that it overtook into one store set. When both
+ * already belong to sets, the smaller id wins so the sets converge */
+void trainStoreSets(APEX_CPU *cpu, int load_pc, int store_pc)
+{
+    int *load_set = &cpu->store_sets.ssit[getSSITIndex(load_pc)];
+    int *store_set = &cpu->store_sets.ssit[getSSITIndex(store_pc)];
+    if (!*load_set && !*store_set)
     {
-        cpu->rob.head = -1;
-        cpu->rob.tail = -1;
-        return;
+        *load_set = *store_set = cpu->store_sets.next_ssid++;
+    }
+    else if (!*load_set)
+    {
+        *load_set = *store_set;
+    }
+    else if (!*store_set || *load_set < *store_set)
+    {
+        *store_set = *load_set;
+    }
+    else
+    {
+        *load_set = *store_set;
     }
-    head = (head + 1) % ROB_SIZE;
-    cpu->rob.head = head;
-    return;
 }
 
-int isROBFull(APEX_CPU *cpu)
+void clearStoreSets(APEX_CPU *cpu)
+{
+    memset(cpu->store_sets.ssit, 0, sizeof(cpu->store_sets.ssit));
+}
+
+/*----------------------------------Store set predictor utilities end-----------------------------------*/
+
+/*----------------------------------Load value predictor utilities start-----------------------------------*/
+
+static int getVPIndex(int pc_value)
+{
+    return (pc_value / 4) & (VP_SIZE - 1);
+}
+
+/* Predicts the value of the load just added at the LSQ tail. A confident
+ * prediction goes straight into the load's PR, so dependents renamed behind
+ * it find the register ready at dispatch instead of waiting on memory */
+void predictLoadValue(APEX_CPU *cpu)
 {
-    int head = cpu->rob.head;
-    int tail = cpu->rob.tail;
-    if ((head == tail + 1) || (head == 0 && tail == ROB_SIZE - 1))
+    int tail = cpu->thread->lsq.tail;
+    VP_Entry *entry = &cpu->vp[getVPIndex(cpu->thread->lsq.pc_value[tail])];
+    if (!entry->valid || entry->pc_value != cpu->thread->lsq.pc_value[tail] || entry->confidence < VP_CONFIDENCE)
     {
-        return 1;
+        return;
     }
-    return 0;
+    cpu->thread->lsq.value_predicted[tail] = TRUE;
+    cpu->thread->lsq.predicted_value[tail] = entry->last_value + entry->stride;
+    cpu->pr.phy_Reg[cpu->thread->lsq.dest_reg_address[tail]] = cpu->thread->lsq.predicted_value[tail];
+    cpu->pr.reg_invalid[cpu->thread->lsq.dest_reg_address[tail]] = 0;
+    cpu->values_predicted++;
 }
 
-int isROBEmpty(APEX_CPU *cpu)
+/* Trains the entry of the load at pc_value with the value memory returned.
+ * A repeated stride builds confidence, a new one starts over */
+void trainValuePredictor(APEX_CPU *cpu, int pc_value, int value)
 {
-    int head = cpu->rob.head;
-    int tail = cpu->rob.tail;
-    if (head == -1 && tail == -1)
+    VP_Entry *entry = &cpu->vp[getVPIndex(pc_value)];
+    if (!entry->valid || entry->pc_value != pc_value)
     {
-        return 1;
+        entry->valid = TRUE;
+        entry->pc_value = pc_value;
+        entry->stride = 0;
+        entry->confidence = 0;
     }
-    if (head == -1 && tail != -1)
+    else if (value - entry->last_value == entry->stride)
     {
-        cpu->rob.head = 0;
+        if (entry->confidence < VP_CONFIDENCE_MAX)
+        {
+            entry->confidence++;
+        }
     }
-    return 0;
+    else
+    {
+        entry->stride = value - entry->last_value;
+        entry->confidence = 0;
+    }
+    entry->last_value = value;
 }
 
-void updateROBEntry(APEX_CPU *cpu, int rob_index, int mem_error_code)
+/*----------------------------------Load value predictor utilities end-----------------------------------*/
+
+/*----------------------------------SMT utilities start-----------------------------------*/
+
+/* Makes tid the thread the pipeline functions work on. Its state stays in
+ * its slot, everything shared stays where it is */
+void switch_thread(APEX_CPU *cpu, int tid)
 {
-    if (rob_index >= cpu->rob.head && rob_index <= cpu->rob.tail)
-    {
-        cpu->rob.entry[rob_index]->mem_error_code = mem_error_code;
-    }
+    cpu->tid = tid;
+    cpu->thread = &cpu->threads[tid];
 }
 
-/*----------------------------------Reorder buffer queue utilities end-----------------------------------*/
+/* Entries of a structure of size entries each thread may hold */
+int getThreadShare(APEX_CPU *cpu, int size)
+{
+    return size / cpu->num_threads;
+}
 
-/*----------------------------------Branch target buffer utilities start-----------------------------------*/
-int isBTBFull(APEX_CPU *cpu)
+/* Whether the running thread has anything for DR2, DR1 or fetch to do. An
+ * I-cache miss is served without the front end, see serveICacheMisses */
+static int wantsFrontEnd(APEX_CPU *cpu)
 {
-    int i = 0;
-    while (i < BTB_SIZE)
+    return !cpu->thread->halted &&
+           (cpu->thread->DR2.has_insn || cpu->thread->DR1.has_insn || cpu->thread->fetch_buffer.count || cpu->thread->fetch_from_next_cycle ||
+            (cpu->thread->fetch.has_insn && !cpu->thread->waitingForBranch && cpu->thread->icache_cycles <= 1));
+}
+
+/* Counts down the I-cache misses of the threads the front end does not
+ * serve this cycle, up to the cycle fetch gets the line */
+static void serveICacheMisses(APEX_CPU *cpu, int served)
+{
+    for (int i = 0; i < cpu->num_threads; i++)
     {
-        BTB_Entry *entry = cpu->btb.entry[i];
-        if (entry == NULL)
+        if (i == served)
         {
-            return i;
+            continue;
         }
-        if (entry->prediction == 0)
+        switch_thread(cpu, i);
+        if (cpu->thread->icache_cycles > 1)
         {
-            return i;
+            cpu->thread->icache_cycles--;
+            cpu->icache_stall_cycles++;
         }
-
-        i++;
     }
-    return -2;
 }
-void BTBReplacement(APEX_CPU *cpu, BTB_Entry *entry)
+
+/* IQ entries held by thread tid */
+static int getThreadIQCount(APEX_CPU *cpu, int tid)
 {
-    int i = 0;
-    int min = 100000000;
-    int tail;
-    while (i < BTB_SIZE)
+    int count = 0;
+    for (int i = 0; i <= cpu->iq.tail; i++)
     {
-        BTB_Entry *entry = cpu->btb.entry[i];
-        if (entry->pc_value < min)
-        {
-            min = entry->pc_value;
-            tail = i;
-        }
-        i++;
+        count += cpu->iq.thread[i] == tid;
     }
-    cpu->btb.entry[tail] = entry;
-    cpu->btb.tail = tail;
+    return count;
 }
 
-void addBTBEntry(int pc_value, int target_address, APEX_CPU *cpu)
+/* Instructions of the running thread between fetch and issue */
+static int getFrontEndCount(APEX_CPU *cpu)
 {
-    BTB_Entry *entry = malloc(sizeof(BTB_Entry));
-    entry->pc_value = pc_value;
-    entry->target_address = target_address;
-    entry->prediction = 1;
-    int btbInd = isBTBFull(cpu);
-    if (btbInd == -2)
+    return cpu->thread->fetch_buffer.count + cpu->thread->DR1.has_insn + cpu->thread->DR2.has_insn + getThreadIQCount(cpu, cpu->tid);
+}
+
+/* Picks the thread the front end serves this cycle under the fetch policy,
+ * -1 when no thread has work for it. Candidates are tried round robin from
+ * the one after the last served, ICOUNT takes the one with the fewest
+ * instructions waiting to issue so a stalled thread cannot clog the IQ */
+int selectFetchThread(APEX_CPU *cpu)
+{
+    if (cpu->num_threads == 1)
     {
-        BTBReplacement(cpu, entry);
+        return 0;
     }
-    else
+    int selected = -1;
+    int selected_count = 0;
+    for (int i = 1; i <= cpu->num_threads; i++)
     {
-        int tail = btbInd;
-        cpu->btb.entry[tail] = entry;
-        cpu->btb.tail = tail;
+        int tid = (cpu->fetch_thread + i) % cpu->num_threads;
+        switch_thread(cpu, tid);
+        if (!wantsFrontEnd(cpu))
+        {
+            continue;
+        }
+        if (cpu->fetch_policy == FETCH_ROUND_ROBIN)
+        {
+            return tid;
+        }
+        int count = getFrontEndCount(cpu);
+        if (selected == -1 || count < selected_count)
+        {
+            selected = tid;
+            selected_count = count;
+        }
     }
+    return selected;
 }
 
-void updateBTBEntry(int pc_value, int prediction, APEX_CPU *cpu)
+const char *getFetchPolicyName(int policy)
 {
-    int tail = cpu->btb.tail;
-    int i = 0;
-    while (i <= tail)
+    switch (policy)
     {
-        BTB_Entry *entry = cpu->btb.entry[i];
-        if (entry != NULL && entry->pc_value == pc_value)
-        {
-            entry->prediction = prediction;
-            return;
-        }
-        i++;
+    case FETCH_ICOUNT:
+        return "icount";
+    default:
+        return "round-robin";
     }
 }
 
-BTB_Entry *getBTBEntry(int pc_value, APEX_CPU *cpu)
+int getFetchPolicy(const char *name)
 {
-    int i = 0;
-    while (i < BTB_SIZE)
+    for (int policy = FETCH_ROUND_ROBIN; policy <= FETCH_ICOUNT; policy++)
     {
-        BTB_Entry *entry = cpu->btb.entry[i];
-        if (entry != NULL && entry->pc_value == pc_value)
+        if (strcmp(name, getFetchPolicyName(policy)) == 0)
         {
-            return entry;
+            return policy;
         }
-        i++;
     }
-    return NULL;
+    return -1;
 }
 
-/*----------------------------------Branch target buffer utilities end-----------------------------------*/
+/*----------------------------------SMT utilities end-----------------------------------*/
 
-/*----------------------------------Branch Instruction stack utilities start-----------------------------------*/
+/*----------------------------------FLUSH instruction utilities start-----------------------------------*/
 
-void addBISEntry(APEX_CPU *cpu, int pc_value, int rob_index, int is_exec)
+/* Position of a ROB entry counted from the ROB head */
+static int getROBAge(APEX_CPU *cpu, int rob_index)
 {
-    if (isBISFull(cpu))
-    {
-        return;
-    }
-    BIS_Entry *entry = malloc(sizeof(BIS_Entry));
-    entry->rob_index = rob_index;
-    entry->pc_value = pc_value;
-    entry->is_exec = is_exec;
-    int tail = cpu->bis.tail;
-    int head = cpu->bis.head;
-    if (head == -1)
-    {
-        cpu->bis.head = 0;
-    }
-    tail = (tail + 1) % BIS_SIZE;
-    cpu->bis.entry[tail] = entry;
-    cpu->bis.tail = tail;
+    int head = cpu->thread->rob.head == -1 ? 0 : cpu->thread->rob.head;
+    return (rob_index - head + ROB_SIZE) % ROB_SIZE;
 }
 
-int isBISFull(APEX_CPU *cpu)
+/* Drops every memory instruction younger than the ROB entry rob_index. The
+ * ROB only records where the LSQ tail would be for non memory instructions,
+ * so the LSQ is trimmed by age instead */
+void flush_lsqEntries(APEX_CPU *cpu, int rob_index)
 {
-    int head = cpu->bis.head;
-    int tail = cpu->bis.tail;
-    if ((head == tail + 1) || (head == 0 && tail == ROB_SIZE - 1))
+    int age = getROBAge(cpu, rob_index);
+    while (!isLSQEmpty(cpu))
     {
-        return 1;
+        int tail = cpu->thread->lsq.tail;
+        if (getROBAge(cpu, cpu->thread->lsq.rob_index[tail]) <= age)
+        {
+            return;
+        }
+        if (cpu->thread->lsq.lost[tail])
+        {
+            cpu->thread->lsq.loads--;
+        }
+        else
+        {
+            cpu->thread->lsq.stores--;
+        }
+        if (tail == cpu->thread->lsq.head)
+        {
+            cpu->thread->lsq.head = -1;
+            cpu->thread->lsq.tail = -1;
+            return;
+        }
+        cpu->thread->lsq.tail = (tail + LSQ_SIZE - 1) % LSQ_SIZE;
     }
-    return 0;
 }
 
-int getBIS_index(APEX_CPU *cpu, int pc_value)
+/* Squashes the running thread's instructions younger than the ROB entry
+ * rob_index that are already past the IQ */
+void flush_fuEntries(APEX_CPU *cpu, int rob_index)
 {
-    int i = cpu->bis.head;
-    int tail = cpu->bis.tail;
-    while (i <= tail)
+    CPU_Stage *stages[] = {&cpu->INT_FU, &cpu->LOP_FU, &cpu->MUL1_FU, &cpu->MUL2_FU, &cpu->MUL3_FU, &cpu->MUL4_FU};
+    int age = getROBAge(cpu, rob_index);
+    for (int i = 0; i < 6; i++)
     {
-        BIS_Entry *entry = cpu->bis.entry[i];
-        if (entry->pc_value == pc_value)
+        if (stages[i]->has_insn && stages[i]->thread == cpu->tid && getROBAge(cpu, stages[i]->rob_index) > age)
         {
-            return i;
+            stages[i]->has_insn = FALSE;
         }
-        i = (i + 1) % BIS_SIZE;
     }
-    return -1;
 }
-/*----------------------------------Branch Instruction stack utilities end-----------------------------------*/
 
-/*----------------------------------FLUSH instruction utilities start-----------------------------------*/
-
-void reset_decode_stage(APEX_CPU *cpu, CPU_Stage stage)
+void flush_iqEntries(APEX_CPU *cpu, int rob_index)
 {
-    switch (stage.opcode)
-    {
-    case OPCODE_MUL:
-    case OPCODE_ADD:
-    case OPCODE_DIV:
-    case OPCODE_SUB:
-    case OPCODE_XOR:
-    case OPCODE_OR:
-    case OPCODE_AND:
-    case OPCODE_LDR:
-    case OPCODE_CMP:
-    case OPCODE_ADDL:
-    case OPCODE_SUBL:
-    case OPCODE_LOAD:
-    case OPCODE_MOVC:
+    /* The IQ is kept in dispatch order, but the other threads' entries can
+     * sit between the running thread's younger ones */
+    int age = getROBAge(cpu, rob_index);
+    for (int i = cpu->iq.tail; i >= 0; i--)
     {
-        cpu->pr.PR_File[stage.pd].reg_invalid = 0;
-        break;
+        if (cpu->iq.thread[i] != cpu->tid)
+        {
+            continue;
+        }
+        if (getROBAge(cpu, cpu->iq.rob_index[i]) <= age)
+        {
+            break;
+        }
+        shiftIQElements(cpu, i);
     }
-
-    case OPCODE_BZ:
-    case OPCODE_BNZ:
+    /* The flushed consumers no longer count for what they waited on */
+    for (int i = 0; i <= cpu->iq.tail; i++)
     {
-        cpu->pr.PR_File[stage.branch_reg].reg_invalid = 0;
-        break;
+        rankIQEntry(cpu, i);
     }
+}
 
-    default:
+void flush_bisEntries(APEX_CPU *cpu, int rob_index)
+{
+    int age = getROBAge(cpu, rob_index);
+    while (cpu->thread->bis.tail != -1 && getROBAge(cpu, cpu->thread->bis.entry[cpu->thread->bis.tail]->rob_index) > age)
     {
-        break;
-    }
+        free(cpu->thread->bis.entry[cpu->thread->bis.tail]);
+        cpu->thread->bis.entry[cpu->thread->bis.tail] = NULL;
+        if (cpu->thread->bis.tail == cpu->thread->bis.head)
+        {
+            cpu->thread->bis.head = -1;
+            cpu->thread->bis.tail = -1;
+            return;
+        }
+        cpu->thread->bis.tail = (cpu->thread->bis.tail + BIS_SIZE - 1) % BIS_SIZE;
     }
 }
 
-void flush_instructions(APEX_CPU *cpu, int pc_value)
+/* Drops every instruction younger than the ROB entry rob_index from the
+ * back end. Register state is restored from a checkpoint by the caller */
+void flush_robEntries(APEX_CPU *cpu, int rob_index)
 {
-    reset_decode_stage(cpu, cpu->DR1);
-    reset_decode_stage(cpu, cpu->DR2);
-    cpu->prev_cc = cpu->INT_FU.branch_reg;
-    cpu->fetch_from_next_cycle = TRUE;
-    cpu->DR1.has_insn = FALSE;
-    cpu->DR2.has_insn = FALSE;
-    flush_bisEntries(cpu, pc_value);
+    flush_iqEntries(cpu, rob_index);
+    flush_bisEntries(cpu, rob_index);
+    flush_lsqEntries(cpu, rob_index); // lsq instructions are flushed here
+    flush_fuEntries(cpu, rob_index);
+    cpu->thread->rob.tail = rob_index;
 }
 
-void flush_bisEntries(APEX_CPU *cpu, int pc_value)
+static void flush_front_end(APEX_CPU *cpu)
 {
-    int bis_index = getBIS_index(cpu, pc_value);
-    flush_iqEntries(cpu, bis_index);
-    cpu->bis.tail = bis_index;
-    BIS_Entry *entry = cpu->bis.entry[bis_index];
-    int rob_index = entry->rob_index;
-    flush_robEntries(cpu, rob_index);
+    cpu->thread->DR1.has_insn = FALSE;
+    cpu->thread->DR2.has_insn = FALSE;
+    cpu->thread->fetch_from_next_cycle = TRUE;
+    cpu->thread->waitingForBranch = FALSE;
 }
 
-void flush_iqEntries(APEX_CPU *cpu, int bis_index)
+/* Recovers from a mispredicted control transfer at the BIS entry bis_index.
+ * The rename table and the PR and CC registers the thread holds come back
+ * from the branch checkpoint with a memcpy each */
+void flush_instructions(APEX_CPU *cpu, int bis_index)
 {
-    int i = 0;
-    int tail = cpu->iq.tail;
-    while (i <= tail)
-    {
-        IQ_Entry *entry = cpu->iq.entry[i];
-        if (entry->bis_index == bis_index)
-        {
-            cpu->iq.tail = i - 1;
-            return;
-        }
-        i--;
-    }
+    BIS_Entry *entry = cpu->thread->bis.entry[bis_index];
+    flush_front_end(cpu);
+    restoreFetchHistory(cpu, entry->path_hist, entry->ras_top, entry->ras_count, entry->ras_value);
+    flush_robEntries(cpu, entry->rob_index);
+    restoreRenameState(cpu, entry->rt, entry->cc_tag, &entry->ren);
+    cpu->branch_recoveries++;
+    cpu->thread->branch_recoveries++;
 }
 
-void flush_lsqEntries(APEX_CPU *cpu, int lsq_index)
+/* Replays from a load that read memory ahead of an older store to the same
+ * address. The load's checkpoint is from before its own rename, so fetch
+ * restarts at the load */
+void replay_load(APEX_CPU *cpu, int lsq_index)
 {
-    cpu->lsq.tail = lsq_index;
+    /* An older store is still in the ROB, so the load is never the head */
+    int rob_index = (cpu->thread->lsq.rob_index[lsq_index] + ROB_SIZE - 1) % ROB_SIZE;
+    int pc_value = cpu->thread->lsq.pc_value[lsq_index];
+
+    flush_front_end(cpu);
+    restoreFetchHistory(cpu, cpu->thread->lsq.path_hist[lsq_index], cpu->thread->lsq.ras_top[lsq_index], cpu->thread->lsq.ras_count[lsq_index], cpu->thread->lsq.ras_value[lsq_index]);
+    flush_robEntries(cpu, rob_index);
+    /* The load's LSQ slot is only dropped, its checkpoint is still there */
+    restoreRenameState(cpu, cpu->thread->lsq.rt[lsq_index], cpu->thread->lsq.cc_tag[lsq_index], &cpu->thread->lsq.ren[lsq_index]);
+    cpu->thread->pc = pc_value;
 }
 
-void flush_robEntries(APEX_CPU *cpu, int rob_index)
+/* Recovers from a wrong load value prediction. The load has its real value
+ * by now, so it stays and only what follows it is squashed. Its rename is
+ * redone on top of its replay checkpoint and fetch restarts after it */
+void recover_value_misprediction(APEX_CPU *cpu, int lsq_index)
 {
-    int lsq_index = cpu->rob.entry[rob_index]->lsq_index;
-    flush_lsqEntries(cpu, lsq_index); // lsq instructions are flushed here
-
-    int start = cpu->rob.tail;
-    int end = rob_index + 1;
-    while (start >= end)
+    int rob_index = cpu->thread->lsq.rob_index[lsq_index];
+    int rt[REG_FILE_SIZE];
+    Rename_State ren;
+    int cc_tag = cpu->thread->lsq.cc_tag[lsq_index];
+    int pc_value = cpu->thread->lsq.pc_value[lsq_index] + 4;
+
+    memcpy(rt, cpu->thread->lsq.rt[lsq_index], sizeof(rt));
+    memcpy(&ren, &cpu->thread->lsq.ren[lsq_index], sizeof(ren));
+    if (cpu->thread->rob.fused[rob_index] == FUSE_ADDL_LOAD)
     {
-        ROB_Entry *entry = cpu->rob.entry[start];
-        int prev_pr = entry->prev_phy_reg;
-        int curr_pr = entry->dest_phy_reg;
-        int arc_reg = entry->dest_arch_reg;
-        cpu->rt.reg[arc_reg] = prev_pr;
-        reverse_insert_pr(curr_pr, cpu);
-
-        if (start == 0)
-        {
-            start = ROB_SIZE - 1;
-        }
-        else
-        {
-            start = start - 1;
-        }
+        rt[cpu->thread->rob.fused_arch_reg[rob_index]] = cpu->thread->rob.fused_dest_phy_reg[rob_index];
+        holdPR(&ren, cpu->thread->rob.fused_dest_phy_reg[rob_index]);
+        cc_tag = cpu->thread->rob.cc_dest[rob_index];
+        holdCC(&ren, cc_tag);
+        pc_value += 4;
     }
-    cpu->rob.tail = rob_index;
+    rt[cpu->thread->rob.dest_arch_reg[rob_index]] = cpu->thread->lsq.dest_reg_address[lsq_index];
+    holdPR(&ren, cpu->thread->lsq.dest_reg_address[lsq_index]);
+
+    flush_front_end(cpu);
+    restoreFetchHistory(cpu, cpu->thread->lsq.path_hist[lsq_index], cpu->thread->lsq.ras_top[lsq_index], cpu->thread->lsq.ras_count[lsq_index], cpu->thread->lsq.ras_value[lsq_index]);
+    flush_robEntries(cpu, rob_index);
+    restoreRenameState(cpu, rt, cc_tag, &ren);
+    cpu->thread->pc = pc_value;
+    cpu->value_mispredictions++;
 }
 /*----------------------------------FLUSH instruction utilities end-----------------------------------*/
 
 /*
- * APEX CPU simulation loop
- *
- * Note: You are free to edit this function according to your implementation
+ * Simulates one clock cycle. Returns 1 once HALT retires, 2 when the user
+ * stopped the simulation and 0 otherwise
  */
-void APEX_cpu_run(APEX_CPU *cpu)
+int APEX_cpu_cycle(APEX_CPU *cpu)
 {
     char user_prompt_val;
 
-    while (TRUE)
+    if (ENABLE_DEBUG_MESSAGES)
     {
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            printf("--------------------------------------------\n");
-        }
-        if (do_commit(cpu))
-        {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
-            break;
-        }
+        printf("--------------------------------------------\n");
+        printf("Clock Cycle #: %d\n", cpu->clock);
+        printf("--------------------------------------------\n");
+    }
+    if (do_commit(cpu))
+    {
+        /* Halt in writeback stage */
+        return 1;
+    }
 
-        APEX_MUL4_FU(cpu);
-        APEX_MUL3_FU(cpu);
-        APEX_MUL2_FU(cpu);
-        APEX_MUL1_FU(cpu);
+    APEX_MUL4_FU(cpu);
+    APEX_MUL3_FU(cpu);
+    APEX_MUL2_FU(cpu);
+    APEX_MUL1_FU(cpu);
 
-        APEX_LOP_FU(cpu);
+    APEX_LOP_FU(cpu);
 
-        APEX_INT_FU(cpu); // ADD execution completed data released
-        APEX_LSQ(cpu);
-        APEX_IQ(cpu); // fwrd bus...data also received...BZ tag released
+    APEX_INT_FU(cpu); // ADD execution completed data released
+    APEX_LSQ(cpu);
+    APEX_IQ(cpu); // fwrd bus...data also received...BZ tag released
+
+    for (int i = 0; i < cpu->num_threads && cpu->num_threads > 1; i++)
+    {
+        cpu->threads[i].iq_occupancy += getThreadIQCount(cpu, i);
+    }
+    /* The front end serves one thread a cycle */
+    int tid = selectFetchThread(cpu);
+    if (cpu->num_threads > 1)
+    {
+        serveICacheMisses(cpu, tid);
+    }
+    if (tid != -1)
+    {
+        switch_thread(cpu, tid);
+        cpu->fetch_thread = tid;
+        cpu->threads[tid].front_end_cycles++;
 
         APEX_DR2(cpu);
         APEX_DR1(cpu);
 
         APEX_fetch(cpu);
+    }
 
-        print_reg_file(cpu);
-        print_rename_table(cpu);
-        print_physical_reg_file(cpu);
-        print_fwd_bus(cpu);
-
-        cpu->fBus[0].busy = 0;
-        cpu->fBus[0].isDataFwd = 0;
-        cpu->fBus[0].cc = 0;
-        cpu->fBus[1].busy = 0;
-        cpu->fBus[1].isDataFwd = 0;
-        cpu->fBus[1].cc = 0;
+    print_reg_file(cpu);
+    print_rename_table(cpu);
+    print_physical_reg_file(cpu);
+    print_fwd_bus(cpu);
+
+    cpu->fBus[0].busy = 0;
+    cpu->fBus[0].isDataFwd = 0;
+    cpu->fBus[0].cc = 0;
+    cpu->fBus[0].cc_tag = -1;
+    cpu->fBus[1].busy = 0;
+    cpu->fBus[1].isDataFwd = 0;
+    cpu->fBus[1].cc = 0;
+    cpu->fBus[1].cc_tag = -1;
+
+    if (cpu->single_step)
+    {
+        user_prompt_val = 'r';
+        printf("Press any key to advance CPU Clock or <q> to quit:\n");
+        //scanf("%c", &user_prompt_val);
 
-        if (cpu->single_step)
+        if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
         {
-            user_prompt_val = 'r';
-            printf("Press any key to advance CPU Clock or <q> to quit:\n");
-            //scanf("%c", &user_prompt_val);
+            return 2;
+        }
+    }
 
-            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
-            {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
-                break;
-            }
+    cpu->clock++;
+    return 0;
+}
+
+/*
+ * APEX CPU simulation loop
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+void APEX_cpu_run(APEX_CPU *cpu)
+{
+    int status;
+
+    while ((status = APEX_cpu_cycle(cpu)) == 0)
+    {
+    }
+    if (status == 1)
+    {
+        printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+    }
+    else
+    {
+        printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+    }
+    for (int i = 0; i < cpu->num_threads; i++)
+    {
+        switch_thread(cpu, i);
+        if (cpu->num_threads > 1)
+        {
+            printf("\n==========\nThread %d\n==========", i);
         }
+        print_reg_file(cpu);
+    }
+    print_stats(cpu);
+}
 
-        cpu->clock++;
+/* Stops fetch and runs the pipeline until every instruction already
+ * fetched has retired and its stores have left the store buffer.
+ * cpu->thread->pc is then the next instruction in
+ * program order and the registers, flags and data memory hold the
+ * architectural state.
+ * Returns 1 when a HALT retired */
+int APEX_cpu_drain(APEX_CPU *cpu)
+{
+    int status = 0;
+
+    cpu->fetch_gated = TRUE;
+    while (!isROBEmpty(cpu) || cpu->thread->DR1.has_insn || cpu->thread->DR2.has_insn || cpu->thread->fetch_buffer.count ||
+           cpu->thread->sb.count)
+    {
+        status = APEX_cpu_cycle(cpu);
+        if (status)
+        {
+            break;
+        }
     }
+    cpu->fetch_gated = FALSE;
+    return status == 1;
+}
+
+/* Restarts fetch at cpu->thread->pc on a drained pipeline whose
+ * architectural state may have been changed from outside, the registers
+ * are renamed afresh */
+void APEX_cpu_resume(APEX_CPU *cpu)
+{
+    intialize_PR_RT(cpu);
+    flush_fetch_buffer(cpu);
+    cpu->thread->fetch_from_next_cycle = FALSE;
+    cpu->thread->waitingForBranch = 0;
+    cpu->fetch_gated = FALSE;
 }
 
 /*
@@ -3150,6 +5813,15 @@ void APEX_cpu_run(APEX_CPU *cpu)
  */
 void APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    freeCache(&cpu->l1i);
+    freeCache(&cpu->l1d);
+    freeCache(&cpu->l2);
+    for (int i = 0; i < cpu->num_threads; i++)
+    {
+        switch_thread(cpu, i);
+        free(cpu->thread->code_memory);
+        free(cpu->thread->pe);
+    }
+    freeDataMemory(cpu->data_memory);
     free(cpu);
 }
\ No newline at end of file
@@ -9,7 +9,11 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include <pthread.h>
+
 #include "apex_macros.h"
+#include "apex_cache.h"
+#include "apex_memory.h"
 
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
@@ -32,80 +36,63 @@ typedef struct Forwarding_Bus
     int isDataFwd;
     int data;
     int cc;
+    int cc_tag; //CC register the flags in cc belong to, -1 for none
 }FB;
 
 
-/* Format of Physical Register*/
-typedef struct Physical_Reg_format
-{
-    int phy_Reg;
-    int reg_invalid;
-    int cc_flag;
-    int free;
-}PRF;
-
+/* Format of Physical Register file. Each field is an array over the
+ * registers, so a scan over one of them stays in a few cache lines. Free
+ * registers are the set bits of free_map, allocation takes the lowest one.
+ * A register is freed once the references its thread keeps for it in
+ * Rename_State drop to zero */
 typedef struct Physical_Reg
 {
-    PRF PR_File[PR_FILE_SIZE];
-    int head;
-    int tail;
+    int phy_Reg[PR_FILE_SIZE];
+    int reg_invalid[PR_FILE_SIZE];
+    int is_const[PR_FILE_SIZE]; //written in rename by MOVC or a zero idiom, shared by value
+    int cc_reg[PR_FILE_SIZE];   //CC register with the flags of phy_Reg, -1 for none
+    int cc_seq[PR_FILE_SIZE];   //allocation number of cc_reg, tells whether it is still that one
+    int thread[PR_FILE_SIZE];   //hardware thread whose rename allocated it
+    unsigned long long free_map[PR_MAP_WORDS];
+    int count;
 }PR;
 
+typedef struct CC_Reg
+{
+    int flag; //zero flag
+    int invalid;
+    int alloc_seq; //tells a reallocation apart, see PR cc_seq
+    int thread;
+}CC_Reg;
+
+/* Renamed condition code registers. Flags producers write their own CC
+ * register, so branches wait on that and never on a data register. Free
+ * registers are the set bits of free_map */
+typedef struct CC_File
+{
+    CC_Reg reg[CC_FILE_SIZE];
+    unsigned int free_map;
+    int count;
+    int alloc_seq; //number of the next allocation
+}CC_File;
+
 /* Format of Rename Table*/
 typedef struct Rename_Table
 {
     int reg[REG_FILE_SIZE];
 }RT;
 
-typedef struct IQ_Entry
+/* The PR and CC registers a thread holds and how many mappings, in its
+ * rename table and flags mapping or held by its ROB entries until they
+ * retire, still name each. Every branch and load keeps a copy, so a
+ * recovery puts it back with a memcpy */
+typedef struct Rename_State
 {
-    int allocated_bit;
-    int fu_type; //INT_FU (1), LOGICAL_FU (2), MUL_FU (3) 
-    int literal;
-    int src1_valid_bit;
-    int src1_tag;
-    int src1_value;
-    int src2_valid_bit;
-    int src2_tag;
-    int src2_value;
-    int dest;
-    int waitingForBranch;
-    int bis_index;
-    int pc_value;
-    int opcode;
-    int prediction;
-    char opcode_str[128];
-    int rs1;
-    int rs2;
-    int rs3;
-    int rd;
-}IQ_Entry;
-
-typedef struct LSQ_Entry
-{
-    int established_bit;
-    int lost;
-    int mem_valid_bit;
-    int mem_address;
-    int dest_reg_address;
-    int src_valid_bit;
-    int src_tag;
-    int src_value;
-    int rob_index;
-}LSQ_Entry;
-
-typedef struct ROB_Entry
-{
-    int established_bit;
-    int instruction_type;
-    int pc_value;
-    int dest_phy_reg;
-    int prev_phy_reg;
-    int dest_arch_reg;
-    int lsq_index;
-    int mem_error_code;
-    int isExecuted;
-}ROB_Entry;
+    unsigned long long pr_map[PR_MAP_WORDS]; //registers held, none of them in PR free_map
+    int pr_refs[PR_FILE_SIZE];
+    unsigned int cc_map;                     //CC registers held, never the pinned ones
+    int cc_refs[CC_FILE_SIZE];
+}Rename_State;
 
 typedef struct PC_exec
 {
@@ -115,43 +102,181 @@ typedef struct PC_exec
 
 typedef struct BTB_Entry
 {
-    int pc_value;
+    int valid;
+    int tag;
     int target_address;
     int prediction;
+    int lru_age; //0 for the most recently used way of the set
 }BTB_Entry;
 
+typedef struct ITP_Entry
+{
+    int valid;
+    int pc_value;
+    int target_address;
+}ITP_Entry;
+
+typedef struct RAS
+{
+    int entry[RAS_SIZE];
+    int top;
+    int count;
+}RAS;
+
 typedef struct BIS_Entry
 {
     int pc_value;
     int rob_index;
     int is_exec;
+    int pred_target;
+    int itp_index;
+    int cc_tag;    //CC register in effect at this branch
+    int path_hist; //path history before this branch was fetched
+    int ras_top;   //RAS state right after this branch was fetched
+    int ras_count;
+    int ras_value;
+    int rt[REG_FILE_SIZE]; //rename table right after this branch was renamed
+    Rename_State ren;      //registers held right after this branch was renamed
 }BIS_Entry;
 
+/* Store set predictor. The SSIT maps load and store PCs to a store set, a
+ * load waits for older stores of its own set whose address is unknown */
+typedef struct Store_Sets
+{
+    int ssit[SSIT_SIZE];
+    int next_ssid;
+}Store_Sets;
+
+/* Load value predictor entry, predicts last_value + stride for its PC */
+typedef struct VP_Entry
+{
+    int valid;
+    int pc_value;
+    int last_value;
+    int stride;
+    int confidence;
+}VP_Entry;
+
+/* Issue queue, kept in dispatch order from slot 0 to tail. Each field is
+ * an array over the slots, so the wakeup and select scans read the tags,
+ * valid bits and sequence numbers of all entries from a few cache lines and
+ * the broadcast matches the tags of all of them at once */
 typedef struct IQ
 {
-    IQ_Entry *entry[IQ_SIZE];
     int head;
     int tail;
+    int src1_tag[TAG_SLOTS(IQ_SIZE)];
+    int src2_tag[TAG_SLOTS(IQ_SIZE)];
+    int cc_src[TAG_SLOTS(IQ_SIZE)]; //CC register a branch tests, -1 for none
+    int allocated_bit[IQ_SIZE];
+    int src1_valid_bit[IQ_SIZE];
+    int src2_valid_bit[IQ_SIZE];
+    int cc_src_valid[IQ_SIZE];
+    int fu_type[IQ_SIZE];      //INT_FU (1), LOGICAL_FU (2), MUL_FU (3)
+    int seq[IQ_SIZE];          //dispatch order, lower is older
+    int ready_cycle[IQ_SIZE];  //first cycle all sources were valid, -1 until then
+    int thread[IQ_SIZE];       //hardware thread, a memory op's dest also names its LSQ
+    int opcode[IQ_SIZE];
+    int dest[IQ_SIZE];
+    int cc_dest[IQ_SIZE];      //CC register written, -1 for none
+    int fused[IQ_SIZE];        //FUSE_ kind
+    int fused_pd[IQ_SIZE];     //ADDL destination of a fused ADDL+LOAD
+    int src1_value[IQ_SIZE];
+    int src2_value[IQ_SIZE];
+
+    /* Read once the entry issues */
+    int literal[IQ_SIZE];
+    int fused_imm[IQ_SIZE];
+    int waitingForBranch[IQ_SIZE];
+    int bis_index[IQ_SIZE];
+    int pc_value[IQ_SIZE];
+    int prediction[IQ_SIZE];
+    int rs1[IQ_SIZE];
+    int rs2[IQ_SIZE];
+    int rs3[IQ_SIZE];
+    int rd[IQ_SIZE];
+    int rob_index[IQ_SIZE];
+    int dispatch_cycle[IQ_SIZE];
+    int rank[IQ_SIZE];         //select priority under the active policy, higher issues first
 }IQ;
 
+/* Load store queue, a circular buffer with a field array per entry field.
+ * tag mirrors the store data tag of each slot for the broadcast, a load's is
+ * -1, and mem_address is searched the same way */
 typedef struct LSQ
 {
-    LSQ_Entry *entry[LSQ_SIZE];
     int head;
     int tail;
+    int tag[TAG_SLOTS(LSQ_SIZE)];
+    int mem_address[TAG_SLOTS(LSQ_SIZE)];
+    int loads;  //entries held against LOAD_QUEUE_SIZE
+    int stores; //entries held against STORE_QUEUE_SIZE
+    int established_bit[LSQ_SIZE];
+    int lost[LSQ_SIZE];
+    int mem_valid_bit[LSQ_SIZE];
+    int src_valid_bit[LSQ_SIZE];
+    int mem_cycles[LSQ_SIZE]; //cycles left on the memory access, -1 until it starts
+    int is_done[LSQ_SIZE];    //load value is in the PR
+    int fwd_index[LSQ_SIZE];  //LSQ index of the store a load took its value from, -1 for memory
+    int store_set[LSQ_SIZE];  //store set of the instruction, 0 for none
+    int is_atomic[LSQ_SIZE];  //FADD, executes at the ROB head, its addend is in PR src_tag
+    int dest_reg_address[LSQ_SIZE];
+    int src_tag[LSQ_SIZE];
+    int src_value[LSQ_SIZE];
+    int rob_index[LSQ_SIZE];
+    int pc_value[LSQ_SIZE];
+    int value_predicted[LSQ_SIZE]; //dependents were handed predicted_value at dispatch
+    int predicted_value[LSQ_SIZE];
+
+    /* Checkpoint to replay a load from after an ordering violation */
+    int cc_tag[LSQ_SIZE];
+    int path_hist[LSQ_SIZE];
+    int ras_top[LSQ_SIZE];
+    int ras_count[LSQ_SIZE];
+    int ras_value[LSQ_SIZE];
+    int rt[LSQ_SIZE][REG_FILE_SIZE];
+    Rename_State ren[LSQ_SIZE];
 }LSQ;
 
+/* Retired stores in program order. Each starts its D-cache write as soon
+ * as the write port is free, a miss waits in an MSHR while younger ones
+ * start, and memory is written from the head once its access is over */
+typedef struct Store_Buffer
+{
+    int head;
+    int count;
+    int mem_address[STORE_BUFFER_SIZE];
+    int value[STORE_BUFFER_SIZE];
+    int pc_value[STORE_BUFFER_SIZE];
+    int mem_cycles[STORE_BUFFER_SIZE]; //cycles left on the access, -1 until it starts
+}Store_Buffer;
+
+/* Reorder buffer, a circular buffer with a field array per entry field */
 typedef struct ROB
 {
-    ROB_Entry *entry[ROB_SIZE];
     int head;
     int tail;
+    int established_bit[ROB_SIZE];
+    int isExecuted[ROB_SIZE];
+    int instruction_type[ROB_SIZE];
+    int pc_value[ROB_SIZE];
+    int dest_phy_reg[ROB_SIZE];
+    int prev_phy_reg[ROB_SIZE];
+    int dest_arch_reg[ROB_SIZE];
+    int lsq_index[ROB_SIZE];
+    int mem_error_code[ROB_SIZE];
+    int eliminated[ROB_SIZE]; //resolved in rename by sharing dest_phy_reg
+    int fused[ROB_SIZE];      //FUSE_ kind, the first instruction of the pair retires with it
+    int fused_dest_phy_reg[ROB_SIZE];
+    int fused_prev_phy_reg[ROB_SIZE];
+    int fused_arch_reg[ROB_SIZE];
+    int cc_dest[ROB_SIZE];    //CC register written, -1 for none
+    int cc_prev[ROB_SIZE];    //CC mapping it replaced, released at commit
 }ROB;
 
 typedef struct BTB
 {
-    BTB_Entry *entry[BTB_SIZE];
-    int tail;
+    BTB_Entry set[BTB_SETS][BTB_WAYS];
 }BTB;
 
 typedef struct BIS
@@ -188,33 +313,136 @@ typedef struct CPU_Stage
     int branch_reg;
     int branch_prediction;
     int waitingForBranch;
+    int bis_index;
+    int pred_target;
+    int itp_index;
+    int path_hist;
+    int ras_top;
+    int ras_count;
+    int ras_value;
+    int cc_tag;    //CC register in effect before this instruction
+    int cc_pd;     //CC register written, -1 for none
+    int cc_prev;
+    int rob_index;
+    int eliminated;
+    int fused;     //FUSE_ kind, CMP sources in rs1/rs2 or ADDL in fused_ fields
+    int fused_rd;
+    int fused_pd;
+    int fused_imm;
+    int fused_prev_phy_reg;
+    int thread;    //hardware thread the instruction belongs to
 } CPU_Stage;
 
+/* Decouples fetch from DR1, holds fetched instructions in program order */
+typedef struct Fetch_Buffer
+{
+    CPU_Stage entry[FETCH_BUFFER_SIZE];
+    int head;
+    int count;
+    int fusion_wait; //head already held a cycle for its fusion partner
+}Fetch_Buffer;
+
+/* Decoded micro-ops of the loop the loop stream detector is recording or
+ * streaming, entry[0] is the branch target and entry[count-1] the branch */
+typedef struct Loop_Buffer
+{
+    CPU_Stage entry[LOOP_BUFFER_SIZE];
+    int count;
+    int state;     //LSD_ state
+    int start_pc;  //first instruction of the body, the branch target
+    int branch_pc; //BZ/BNZ closing the loop
+    int next;      //entry streamed next
+}Loop_Buffer;
+
+/* A trace cache line, the path from start_pc is rebuilt from code memory
+ * with bit i of outcomes telling whether the trace's i-th branch was taken */
+typedef struct Trace
+{
+    int valid;
+    int thread;    //hardware thread whose retirement built it
+    int start_pc;
+    int count;     //instructions
+    int branches;
+    int outcomes;
+}Trace;
+
+/* The trace being built at commit */
+typedef struct Trace_Fill
+{
+    Trace trace;
+    int last_pc;   //youngest instruction added
+}Trace_Fill;
+
+/* Basic block vectors of a profiling run, one per BBV_INTERVAL retired
+ * instructions. Element i of a vector counts the instructions retired in
+ * blocks starting at code index i, so longer blocks weigh more */
+typedef struct BBV_Profile
+{
+    int blocks;       //elements of a vector, one per instruction of the program
+    int intervals;    //vectors completed
+    int capacity;
+    int *vectors;     //intervals x blocks
+    int *cycles;      //cycles each interval took
+    int block_start;  //code index of the block being retired
+    int insns;        //instructions retired in the current interval
+    int start_clock;  //cycle the current interval started
+    int last_pc;      //youngest instruction retired, 0 before the first
+    int failed;       //growing the vectors ran out of memory, profiling stopped
+}BBV_Profile;
+
+/* A hardware thread, the state the core keeps for each program it runs.
+ * The threads stay in APEX_CPU threads[], the pipeline functions work on
+ * the one cpu->thread points at */
+typedef struct APEX_Thread
+{
+    int pc;                        /* Current program counter */
+    int regs[REG_FILE_SIZE+1];     /* Integer register file */
+    int code_memory_size;          /* Number of instruction in the input file */
+    APEX_Instruction *code_memory; /* Code Memory */
+    PE *pe;
+    int fetch_from_next_cycle;
+    int prev_cc;                   /* CC register of the youngest flags producer */
+    int waitingForBranch;
+    CPU_Stage fetch;
+    CPU_Stage DR1;
+    CPU_Stage DR2;
+    RT rt;
+    Rename_State ren;              /* Registers it holds in the shared PR and CC files */
+    int const_map[CONST_MAP_SIZE]; /* PR last written with a constant, by its value, -1 for none */
+    LSQ lsq;
+    Store_Buffer sb;
+    ROB rob;
+    BIS bis;
+    RAS ras;
+    int path_hist;                 /* Speculative taken-target path history */
+    Fetch_Buffer fetch_buffer;
+    int icache_cycles;             /* Cycles left on the current I-cache access */
+    Loop_Buffer loop_buffer;
+    Trace_Fill trace_fill;
+
+    int halted;                    /* Its HALT has retired */
+    int insn_completed;
+    int front_end_cycles;          /* Cycles the fetch policy gave it the front end */
+    int branch_recoveries;
+    long iq_occupancy;             /* Its IQ entries, summed over all cycles */
+}APEX_Thread;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
-    int pc;                        /* Current program counter */
     int clock;                     /* Clock cycles elapsed */
     int insn_completed;            /* Instructions retired */
-    int regs[REG_FILE_SIZE+1];       /* Integer register file */
-    int code_memory_size;          /* Number of instruction in the input file */
-    APEX_Instruction *code_memory; /* Code Memory */
-    int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
+    Data_Memory *data_memory;      /* Data Memory, shared by the cores of a multi-core run */
     int single_step;               /* Wait for user input after every cycle */
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
-    int fetch_from_next_cycle;
-    int prev_cc;
-    int waitingForBranch;
+    CC_File ccf;
     int propogate_NOP;
     int conditional_pc;
     int cmp_flag;
     int new_bis;
     
 
-    /* Pipeline stages */
-    CPU_Stage fetch;
-    CPU_Stage DR1;
-    CPU_Stage DR2;
+    /* Pipeline stages, fetch, DR1 and DR2 are per thread */
     CPU_Stage I_Queue;
     //CPU_Stage execute;
     CPU_Stage INT_FU;
@@ -224,18 +452,74 @@ typedef struct APEX_CPU
     CPU_Stage MUL3_FU;
     CPU_Stage MUL4_FU;
     CPU_Stage commit;
-    RT rt;
     PR pr;
     FB fBus[2];
 
     IQ iq;
-    LSQ lsq;
-    ROB rob;
     BTB btb;
-    BIS bis;
-
-    PE *pe;
-    
+    ITP_Entry itp[ITP_SIZE];
+
+    /* Front end */
+    int icache_stall_cycles;       /* Cycles fetch waited on I-cache misses */
+    int decode_starved_cycles;     /* Cycles DR1 was free but the fetch buffer empty */
+    int loops_streamed;            /* Loops the loop stream detector locked in */
+    int lsd_uops;                  /* Micro-ops DR1 got from the loop buffer */
+    int lsd_cycles;                /* Cycles fetch was bypassed by the loop buffer */
+    Trace tc[TC_SIZE];
+    int traces_built;
+    int trace_lookups;             /* Fetches with room in the fetch buffer for a whole trace */
+    int trace_hits;                /* Lookups whose trace the predictor followed */
+    int trace_insns;               /* Instructions fetched from trace hits */
+    int fetch_gated;               /* Fetch is held while the pipeline drains */
+    BBV_Profile *bbv;              /* Basic block vectors recorded at commit, NULL when not profiling */
+
+    /* Memory hierarchy */
+    int loads_executed;
+    int loads_forwarded;           /* Loads served by an older store in the LSQ or store buffer */
+    int loads_buffer_forwarded;    /* ... of which from the store buffer */
+    int store_buffer_full_cycles;  /* Cycles a retiring store waited for a store buffer slot */
+    int loads_speculated;          /* Loads issued past an older unknown store address */
+    int ordering_violations;       /* Loads replayed after an older store matched them */
+    Store_Sets store_sets;
+    VP_Entry vp[VP_SIZE];
+    int values_predicted;          /* Loads whose dependents got a predicted value */
+    int value_mispredictions;      /* ... of which the value was wrong */
+    int retire_histogram[COMMIT_WIDTH + 1]; /* Cycles that retired 0..COMMIT_WIDTH instructions */
+    int branch_recoveries;         /* Checkpoint restores after a mispredict */
+    int consts_eliminated;         /* MOVCs mapped onto a constant register */
+    int zero_idioms_eliminated;    /* SUB/XOR Rx,Ry,Ry mapped onto the zero constant */
+    int copies_eliminated;         /* ADDL/SUBL Rx,Ry,#0 aliased to Ry's register */
+    int rename_blocked_cycles;     /* Cycles DR1 waited for a free physical register */
+    int select_policy;             /* SELECT_ policy of the issue stage */
+    int iq_seq;                    /* Dispatch number of the next IQ entry */
+    int insn_issued;
+    long issue_wait_cycles;        /* Dispatch to issue, summed over issued entries */
+    long ready_wait_cycles;        /* Ready to issue, summed over issued entries */
+    int max_ready_wait;
+    int cmp_branches_fused;        /* CMP+BZ/BNZ pairs retired as one micro-op */
+    int addl_loads_fused;          /* ADDL+LOAD pairs retired as one micro-op */
+    long outstanding_misses;       /* L1D MSHRs in use, summed over all cycles */
+    Cache l1i;
+    Cache l1d;
+    Prefetcher prefetcher;
+    Cache l2;
+    Main_Memory memory;
+
+    /* Multi-core */
+    int core_id;
+    pthread_mutex_t *bus_lock;     /* Coherence bus, NULL when the core runs alone */
+    int atomics_executed;
+    int fences;
+    int fence_stall_cycles;        /* Cycles a FENCE waited in DR2 for the LSQ and store buffer to drain */
+
+    /* Simultaneous multithreading */
+    int tid;                       /* Thread the pipeline functions work on */
+    APEX_Thread *thread;           /* ... and its state, threads[tid] */
+    int num_threads;
+    int threads_halted;
+    int fetch_policy;              /* FETCH_ policy of the front end */
+    int fetch_thread;              /* Thread the front end served last */
+    APEX_Thread threads[SMT_THREADS];
 } APEX_CPU;
 
 //IQ
@@ -255,7 +539,6 @@ void addIQEntry(
     int pc_value,
     int opcode,
     int prediction,
-    char opcode_str[128],
     int rs1,
     int rs2,
     int rs3,
@@ -263,15 +546,23 @@ void addIQEntry(
     APEX_CPU *cpu
     );
 
-IQ_Entry *getIQEntry(APEX_CPU *cpu);
 int getIQEntry_Index(APEX_CPU *cpu, int index);
+void rankIQEntry(APEX_CPU *cpu, int index);
+int selectIQEntry(APEX_CPU *cpu);
+const char *getSelectPolicyName(int policy);
+int getSelectPolicy(const char *name);
 int isIQFull(APEX_CPU *cpu);
 int isIQEmpty(APEX_CPU *cpu);
-int isIQEntryReady(IQ_Entry *entry);
+int isIQEntryReady(APEX_CPU *cpu, int index);
 void shiftIQElements(APEX_CPU *cpu, int pos);
 void updateIQEntry(APEX_CPU *cpu, int src_tag, int isDataAvailable, int src_value);
+void updateIQFlags(APEX_CPU *cpu, int cc_tag);
 static void APEX_IQ(APEX_CPU *cpu);
 
+//Tag matching
+void initTagMatch(void);
+const char *getTagMatchName(void);
+
 //LSQ
 void addLSQEntry(
     int established_bit,
@@ -288,10 +579,14 @@ void addLSQEntry(
 
 int isLSQFull(APEX_CPU *cpu);
 int isLSQEmpty(APEX_CPU *cpu);
-int isLSQEntryReady(LSQ_Entry *entry);
+int isLoadQueueFull(APEX_CPU *cpu);
+int isStoreQueueFull(APEX_CPU *cpu);
+void removeLSQHead(APEX_CPU *cpu);
+void saveLSQCheckpoint(APEX_CPU *cpu, const CPU_Stage *stage);
 int getLSQEntry(APEX_CPU *cpu);
 void updateLSQEntry(APEX_CPU *cpu, int src_tag, int src_value);
 static void APEX_LSQ(APEX_CPU *cpu);
+static void execute_loads(APEX_CPU *cpu, int *port_free);
 
 //ROB
 void addROBEntry(
@@ -305,36 +600,80 @@ void addROBEntry(
     int mem_error_code,
     APEX_CPU *cpu
 );
-ROB_Entry* getROBHead(APEX_CPU *cpu);
+int getROBHead(APEX_CPU *cpu);
 void removeROBHead(APEX_CPU *cpu);
 int isROBFull(APEX_CPU *cpu);
 int isROBEmpty(APEX_CPU *cpu);
-int isROBEntryReady(ROB_Entry *entry);
 void updateROBEntry(APEX_CPU *cpu, int src_tag, int src_value);
 
 //BTB
 void addBTBEntry(int pc_value, int target_address, APEX_CPU *cpu);
 BTB_Entry* getBTBEntry(int pc_value, APEX_CPU *cpu);
-void BTBReplacement(APEX_CPU *cpu, BTB_Entry *entry);
-int isBTBFull(APEX_CPU *cpu);
+int BTBReplacement(APEX_CPU *cpu, int set);
+void touchBTBEntry(APEX_CPU *cpu, int set, int way);
 
 //BIS
 int isBISFull(APEX_CPU *cpu);
 void addBISEntry(APEX_CPU *cpu, int pc_value, int rob_index, int is_exec);
+void saveBISCheckpoint(APEX_CPU *cpu, const CPU_Stage *stage);
+void removeBISHead(APEX_CPU *cpu);
 void updateBTBEntry(int pc_value, int prediction, APEX_CPU *cpu);
 
+//Indirect target predictor and RAS
+int is_control_transfer(int opcode);
+int getITPIndex(APEX_CPU *cpu, int pc_value);
+ITP_Entry *getITPEntry(APEX_CPU *cpu, int index, int pc_value);
+void updateITPEntry(APEX_CPU *cpu, int index, int pc_value, int target_address);
+void pushRAS(APEX_CPU *cpu, int return_address);
+int popRAS(APEX_CPU *cpu);
+void restoreFetchHistory(APEX_CPU *cpu, int path_hist, int ras_top, int ras_count, int ras_value);
+void updatePathHistory(APEX_CPU *cpu, int target_address);
+
+//Store sets
+int getStoreSet(APEX_CPU *cpu, int pc_value);
+void trainStoreSets(APEX_CPU *cpu, int load_pc, int store_pc);
+void clearStoreSets(APEX_CPU *cpu);
+
+//Load value predictor
+void predictLoadValue(APEX_CPU *cpu);
+void trainValuePredictor(APEX_CPU *cpu, int pc_value, int value);
+
+//Basic block vectors
+BBV_Profile *createBBVProfile(APEX_CPU *cpu);
+void freeBBVProfile(BBV_Profile *bbv);
+void recordBasicBlock(APEX_CPU *cpu, int pc_value);
+
+//Fetch buffer
+int isFetchBufferFull(APEX_CPU *cpu);
+void addFetchBufferEntry(APEX_CPU *cpu, const CPU_Stage *stage);
+void flush_fetch_buffer(APEX_CPU *cpu);
+
+//SMT
+void switch_thread(APEX_CPU *cpu, int tid);
+int getThreadShare(APEX_CPU *cpu, int size);
+int selectFetchThread(APEX_CPU *cpu);
+const char *getFetchPolicyName(int policy);
+int getFetchPolicy(const char *name);
+
 //FLUSH
-void flush_instructions(APEX_CPU *cpu, int pc_value);
-void flush_bisEntries(APEX_CPU *cpu, int pc_value);
-void flush_iqEntries(APEX_CPU *cpu, int bis_index);
-void flush_lsqEntries(APEX_CPU *cpu, int lsq_index);
+void flush_instructions(APEX_CPU *cpu, int bis_index);
+void flush_bisEntries(APEX_CPU *cpu, int rob_index);
+void flush_iqEntries(APEX_CPU *cpu, int rob_index);
+void flush_lsqEntries(APEX_CPU *cpu, int rob_index);
+void flush_fuEntries(APEX_CPU *cpu, int rob_index);
+void replay_load(APEX_CPU *cpu, int lsq_index);
+void recover_value_misprediction(APEX_CPU *cpu, int lsq_index);
 void flush_robEntries(APEX_CPU *cpu, int rob_index);
 
 
 APEX_Instruction *create_code_memory(const char *filename, int *size);
 APEX_CPU *APEX_cpu_init(const char *filename);
+int APEX_cpu_add_thread(APEX_CPU *cpu, const char *filename);
+int APEX_cpu_cycle(APEX_CPU *cpu);
 void APEX_cpu_run(APEX_CPU *cpu);
+int APEX_cpu_drain(APEX_CPU *cpu);
+void APEX_cpu_resume(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
 int do_commit(APEX_CPU *cpu);
-void APEX_D_cache(APEX_CPU *cpu);
+void APEX_D_cache(APEX_CPU *cpu, int *port_free);
 #endif
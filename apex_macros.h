@@ -12,23 +12,250 @@
 #define FALSE 0x0
 #define TRUE 0x1
 
-/* Integers */
-#define DATA_MEMORY_SIZE 4096
+/* Data memory: 32-bit word addresses, split into a page directory index of
+ * the top bits, a page table index of MEM_TABLE_BITS and a word offset of
+ * MEM_PAGE_BITS */
+#define MEM_PAGE_BITS 10
+#define MEM_TABLE_BITS 11
+#define MEM_PAGE_WORDS (1 << MEM_PAGE_BITS)
+#define MEM_TABLE_SIZE (1 << MEM_TABLE_BITS)
+#define MEM_DIRECTORY_SIZE (1 << (32 - MEM_PAGE_BITS - MEM_TABLE_BITS))
+
+/* Cache replacement policies */
+#define REPL_LRU 0
+#define REPL_FIFO 1
+#define REPL_RANDOM 2
+
+/* Memory hierarchy behind APEX_D_cache. Sizes are in data memory words,
+ * latencies in cycles. A hit costs the level's hit latency, a miss adds the
+ * latency of the level below */
+#define L1D_SIZE 256
+#define L1D_ASSOC 2
+#define L1D_LINE_SIZE 4
+#define L1D_HIT_LATENCY 1
+#define L1D_REPLACEMENT REPL_LRU
+#define L1D_WRITE_BACK 1
+#define L1D_WRITE_ALLOCATE 1
+/* Misses the L1D can have outstanding before further misses wait */
+#define L1D_MSHRS 4
+
+/* L1D prefetcher fed by the LSQ address stream. L1D_PREFETCHER selects one
+ * of the PREFETCH_ kinds, PREFETCH_DEGREE is how many lines next-line and
+ * stride fetch ahead, STREAM_DISTANCE how far a stream runs ahead */
+#define PREFETCH_NONE 0
+#define PREFETCH_NEXT_LINE 1
+#define PREFETCH_STRIDE 2
+#define PREFETCH_STREAM 3
+#define L1D_PREFETCHER PREFETCH_STRIDE
+#define PREFETCH_DEGREE 2
+#define STRIDE_TABLE_SIZE 64
+#define STREAM_TABLE_SIZE 4
+#define STREAM_DISTANCE 4
+
+#define L2_SIZE 2048
+#define L2_ASSOC 8
+#define L2_LINE_SIZE 8
+#define L2_HIT_LATENCY 8
+#define L2_REPLACEMENT REPL_LRU
+#define L2_WRITE_BACK 1
+#define L2_WRITE_ALLOCATE 1
+
+#define MEM_LATENCY 60
+
+/* L1 instruction cache, sizes in instructions. Misses are served by the
+ * unified L2, in which instruction fetches use their own address region so
+ * code lines never alias data words */
+#define L1I_SIZE 64
+#define L1I_ASSOC 2
+#define L1I_LINE_SIZE 4
+#define L1I_HIT_LATENCY 1
+#define L1I_REPLACEMENT REPL_LRU
+#define CODE_ADDRESS_SPACE 0x40000000
+
+/* Multi-core runs: up to MAX_CORES cores, each with private L1s kept
+ * coherent by MESI snooping, share the L2 and data memory. A cache to cache
+ * transfer or a shared to modified upgrade costs COHERENCE_LATENCY cycles.
+ * Host threads step the cores in quanta of CORE_QUANTUM cycles */
+#define MAX_CORES 8
+#define CORE_QUANTUM 100
+#define COHERENCE_LATENCY 6
+#define MESI_INVALID 0
+#define MESI_SHARED 1
+#define MESI_EXCLUSIVE 2
+#define MESI_MODIFIED 3
+
+/* Simultaneous multithreading: up to SMT_THREADS hardware threads, each
+ * with its own program, architectural state and front end, share the IQ,
+ * physical registers, function units and forwarding buses of a core. The
+ * ROB and the load and store queues are split evenly between the threads.
+ * The front end serves one thread a cycle, picked by a FETCH_ policy.
+ * FETCH_POLICY is the default, a run can choose another with --fetch=<name> */
+#define SMT_THREADS 2
+#define FETCH_ROUND_ROBIN 0
+#define FETCH_ICOUNT 1
+#define FETCH_POLICY FETCH_ICOUNT
+
+/* Instructions held between fetch and DR1, room for a whole trace behind
+ * the ones already waiting */
+#define FETCH_BUFFER_SIZE 8
+
+/* Loop stream detector: decode captures a loop of at most LOOP_BUFFER_SIZE
+ * instructions closed by a predicted taken backward BZ/BNZ, with no JUMP,
+ * JAL, RET or HALT in its body, and streams its micro-ops into DR1 with
+ * fetch bypassed until the loop exits. LSD_ states */
+#define ENABLE_LOOP_BUFFER 1
+#define LOOP_BUFFER_SIZE 16
+#define LSD_IDLE 0
+#define LSD_RECORDING 1
+#define LSD_STREAMING 2
+
+/* Trace cache: TC_SIZE direct mapped traces (a power of two) built from the
+ * retired instruction stream. A trace is a start PC and the outcomes of its
+ * BZ/BNZ, up to TRACE_LENGTH instructions and TRACE_BRANCHES branches. When
+ * the predictor follows the same path, fetch takes the whole trace in one
+ * cycle. The trace cache is only looked up while the fetch buffer has room
+ * for TRACE_LENGTH instructions, the I-cache fetches one at a time */
+#define ENABLE_TRACE_CACHE 1
+#define TC_SIZE 64
+#define TRACE_LENGTH 4
+#define TRACE_BRANCHES 2
+
+#if TRACE_LENGTH > FETCH_BUFFER_SIZE
+#error "TRACE_LENGTH must be at most FETCH_BUFFER_SIZE"
+#endif
+
+/* Sampled runs (--sample): every SAMPLE_PERIOD instructions, SAMPLE_UNIT are
+ * measured in detail after SAMPLE_WARMUP detailed ones refill the pipeline,
+ * the rest only warm the caches and predictors. The CPI confidence interval
+ * is SAMPLE_Z standard errors wide, and while its half width is above
+ * SAMPLE_TARGET_ERROR of the mean the program is run again at the period
+ * the spread so far calls for, at most SAMPLE_MAX_PASSES times. A rerun
+ * never goes below SAMPLE_MIN_PERIOD, so at least half of it stays
+ * functional, the interval reached is reported when the target is missed */
+#define SAMPLE_PERIOD 400
+#define SAMPLE_UNIT 50
+#define SAMPLE_WARMUP 50
+#define SAMPLE_MIN_PERIOD (2 * (SAMPLE_WARMUP + SAMPLE_UNIT))
+#define SAMPLE_Z 3.0
+#define SAMPLE_TARGET_ERROR 0.03
+#define SAMPLE_MAX_PASSES 4
+
+/* SimPoint profiling (--profile=<file>): the retired PC stream is cut into
+ * intervals of BBV_INTERVAL instructions, each summed up by its basic block
+ * vector. The vectors are randomly projected to BBV_DIMENSIONS and grouped
+ * by k-means for every k up to BBV_MAX_K, keeping the smallest k with
+ * BBV_SCORE of the largest distortion reduction. A --simpoints=<file> run
+ * measures only the chosen intervals, after BBV_WARMUP detailed ones */
+#define BBV_INTERVAL 500
+#define BBV_DIMENSIONS 15
+#define BBV_MAX_K 6
+#define BBV_SCORE 0.9
+#define BBV_KMEANS_ITERATIONS 100
+#define BBV_WARMUP 100
 
 /* Size of integer register file */
 #define REG_FILE_SIZE 8
 
-#define PR_FILE_SIZE 15
+/* Physical registers, 64 to 256 independent of REG_FILE_SIZE. The free list
+ * is a bitmap of PR_MAP_WORDS 64 bit words */
+#define PR_FILE_SIZE 128
+#define PR_MAP_WORDS ((PR_FILE_SIZE + 63) / 64)
+#if PR_FILE_SIZE < 64 || PR_FILE_SIZE > 256
+#error "PR_FILE_SIZE must be between 64 and 256"
+#endif
+/* Slots of the per thread map from a constant to the PR holding it, a
+ * power of two. Constants sharing a slot evict each other */
+#define CONST_MAP_SIZE 16
+#if CONST_MAP_SIZE & (CONST_MAP_SIZE - 1)
+#error "CONST_MAP_SIZE must be a power of two"
+#endif
+/* Data tag on a forwarding bus that only carries flags */
+#define NO_DATA_TAG PR_FILE_SIZE
+
+/* Renamed condition code registers, at most 32 for the free bitmap.
+ * CC_ZERO_CLEAR and CC_ZERO_SET are pinned registers holding a clear and a
+ * set zero flag, shared by constants and zero idioms */
+#define CC_FILE_SIZE 16
+#define CC_ZERO_CLEAR 0
+#define CC_ZERO_SET 1
+#if CC_FILE_SIZE > 32
+#error "CC_FILE_SIZE must be at most 32"
+#endif
 
 #define INT_U 1
 #define LOP_U 2
 #define MUL_U 3
 
 #define IQ_SIZE 8
-#define LSQ_SIZE 4
-#define ROB_SIZE 12
-#define BTB_SIZE 4
+/* Issue select policies, picking among the ready IQ entries whose FU is
+ * free. ISSUE_SELECT_POLICY is the default, a run can choose another with
+ * --select=<name>. Ties always go to the oldest entry */
+#define SELECT_OLDEST 0
+#define SELECT_DEPENDENTS 1
+#define SELECT_CRITICAL_PATH 2
+#define SELECT_LOAD_FIRST 3
+#define SELECT_BRANCH_FIRST 4
+#define ISSUE_SELECT_POLICY SELECT_OLDEST
+/* Loads and stores share one program ordered LSQ but are admitted against
+ * separate capacities */
+#define LOAD_QUEUE_SIZE 4
+#define STORE_QUEUE_SIZE 4
+#define LSQ_SIZE (LOAD_QUEUE_SIZE + STORE_QUEUE_SIZE)
+/* Retired stores waiting for their D-cache write, per thread */
+#define STORE_BUFFER_SIZE 8
+#define ROB_SIZE 32
+
+/* Tag broadcasts and LSQ address searches compare against contiguous tag
+ * arrays, TAG_MATCH_WIDTH at a time with AVX2 or SSE2 when CPUID reports
+ * them and one at a time otherwise. The arrays are padded to a multiple of
+ * TAG_MATCH_WIDTH, a match is a bit mask of TAG_MASK_WORDS 64 bit words */
+#define ENABLE_SIMD_TAG_MATCH 1
+#define TAG_MATCH_WIDTH 8
+#define TAG_SLOTS(size) (((size) + TAG_MATCH_WIDTH - 1) / TAG_MATCH_WIDTH * TAG_MATCH_WIDTH)
+#define TAG_MASK_WORDS(size) (((size) + 63) / 64)
+/* Each BIS entry is a branch checkpoint holding a rename table and free
+ * list snapshot, BIS_SIZE bounds the unresolved branches in flight */
 #define BIS_SIZE 8
+/* Instructions retired from the ROB head per cycle, of which at most
+ * COMMIT_STORE_WIDTH can be stores moving to the store buffer */
+#define COMMIT_WIDTH 4
+#define COMMIT_STORE_WIDTH 1
+
+/* Store set predictor: SSIT_SIZE PC indexed entries (a power of two), all
+ * forgotten every SSIT_CLEAR_INTERVAL cycles so stale sets stop serializing
+ * loads */
+#define SSIT_SIZE 256
+#define SSIT_CLEAR_INTERVAL 8192
+
+/* Load value predictor: VP_SIZE PC indexed entries (a power of two) holding
+ * the last value and stride of a load. Once the same stride has repeated
+ * VP_CONFIDENCE times, dispatch hands dependents last value + stride */
+#define ENABLE_VALUE_PREDICTION 1
+#define VP_SIZE 256
+#define VP_CONFIDENCE 2
+#define VP_CONFIDENCE_MAX 7
+
+/* Decode fuses an adjacent CMP+BZ/BNZ or ADDL+LOAD pair into one micro-op,
+ * FUSE_ kinds mark which pair a micro-op carries */
+#define ENABLE_MACRO_FUSION 1
+#define FUSE_NONE 0
+#define FUSE_CMP_BRANCH 1
+#define FUSE_ADDL_LOAD 2
+
+/* Branch target buffer geometry: BTB_SETS x BTB_WAYS entries indexed by the
+ * word-aligned PC bits, with BTB_TAG_BITS of the remaining PC kept as a
+ * partial tag. BTB_SETS must be a power of two. */
+#define BTB_SETS 512
+#define BTB_WAYS 4
+#define BTB_TAG_BITS 10
+
+/* Indirect target predictor for JUMP/JAL, indexed by the PC hashed with
+ * ITP_HIST_BITS of taken-target path history. ITP_SIZE must be a power of two */
+#define ITP_SIZE 256
+#define ITP_HIST_BITS 8
+
+/* Return address stack depth, pushed by JAL and popped by RET */
+#define RAS_SIZE 16
 
 #define R2R 1
 #define LOAD 2
@@ -58,6 +285,10 @@
 #define OPCODE_ADDL 0x11
 #define OPCODE_SUBL 0x12
 #define OPCODE_CMP  0x13
+#define OPCODE_JAL 0x14
+#define OPCODE_RET 0x15
+#define OPCODE_FADD 0x16
+#define OPCODE_FENCE 0x17
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
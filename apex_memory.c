@@ -0,0 +1,90 @@
+/*
+ * apex_memory.c
+ * Contains the sparse paged data memory
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdlib.h>
+
+#include "apex_memory.h"
+#include "apex_macros.h"
+
+Data_Memory *
+createDataMemory(void)
+{
+    return calloc(1, sizeof(Data_Memory));
+}
+
+void
+freeDataMemory(Data_Memory *mem)
+{
+    if (!mem)
+    {
+        return;
+    }
+    for (int i = 0; i < MEM_DIRECTORY_SIZE; i++)
+    {
+        if (!mem->tables[i])
+        {
+            continue;
+        }
+        for (int j = 0; j < MEM_TABLE_SIZE; j++)
+        {
+            free(mem->tables[i][j]);
+        }
+        free(mem->tables[i]);
+    }
+    free(mem);
+}
+
+/* Page holding address, allocated when allocate is set. NULL for a page
+ * never written, or when memory for it runs out */
+static int *
+getPage(Data_Memory *mem, unsigned int address, int allocate)
+{
+    unsigned int page = address >> MEM_PAGE_BITS;
+    if (mem->last_words && page == mem->last_page)
+    {
+        return mem->last_words;
+    }
+
+    int ***table = &mem->tables[page >> MEM_TABLE_BITS];
+    if (!*table)
+    {
+        if (!allocate || !(*table = calloc(MEM_TABLE_SIZE, sizeof(int *))))
+        {
+            return NULL;
+        }
+    }
+    int **words = &(*table)[page & (MEM_TABLE_SIZE - 1)];
+    if (!*words)
+    {
+        if (!allocate || !(*words = calloc(MEM_PAGE_WORDS, sizeof(int))))
+        {
+            return NULL;
+        }
+        mem->pages++;
+    }
+    mem->last_page = page;
+    mem->last_words = *words;
+    return *words;
+}
+
+int
+readDataMemory(Data_Memory *mem, unsigned int address)
+{
+    int *words = getPage(mem, address, FALSE);
+    return words ? words[address & (MEM_PAGE_WORDS - 1)] : 0;
+}
+
+void
+writeDataMemory(Data_Memory *mem, unsigned int address, int value)
+{
+    int *words = getPage(mem, address, TRUE);
+    if (words)
+    {
+        words[address & (MEM_PAGE_WORDS - 1)] = value;
+    }
+}
@@ -0,0 +1,31 @@
+/*
+ * apex_memory.h
+ * Contains the data memory declarations
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_MEMORY_H_
+#define _APEX_MEMORY_H_
+
+#include "apex_macros.h"
+
+/* Sparse data memory over a 32-bit word address space. A two level page
+ * table maps page numbers to pages of MEM_PAGE_WORDS words, allocated zeroed
+ * by the first write to them. Reads of a page never written return 0
+ * without allocating it. The page used last is kept aside so a run of
+ * accesses to the same page skips the table walk */
+typedef struct Data_Memory
+{
+    int **tables[MEM_DIRECTORY_SIZE];  /* Page pointers, NULL for an empty table */
+    unsigned int last_page;            /* Page number of last_words */
+    int *last_words;                   /* Page used last, NULL for none */
+    int pages;                         /* Pages allocated */
+}Data_Memory;
+
+Data_Memory *createDataMemory(void);
+void freeDataMemory(Data_Memory *mem);
+int readDataMemory(Data_Memory *mem, unsigned int address);
+void writeDataMemory(Data_Memory *mem, unsigned int address, int value);
+#endif
@@ -0,0 +1,465 @@
+/*
+ * apex_sample.c
+ * Contains the sampled simulation, short detailed measurements taken at a
+ * fixed instruction interval with functional warming in between
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "apex_sample.h"
+#include "apex_macros.h"
+
+static void
+write_result(APEX_CPU *cpu, const APEX_Instruction *instr, int result)
+{
+    cpu->thread->regs[instr->rd] = result;
+    if (writes_flags(instr->opcode))
+    {
+        cpu->thread->regs[REG_FILE_SIZE] = result == 0;
+    }
+}
+
+/* Word of data memory at address through the L1D */
+static int
+functional_load(APEX_CPU *cpu, int address)
+{
+    accessCache(&cpu->l1d, address, FALSE);
+    return readDataMemory(cpu->data_memory, address);
+}
+
+static void
+functional_store(APEX_CPU *cpu, int address, int value)
+{
+    accessCache(&cpu->l1d, address, TRUE);
+    writeDataMemory(cpu->data_memory, address, value);
+}
+
+/* Trains the BTB, ITP, RAS and path history with a control transfer the
+ * way its execution and fetch would */
+static void
+warm_branch_predictors(APEX_CPU *cpu, const APEX_Instruction *instr, int taken, int target)
+{
+    switch (instr->opcode)
+    {
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        {
+            if (getBTBEntry(cpu->thread->pc, cpu) != NULL)
+            {
+                updateBTBEntry(cpu->thread->pc, taken, cpu);
+            }
+            else if (taken)
+            {
+                addBTBEntry(cpu->thread->pc, target, cpu);
+            }
+            break;
+        }
+
+        case OPCODE_JUMP:
+        case OPCODE_JAL:
+        {
+            updateITPEntry(cpu, getITPIndex(cpu, cpu->thread->pc), cpu->thread->pc, target);
+            if (instr->opcode == OPCODE_JAL)
+            {
+                pushRAS(cpu, cpu->thread->pc + 4);
+            }
+            break;
+        }
+
+        case OPCODE_RET:
+        {
+            if (cpu->thread->ras.count > 0)
+            {
+                popRAS(cpu);
+            }
+            break;
+        }
+    }
+    if (taken)
+    {
+        updatePathHistory(cpu, target);
+    }
+}
+
+/* Executes the instruction at cpu->thread->pc on the architectural state
+ * alone, without timing. The L1I, L1D, branch predictors, value predictor and
+ * trace cache see it as if it had run in detail. Returns FALSE at HALT */
+int
+functional_step(APEX_CPU *cpu)
+{
+    int code_index = get_code_memory_index_from_pc(cpu->thread->pc);
+    if (code_index < 0 || code_index >= cpu->thread->code_memory_size)
+    {
+        return FALSE;
+    }
+    const APEX_Instruction *instr = &cpu->thread->code_memory[code_index];
+    int *regs = cpu->thread->regs;
+    int taken = FALSE;
+    int target = 0;
+
+    int region = cpu->core_id * SMT_THREADS + cpu->tid;
+    accessCache(&cpu->l1i, CODE_ADDRESS_SPACE + (region << 24) + code_index, FALSE);
+    if (ENABLE_TRACE_CACHE)
+    {
+        fill_trace(cpu, cpu->thread->pc);
+    }
+
+    switch (instr->opcode)
+    {
+        case OPCODE_ADD:
+        {
+            write_result(cpu, instr, regs[instr->rs1] + regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_SUB:
+        {
+            write_result(cpu, instr, regs[instr->rs1] - regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_MUL:
+        {
+            write_result(cpu, instr, regs[instr->rs1] * regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_DIV:
+        {
+            write_result(cpu, instr, divide(regs[instr->rs1], regs[instr->rs2]));
+            break;
+        }
+
+        case OPCODE_AND:
+        {
+            write_result(cpu, instr, regs[instr->rs1] & regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_OR:
+        {
+            write_result(cpu, instr, regs[instr->rs1] | regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_XOR:
+        {
+            write_result(cpu, instr, regs[instr->rs1] ^ regs[instr->rs2]);
+            break;
+        }
+
+        case OPCODE_ADDL:
+        {
+            write_result(cpu, instr, regs[instr->rs1] + instr->imm);
+            break;
+        }
+
+        case OPCODE_SUBL:
+        {
+            write_result(cpu, instr, regs[instr->rs1] - instr->imm);
+            break;
+        }
+
+        case OPCODE_MOVC:
+        {
+            write_result(cpu, instr, instr->imm);
+            break;
+        }
+
+        case OPCODE_CMP:
+        {
+            regs[REG_FILE_SIZE] = regs[instr->rs1] == regs[instr->rs2];
+            break;
+        }
+
+        case OPCODE_LOAD:
+        case OPCODE_LDR:
+        {
+            int address = regs[instr->rs1] + (instr->opcode == OPCODE_LOAD ? instr->imm : regs[instr->rs2]);
+            write_result(cpu, instr, functional_load(cpu, address));
+            if (ENABLE_VALUE_PREDICTION)
+            {
+                trainValuePredictor(cpu, cpu->thread->pc, regs[instr->rd]);
+            }
+            break;
+        }
+
+        case OPCODE_STORE:
+        {
+            functional_store(cpu, regs[instr->rs2] + instr->imm, regs[instr->rs1]);
+            break;
+        }
+
+        case OPCODE_STR:
+        {
+            functional_store(cpu, regs[instr->rs2] + regs[instr->rs3], regs[instr->rs1]);
+            break;
+        }
+
+        case OPCODE_FADD:
+        {
+            int address = regs[instr->rs1];
+            int value = functional_load(cpu, address);
+            functional_store(cpu, address, value + regs[instr->rs2]);
+            regs[instr->rd] = value;
+            break;
+        }
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        {
+            taken = regs[REG_FILE_SIZE] == (instr->opcode == OPCODE_BZ);
+            target = cpu->thread->pc + instr->imm;
+            break;
+        }
+
+        case OPCODE_JUMP:
+        case OPCODE_JAL:
+        case OPCODE_RET:
+        {
+            taken = TRUE;
+            target = regs[instr->rs1] + instr->imm;
+            if (instr->opcode == OPCODE_JAL)
+            {
+                regs[instr->rd] = cpu->thread->pc + 4;
+            }
+            break;
+        }
+
+        case OPCODE_HALT:
+        {
+            return FALSE;
+        }
+    }
+    if (is_control_transfer(instr->opcode))
+    {
+        warm_branch_predictors(cpu, instr, taken, target);
+    }
+    cpu->thread->pc = taken ? target : cpu->thread->pc + 4;
+    return TRUE;
+}
+
+/* Runs the detailed model until count more instructions have retired.
+ * Returns FALSE once the program has ended */
+int
+run_detailed(APEX_CPU *cpu, int count)
+{
+    int target = cpu->insn_completed + count;
+    while (cpu->insn_completed < target)
+    {
+        if (APEX_cpu_cycle(cpu))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Runs the whole program once at pass->period. Every period ends with a
+ * detailed warmup and a measured unit, after which the pipeline is drained
+ * so the next functional stretch starts from the architectural state.
+ * Returns the CPU at the end of the program, or NULL when the units
+ * cannot be stored */
+static APEX_CPU *
+run_pass(const char *filename, Sample_Pass *pass)
+{
+    APEX_CPU *cpu = APEX_cpu_init(filename);
+    if (!cpu)
+    {
+        return NULL;
+    }
+    int capacity = 16;
+    pass->cpi = malloc(capacity * sizeof(double));
+    if (!pass->cpi)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory before the first unit\n");
+        APEX_cpu_stop(cpu);
+        return NULL;
+    }
+
+    int running = TRUE;
+    while (running)
+    {
+        for (int i = SAMPLE_WARMUP + SAMPLE_UNIT; i < pass->period && running; i++)
+        {
+            running = functional_step(cpu);
+            pass->functional_insns++;
+        }
+        if (!running)
+        {
+            break;
+        }
+
+        APEX_cpu_resume(cpu);
+        int clock = cpu->clock;
+        int insns = cpu->insn_completed;
+        running = run_detailed(cpu, SAMPLE_WARMUP);
+        if (running)
+        {
+            int unit_clock = cpu->clock;
+            int unit_insns = cpu->insn_completed;
+            running = run_detailed(cpu, SAMPLE_UNIT);
+            if (running)
+            {
+                if (pass->samples == capacity)
+                {
+                    double *cpi = realloc(pass->cpi, 2 * capacity * sizeof(double));
+                    if (!cpi)
+                    {
+                        fprintf(stderr, "APEX_Error: Out of memory after %d units\n", pass->samples);
+                        free(pass->cpi);
+                        pass->cpi = NULL;
+                        APEX_cpu_stop(cpu);
+                        return NULL;
+                    }
+                    pass->cpi = cpi;
+                    capacity *= 2;
+                }
+                pass->cpi[pass->samples++] = (double)(cpu->clock - unit_clock) / (cpu->insn_completed - unit_insns);
+                running = !APEX_cpu_drain(cpu);
+            }
+        }
+        pass->detailed_cycles += cpu->clock - clock;
+        pass->detailed_insns += cpu->insn_completed - insns;
+    }
+    return cpu;
+}
+
+/* Mean CPI of the units and the half width of its confidence interval.
+ * Returns FALSE when there are too few units for an interval */
+static int
+get_cpi_interval(const Sample_Pass *pass, double *mean, double *half_width)
+{
+    double sum = 0;
+    double squares = 0;
+
+    for (int i = 0; i < pass->samples; i++)
+    {
+        sum += pass->cpi[i];
+    }
+    *mean = pass->samples ? sum / pass->samples : 0;
+    *half_width = 0;
+    if (pass->samples < 2)
+    {
+        return FALSE;
+    }
+    for (int i = 0; i < pass->samples; i++)
+    {
+        squares += (pass->cpi[i] - *mean) * (pass->cpi[i] - *mean);
+    }
+    *half_width = SAMPLE_Z * sqrt(squares / (pass->samples - 1) / pass->samples);
+    return TRUE;
+}
+
+/* Period giving enough units for the target error at the spread seen, the
+ * units needed grow with the square of the coefficient of variation. Always
+ * shorter than the last period, but no shorter than SAMPLE_MIN_PERIOD */
+static int
+get_next_period(const Sample_Pass *pass, int has_interval, double mean, double half_width)
+{
+    int shortest = SAMPLE_MIN_PERIOD;
+    int period = pass->period / 2;
+
+    if (has_interval && mean > 0)
+    {
+        double cv = half_width * sqrt(pass->samples) / SAMPLE_Z / mean;
+        double needed = ceil(pow(SAMPLE_Z * cv / SAMPLE_TARGET_ERROR, 2));
+        double length = pass->functional_insns + pass->detailed_insns;
+        if (needed > 0 && length / needed < period)
+        {
+            period = length / needed;
+        }
+    }
+    return period < shortest ? shortest : period;
+}
+
+/*
+ * Sampled simulation of the program in filename. Passes are repeated at a
+ * shorter period until the CPI is known to SAMPLE_TARGET_ERROR. Once the
+ * passes run out or the period cannot get any shorter the interval reached
+ * is reported as it is. The register file is printed from the last pass
+ */
+int
+APEX_sample_run(const char *filename)
+{
+    Sample_Pass pass;
+    APEX_CPU *cpu = NULL;
+    double mean = 0;
+    double half_width = 0;
+    int period = SAMPLE_PERIOD;
+    int met = FALSE;
+    int passes = 0;
+
+    while (passes < SAMPLE_MAX_PASSES)
+    {
+        if (cpu)
+        {
+            APEX_cpu_stop(cpu);
+            free(pass.cpi);
+        }
+        memset(&pass, 0, sizeof(pass));
+        pass.period = period;
+        cpu = run_pass(filename, &pass);
+        if (!cpu)
+        {
+            return FALSE;
+        }
+        passes++;
+        int has_interval = get_cpi_interval(&pass, &mean, &half_width);
+        printf("Sample pass %d: period = %d units = %d CPI = %.3f +/- %.3f\n", passes, pass.period, pass.samples,
+               mean, half_width);
+        met = has_interval && half_width <= SAMPLE_TARGET_ERROR * mean;
+        if (met)
+        {
+            break;
+        }
+        period = get_next_period(&pass, has_interval, mean, half_width);
+        if (period >= pass.period)
+        {
+            break;
+        }
+    }
+
+    long insns = pass.functional_insns + pass.detailed_insns;
+    printf("APEX_CPU: Sampled Simulation Complete, instructions = %ld functional = %ld detailed = %ld detailed cycles = %ld\n",
+           insns, pass.functional_insns, pass.detailed_insns, pass.detailed_cycles);
+    if (pass.samples)
+    {
+        printf("Sample: units = %d of %d instructions every %d, estimated cycles = %.0f\n", pass.samples, SAMPLE_UNIT,
+               pass.period, mean * insns);
+    }
+    if (pass.samples > 1)
+    {
+        printf("Sample: CPI = %.3f +/- %.3f IPC = %.3f [%.3f, %.3f] at %.1f%% confidence\n", mean, half_width,
+               1 / mean, 1 / (mean + half_width), mean > half_width ? 1 / (mean - half_width) : 0.0,
+               erf(SAMPLE_Z / sqrt(2)) * 100);
+        printf("Sample: error = %.2f%% target = %.2f%%", mean ? 100 * half_width / mean : 0.0,
+               100 * SAMPLE_TARGET_ERROR);
+        if (met)
+        {
+            printf("\n");
+        }
+        else
+        {
+            printf(" missed after %d passes, the interval above is the one reached\n", passes);
+        }
+    }
+    else if (pass.samples)
+    {
+        printf("Sample: CPI = %.3f from a single unit, too few for a confidence interval\n", mean);
+    }
+    else
+    {
+        printf("Sample: program shorter than one period, no units measured\n");
+    }
+    print_reg_file(cpu);
+    APEX_cpu_stop(cpu);
+    free(pass.cpi);
+    return TRUE;
+}
@@ -0,0 +1,31 @@
+/*
+ * apex_sample.h
+ * Contains the sampled simulation declarations
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_SAMPLE_H_
+#define _APEX_SAMPLE_H_
+
+#include "apex_macros.h"
+#include "apex_cpu.h"
+
+/* One run of the program at a sampling period. Between the measured units
+ * the program is executed functionally, only warming the caches and
+ * predictors the detailed model reads */
+typedef struct Sample_Pass
+{
+    int period;
+    int samples;
+    double *cpi;              /* CPI of each measured unit */
+    long functional_insns;
+    long detailed_insns;      /* Warmup, measurement and drain */
+    long detailed_cycles;
+} Sample_Pass;
+
+int APEX_sample_run(const char *filename);
+int functional_step(APEX_CPU *cpu);
+int run_detailed(APEX_CPU *cpu, int count);
+#endif
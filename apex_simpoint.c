@@ -0,0 +1,401 @@
+/*
+ * apex_simpoint.c
+ * Contains the basic block vector profiling, the clustering of its
+ * intervals into phases and the simulation of one interval per phase
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_simpoint.h"
+#include "apex_sample.h"
+#include "apex_macros.h"
+
+static double
+get_distance(const double *a, const double *b)
+{
+    double distance = 0;
+    for (int d = 0; d < BBV_DIMENSIONS; d++)
+    {
+        distance += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return distance;
+}
+
+/* Projects the vector of every interval, as fractions of its instructions,
+ * onto BBV_DIMENSIONS random directions. The directions come from a fixed
+ * seed, so a profile always clusters the same way */
+static double *
+project_vectors(const BBV_Profile *bbv)
+{
+    double *matrix = malloc(bbv->blocks * BBV_DIMENSIONS * sizeof(double));
+    double *points = calloc(bbv->intervals * BBV_DIMENSIONS, sizeof(double));
+    unsigned int state = 0x2545f491;
+
+    for (int i = 0; i < bbv->blocks * BBV_DIMENSIONS; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        matrix[i] = (double)state / 0xffffffffu * 2 - 1;
+    }
+    for (int i = 0; i < bbv->intervals; i++)
+    {
+        for (int b = 0; b < bbv->blocks; b++)
+        {
+            int count = bbv->vectors[i * bbv->blocks + b];
+            for (int d = 0; d < BBV_DIMENSIONS && count; d++)
+            {
+                points[i * BBV_DIMENSIONS + d] += (double)count / BBV_INTERVAL * matrix[b * BBV_DIMENSIONS + d];
+            }
+        }
+    }
+    free(matrix);
+    return points;
+}
+
+/* k-means over n points. The first center is the first interval and each
+ * next one the point farthest from the centers so far. Returns the sum of
+ * the squared distances of the points to their centers */
+static double
+cluster_points(const double *points, int n, int k, int *cluster, double *centers)
+{
+    double *nearest = malloc(n * sizeof(double));
+    int *members = malloc(k * sizeof(int));
+    double distortion = 0;
+
+    memcpy(centers, points, BBV_DIMENSIONS * sizeof(double));
+    for (int i = 0; i < n; i++)
+    {
+        nearest[i] = get_distance(&points[i * BBV_DIMENSIONS], centers);
+        cluster[i] = -1;
+    }
+    for (int c = 1; c < k; c++)
+    {
+        int farthest = 0;
+        for (int i = 1; i < n; i++)
+        {
+            if (nearest[i] > nearest[farthest])
+            {
+                farthest = i;
+            }
+        }
+        memcpy(&centers[c * BBV_DIMENSIONS], &points[farthest * BBV_DIMENSIONS], BBV_DIMENSIONS * sizeof(double));
+        for (int i = 0; i < n; i++)
+        {
+            double distance = get_distance(&points[i * BBV_DIMENSIONS], &centers[c * BBV_DIMENSIONS]);
+            if (distance < nearest[i])
+            {
+                nearest[i] = distance;
+            }
+        }
+    }
+
+    for (int iteration = 0; iteration < BBV_KMEANS_ITERATIONS; iteration++)
+    {
+        int changed = FALSE;
+        for (int i = 0; i < n; i++)
+        {
+            int best = 0;
+            for (int c = 1; c < k; c++)
+            {
+                if (get_distance(&points[i * BBV_DIMENSIONS], &centers[c * BBV_DIMENSIONS]) <
+                    get_distance(&points[i * BBV_DIMENSIONS], &centers[best * BBV_DIMENSIONS]))
+                {
+                    best = c;
+                }
+            }
+            if (cluster[i] != best)
+            {
+                cluster[i] = best;
+                changed = TRUE;
+            }
+        }
+        if (!changed)
+        {
+            break;
+        }
+
+        /* A center left without points stays where it was */
+        memset(members, 0, k * sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            if (!members[cluster[i]]++)
+            {
+                memset(&centers[cluster[i] * BBV_DIMENSIONS], 0, BBV_DIMENSIONS * sizeof(double));
+            }
+            for (int d = 0; d < BBV_DIMENSIONS; d++)
+            {
+                centers[cluster[i] * BBV_DIMENSIONS + d] += points[i * BBV_DIMENSIONS + d];
+            }
+        }
+        for (int c = 0; c < k; c++)
+        {
+            for (int d = 0; d < BBV_DIMENSIONS && members[c]; d++)
+            {
+                centers[c * BBV_DIMENSIONS + d] /= members[c];
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        distortion += get_distance(&points[i * BBV_DIMENSIONS], &centers[cluster[i] * BBV_DIMENSIONS]);
+    }
+    free(nearest);
+    free(members);
+    return distortion;
+}
+
+static int
+compare_simpoints(const void *a, const void *b)
+{
+    return ((const Sim_Point *)a)->interval - ((const Sim_Point *)b)->interval;
+}
+
+/* Clusters the intervals of the profile into phases and picks the interval
+ * closest to the center of each, in program order. Returns the number of
+ * points */
+static int
+choose_simpoints(const BBV_Profile *bbv, Sim_Point *simpoints)
+{
+    int n = bbv->intervals;
+    int max_k = n < BBV_MAX_K ? n : BBV_MAX_K;
+    double *points = project_vectors(bbv);
+    int *clusters = malloc(max_k * n * sizeof(int));
+    double *centers = malloc(max_k * max_k * BBV_DIMENSIONS * sizeof(double));
+    double distortion[BBV_MAX_K + 1];
+    int count = 0;
+
+    for (int k = 1; k <= max_k; k++)
+    {
+        distortion[k] = cluster_points(points, n, k, &clusters[(k - 1) * n], &centers[(k - 1) * max_k * BBV_DIMENSIONS]);
+    }
+    int k = 1;
+    while (k < max_k && distortion[1] - distortion[k] < BBV_SCORE * (distortion[1] - distortion[max_k]))
+    {
+        k++;
+    }
+
+    const int *cluster = &clusters[(k - 1) * n];
+    const double *center = &centers[(k - 1) * max_k * BBV_DIMENSIONS];
+    for (int c = 0; c < k; c++)
+    {
+        int closest = -1;
+        int members = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (cluster[i] != c)
+            {
+                continue;
+            }
+            members++;
+            if (closest == -1 || get_distance(&points[i * BBV_DIMENSIONS], &center[c * BBV_DIMENSIONS]) <
+                                     get_distance(&points[closest * BBV_DIMENSIONS], &center[c * BBV_DIMENSIONS]))
+            {
+                closest = i;
+            }
+        }
+        if (members)
+        {
+            simpoints[count].interval = closest;
+            simpoints[count].weight = (double)members / n;
+            count++;
+        }
+    }
+    qsort(simpoints, count, sizeof(Sim_Point), compare_simpoints);
+
+    free(points);
+    free(clusters);
+    free(centers);
+    return count;
+}
+
+/*
+ * Runs the program in detail recording its basic block vectors, and writes
+ * the simulation points chosen from them to points_file
+ */
+int
+APEX_simpoint_profile(APEX_CPU *cpu, const char *points_file)
+{
+    Sim_Point simpoints[BBV_MAX_K];
+    BBV_Profile *bbv = createBBVProfile(cpu);
+    if (!bbv)
+    {
+        return FALSE;
+    }
+    cpu->bbv = bbv;
+    APEX_cpu_run(cpu);
+    cpu->bbv = NULL;
+
+    if (bbv->failed)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory after %d profiled intervals\n", bbv->intervals);
+        freeBBVProfile(bbv);
+        return FALSE;
+    }
+    if (!bbv->intervals)
+    {
+        fprintf(stderr, "APEX_Error: Program is shorter than one interval of %d instructions\n", BBV_INTERVAL);
+        freeBBVProfile(bbv);
+        return FALSE;
+    }
+    int count = choose_simpoints(bbv, simpoints);
+
+    FILE *fp = fopen(points_file, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write %s\n", points_file);
+        freeBBVProfile(bbv);
+        return FALSE;
+    }
+    fprintf(fp, "interval %d\n", BBV_INTERVAL);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(fp, "point %d %f\n", simpoints[i].interval, simpoints[i].weight);
+    }
+    fclose(fp);
+
+    /* The profiling run knows every interval's CPI, so it can tell how
+     * close the points come */
+    long cycles = 0;
+    double estimate = 0;
+    for (int i = 0; i < bbv->intervals; i++)
+    {
+        cycles += bbv->cycles[i];
+    }
+    printf("SimPoint: intervals = %d of %d instructions, phases = %d\n", bbv->intervals, BBV_INTERVAL, count);
+    for (int i = 0; i < count; i++)
+    {
+        double cpi = (double)bbv->cycles[simpoints[i].interval] / BBV_INTERVAL;
+        printf("SimPoint: point = interval %d weight = %.3f CPI = %.3f\n", simpoints[i].interval, simpoints[i].weight,
+               cpi);
+        estimate += simpoints[i].weight * cpi;
+    }
+    printf("SimPoint: profiled CPI = %.3f estimated from the points = %.3f\n",
+           (double)cycles / ((long)bbv->intervals * BBV_INTERVAL), estimate);
+    freeBBVProfile(bbv);
+    return TRUE;
+}
+
+/* Reads the interval length and points written by a profiling run. Returns
+ * the number of points */
+static int
+read_simpoints(const char *points_file, int *interval, Sim_Point *simpoints)
+{
+    int count = 0;
+    FILE *fp = fopen(points_file, "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    if (fscanf(fp, " interval %d", interval) == 1 && *interval > 0)
+    {
+        while (count < BBV_MAX_K &&
+               fscanf(fp, " point %d %lf", &simpoints[count].interval, &simpoints[count].weight) == 2)
+        {
+            count++;
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+/*
+ * Simulates only the points in points_file in detail, each after BBV_WARMUP
+ * detailed instructions, and executes the rest of the program functionally.
+ * The CPI of the program is the weighted CPI of the points
+ */
+int
+APEX_simpoint_run(const char *filename, const char *points_file)
+{
+    Sim_Point simpoints[BBV_MAX_K];
+    double cpi[BBV_MAX_K];
+    int interval;
+    int count = read_simpoints(points_file, &interval, simpoints);
+    if (!count)
+    {
+        fprintf(stderr, "APEX_Error: No simulation points in %s\n", points_file);
+        return FALSE;
+    }
+    APEX_CPU *cpu = APEX_cpu_init(filename);
+    if (!cpu)
+    {
+        return FALSE;
+    }
+
+    long functional = 0;
+    long cycles = 0;
+    int measured = 0;
+    int running = TRUE;
+    while (running && measured < count)
+    {
+        long start = (long)simpoints[measured].interval * interval;
+        while (running && functional + cpu->insn_completed < start - BBV_WARMUP)
+        {
+            running = functional_step(cpu);
+            functional++;
+        }
+        if (!running)
+        {
+            break;
+        }
+
+        /* Points closer together than the warmup go straight on */
+        APEX_cpu_resume(cpu);
+        int clock = cpu->clock;
+        long position = functional + cpu->insn_completed;
+        if (position < start)
+        {
+            running = run_detailed(cpu, start - position);
+        }
+        if (running)
+        {
+            int unit_clock = cpu->clock;
+            int unit_insns = cpu->insn_completed;
+            running = run_detailed(cpu, interval);
+            if (running)
+            {
+                cpi[measured++] = (double)(cpu->clock - unit_clock) / (cpu->insn_completed - unit_insns);
+                running = !APEX_cpu_drain(cpu);
+            }
+        }
+        cycles += cpu->clock - clock;
+    }
+    while (running)
+    {
+        running = functional_step(cpu);
+        functional++;
+    }
+
+    /* Points past the end of the program leave their weight to the others */
+    long insns = functional + cpu->insn_completed;
+    double weights = 0;
+    double estimate = 0;
+    printf("APEX_CPU: Simulation Points Complete, instructions = %ld functional = %ld detailed = %d detailed cycles = %ld\n",
+           insns, functional, cpu->insn_completed, cycles);
+    for (int i = 0; i < measured; i++)
+    {
+        printf("SimPoint: point = interval %d weight = %.3f CPI = %.3f\n", simpoints[i].interval, simpoints[i].weight,
+               cpi[i]);
+        weights += simpoints[i].weight;
+        estimate += simpoints[i].weight * cpi[i];
+    }
+    if (weights > 0)
+    {
+        estimate /= weights;
+        printf("SimPoint: weighted CPI = %.3f IPC = %.3f estimated cycles = %.0f\n", estimate, 1 / estimate,
+               estimate * insns);
+    }
+    else
+    {
+        printf("SimPoint: no point was reached before the program ended\n");
+    }
+    print_reg_file(cpu);
+    APEX_cpu_stop(cpu);
+    return TRUE;
+}
@@ -0,0 +1,25 @@
+/*
+ * apex_simpoint.h
+ * Contains the basic block vector profiling and simulation point declarations
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_SIMPOINT_H_
+#define _APEX_SIMPOINT_H_
+
+#include "apex_macros.h"
+#include "apex_cpu.h"
+
+/* An interval standing for a phase of the program, weighted by the share of
+ * the intervals in its cluster */
+typedef struct Sim_Point
+{
+    int interval;
+    double weight;
+} Sim_Point;
+
+int APEX_simpoint_profile(APEX_CPU *cpu, const char *points_file);
+int APEX_simpoint_run(const char *filename, const char *points_file);
+#endif
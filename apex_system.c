@@ -0,0 +1,176 @@
+/*
+ * apex_system.c
+ * Contains the multi-core APEX system, cores sharing data memory through
+ * coherent private caches
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "apex_system.h"
+#include "apex_macros.h"
+
+typedef struct Core_Thread
+{
+    APEX_System *sys;
+    int core;
+} Core_Thread;
+
+APEX_System *
+APEX_system_init(const char *filenames[], int count)
+{
+    APEX_System *sys;
+    if (count < 1 || count > MAX_CORES)
+    {
+        return NULL;
+    }
+
+    sys = calloc(1, sizeof(APEX_System));
+    if (!sys)
+    {
+        return NULL;
+    }
+    sys->data_memory = createDataMemory();
+    sys->memory.latency = MEM_LATENCY;
+    if (!sys->data_memory ||
+        !initCache(&sys->l2, "L2", L2_SIZE, L2_ASSOC, L2_LINE_SIZE, L2_HIT_LATENCY,
+                   L2_REPLACEMENT, L2_WRITE_BACK, L2_WRITE_ALLOCATE, NULL, &sys->memory))
+    {
+        freeDataMemory(sys->data_memory);
+        free(sys);
+        return NULL;
+    }
+    pthread_mutex_init(&sys->bus_lock, NULL);
+    pthread_mutex_init(&sys->quantum_lock, NULL);
+    pthread_cond_init(&sys->quantum_end, NULL);
+    sys->quantum = CORE_QUANTUM;
+
+    for (int i = 0; i < count; i++)
+    {
+        APEX_CPU *cpu = APEX_cpu_init(filenames[i]);
+        if (!cpu)
+        {
+            APEX_system_stop(sys);
+            return NULL;
+        }
+        /* The core's own memory and L2 go unused, its L1s are backed by
+         * the shared ones instead */
+        freeDataMemory(cpu->data_memory);
+        cpu->data_memory = sys->data_memory;
+        cpu->core_id = i;
+        cpu->bus_lock = &sys->bus_lock;
+        cpu->l1i.next = &sys->l2;
+        cpu->l1d.next = &sys->l2;
+        cpu->l1d.peers = sys->l1d;
+        cpu->l1d.num_peers = count;
+        sys->l1d[i] = &cpu->l1d;
+        sys->cores[i] = cpu;
+        sys->num_cores++;
+    }
+    return sys;
+}
+
+/* Waits for every thread to finish the current quantum. Returns TRUE once
+ * all cores have halted */
+static int
+wait_quantum(APEX_System *sys, int halted)
+{
+    pthread_mutex_lock(&sys->quantum_lock);
+    int generation = sys->generation;
+    sys->cores_done += halted;
+    if (++sys->arrived == sys->num_cores)
+    {
+        sys->all_done = sys->cores_done == sys->num_cores;
+        sys->arrived = 0;
+        sys->generation++;
+        pthread_cond_broadcast(&sys->quantum_end);
+    }
+    else
+    {
+        while (generation == sys->generation)
+        {
+            pthread_cond_wait(&sys->quantum_end, &sys->quantum_lock);
+        }
+    }
+    int all_done = sys->all_done;
+    pthread_mutex_unlock(&sys->quantum_lock);
+    return all_done;
+}
+
+/* Steps one core a quantum at a time. A halted core keeps taking part in
+ * the synchronisation until the others are done */
+static void *
+run_core(void *arg)
+{
+    Core_Thread *thread = arg;
+    APEX_System *sys = thread->sys;
+    APEX_CPU *cpu = sys->cores[thread->core];
+    int *status = &sys->status[thread->core];
+
+    while (TRUE)
+    {
+        int halted = FALSE;
+        for (int i = 0; i < sys->quantum && !*status; i++)
+        {
+            *status = APEX_cpu_cycle(cpu);
+            halted = *status != 0;
+        }
+        if (wait_quantum(sys, halted))
+        {
+            return NULL;
+        }
+    }
+}
+
+void
+APEX_system_run(APEX_System *sys)
+{
+    pthread_t threads[MAX_CORES];
+    Core_Thread args[MAX_CORES];
+
+    for (int i = 0; i < sys->num_cores; i++)
+    {
+        args[i].sys = sys;
+        args[i].core = i;
+        pthread_create(&threads[i], NULL, run_core, &args[i]);
+    }
+    for (int i = 0; i < sys->num_cores; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < sys->num_cores; i++)
+    {
+        APEX_CPU *cpu = sys->cores[i];
+        printf("\n==========\nCore %d\n==========\n", i);
+        printf("APEX_CPU: Simulation %s, cycles = %d instructions = %d\n",
+               sys->status[i] == 1 ? "Complete" : "Stopped", cpu->clock, cpu->insn_completed);
+        print_reg_file(cpu);
+        print_stats(cpu);
+    }
+    printf("\n----------\n%s\n----------\n", "Shared memory:");
+    printf("Cores = %d quantum = %d cycles\n", sys->num_cores, sys->quantum);
+    printCacheStats(&sys->l2);
+    printf("MEM : reads = %d writes = %d latency = %d pages = %d\n", sys->memory.reads, sys->memory.writes,
+           sys->memory.latency, sys->data_memory->pages);
+}
+
+void
+APEX_system_stop(APEX_System *sys)
+{
+    for (int i = 0; i < sys->num_cores; i++)
+    {
+        sys->cores[i]->data_memory = NULL;
+        APEX_cpu_stop(sys->cores[i]);
+    }
+    freeCache(&sys->l2);
+    freeDataMemory(sys->data_memory);
+    pthread_cond_destroy(&sys->quantum_end);
+    pthread_mutex_destroy(&sys->quantum_lock);
+    pthread_mutex_destroy(&sys->bus_lock);
+    free(sys);
+}
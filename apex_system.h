@@ -0,0 +1,45 @@
+/*
+ * apex_system.h
+ * Contains the multi-core APEX system declarations
+ *
+ * Author:
+ * Copyright (c) 2022, Ashwin Kandheri Jayaraman (akandhe1@binghamton.edu), Srinidhi Sasidharan (ssasidh1@binghamton.edu)
+ * State University of New York at Binghamton
+ */
+#ifndef _APEX_SYSTEM_H_
+#define _APEX_SYSTEM_H_
+
+#include <pthread.h>
+
+#include "apex_macros.h"
+#include "apex_cache.h"
+#include "apex_cpu.h"
+
+/* Several cores, each running its own program, sharing one data memory and
+ * L2. The private L1Ds snoop each other over a bus serialized by bus_lock.
+ * Every core runs on its own host thread and the threads meet after each
+ * quantum of cycles, so no core runs more than a quantum ahead of another */
+typedef struct APEX_System
+{
+    int num_cores;
+    APEX_CPU *cores[MAX_CORES];
+    int status[MAX_CORES];      /* APEX_cpu_cycle result that ended each core */
+    Cache *l1d[MAX_CORES];      /* Snoop domain shared by every L1D */
+    Data_Memory *data_memory;
+    Cache l2;
+    Main_Memory memory;
+    pthread_mutex_t bus_lock;
+
+    int quantum;
+    pthread_mutex_t quantum_lock;
+    pthread_cond_t quantum_end;
+    int arrived;                /* Threads done with the current quantum */
+    int generation;             /* Quanta completed */
+    int cores_done;
+    int all_done;
+} APEX_System;
+
+APEX_System *APEX_system_init(const char *filenames[], int count);
+void APEX_system_run(APEX_System *sys);
+void APEX_system_stop(APEX_System *sys);
+#endif
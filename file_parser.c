@@ -128,6 +128,16 @@ set_opcode_str(const char *opcode_str)
         return OPCODE_JUMP;
     }
 
+    if (strcmp(opcode_str, "JAL") == 0)
+    {
+        return OPCODE_JAL;
+    }
+
+    if (strcmp(opcode_str, "RET") == 0)
+    {
+        return OPCODE_RET;
+    }
+
     if (strcmp(opcode_str, "HALT") == 0)
     {
         return OPCODE_HALT;
@@ -140,11 +150,35 @@ set_opcode_str(const char *opcode_str)
     {
         return OPCODE_NOP;
     }
+    if (strcmp(opcode_str, "FADD") == 0)
+    {
+        return OPCODE_FADD;
+    }
+    if (strcmp(opcode_str, "FENCE") == 0)
+    {
+        return OPCODE_FENCE;
+    }
 
     assert(0 && "Invalid opcode");
     return 0;
 }
 
+/*
+ * This function returns the string value of a numeric opcode, the reverse of
+ * set_opcode_str
+ */
+static const char *
+get_opcode_str(int opcode)
+{
+    static const char *opcode_strs[] = {
+        "ADD", "SUB", "MUL", "DIV", "AND", "OR", "EXOR", "MOVC",
+        "LOAD", "STORE", "BZ", "BNZ", "HALT", "LDR", "STR", "JUMP",
+        "NOP", "ADDL", "SUBL", "CMP", "JAL", "RET", "FADD", "FENCE"};
+
+    assert(opcode >= 0 && opcode <= OPCODE_FENCE);
+    return opcode_strs[opcode];
+}
+
 static void
 split_opcode_from_insn_string(char *buffer, char tokens[2][128])
 {
@@ -208,6 +242,7 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
         case OPCODE_XOR:
         case OPCODE_LDR:
         case OPCODE_CMP:
+        case OPCODE_FADD:
         {
             ins->rd = get_num_from_string(tokens[0]);
             ins->rs1 = get_num_from_string(tokens[1]);
@@ -225,6 +260,7 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
         case OPCODE_LOAD:
         case OPCODE_ADDL:
         case OPCODE_SUBL:
+        case OPCODE_JAL:
         {
             ins->rd = get_num_from_string(tokens[0]);
             ins->rs1 = get_num_from_string(tokens[1]);
@@ -258,6 +294,12 @@ create_APEX_instruction(APEX_Instruction *ins, char *buffer)
             ins->imm = get_num_from_string(tokens[1]);
             break;
         }
+        case OPCODE_RET:
+        {
+            ins->rs1 = get_num_from_string(tokens[0]);
+            ins->imm = 0;
+            break;
+        }
         
         default:
         {
@@ -7,9 +7,21 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "apex_cpu.c"
 #include "apex_cpu.h"
+#include "apex_system.c"
+#include "apex_sample.c"
+#include "apex_simpoint.c"
+
+static void
+print_usage(const char *name)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [--select=<policy>] [--fetch=<policy>] [--sample | --profile=<file> | "
+                    "--simpoints=<file>] <input_file> | --thread=<file>... | --core=<file>...\n",
+            name);
+}
 
 int
 main(int argc, char const *argv[])
@@ -18,20 +30,157 @@ main(int argc, char const *argv[])
 
     //fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    // if (argc != 2)
-    // {
-    //     fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
-    //     exit(1);
-    // }
+    /* --select=<name> picks the issue select policy for this run, each
+     * --core=<file> adds a core running that program to a multi-core run.
+     * Each --thread=<file>, or a plain <file>, adds a hardware thread
+     * running that program to the core, --fetch=<name> picks the policy
+     * sharing its front end. --sample measures the program in sampled
+     * units instead of running all of it in detail. --profile=<file>
+     * writes the simulation points of the program to file,
+     * --simpoints=<file> simulates only those */
+    int select_policy = ISSUE_SELECT_POLICY;
+    int fetch_policy = FETCH_POLICY;
+    const char *core_files[MAX_CORES];
+    int num_cores = 0;
+    const char *thread_files[SMT_THREADS];
+    int num_threads = 0;
+    int sample = FALSE;
+    const char *profile_file = NULL;
+    const char *simpoints_file = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--select=", 9) == 0)
+        {
+            select_policy = getSelectPolicy(argv[i] + 9);
+            if (select_policy == -1)
+            {
+                fprintf(stderr, "APEX_Error: Unknown select policy %s\n", argv[i] + 9);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--core=", 7) == 0)
+        {
+            if (num_cores == MAX_CORES)
+            {
+                fprintf(stderr, "APEX_Error: At most %d cores\n", MAX_CORES);
+                exit(1);
+            }
+            core_files[num_cores++] = argv[i] + 7;
+        }
+        else if (strncmp(argv[i], "--fetch=", 8) == 0)
+        {
+            fetch_policy = getFetchPolicy(argv[i] + 8);
+            if (fetch_policy == -1)
+            {
+                fprintf(stderr, "APEX_Error: Unknown fetch policy %s\n", argv[i] + 8);
+                exit(1);
+            }
+        }
+        else if (strncmp(argv[i], "--thread=", 9) == 0 || argv[i][0] != '-')
+        {
+            int is_option = strncmp(argv[i], "--thread=", 9) == 0;
+            if (num_threads == SMT_THREADS)
+            {
+                fprintf(stderr, "APEX_Error: At most %d threads\n", SMT_THREADS);
+                exit(1);
+            }
+            thread_files[num_threads++] = is_option ? argv[i] + 9 : argv[i];
+        }
+        else if (strcmp(argv[i], "--sample") == 0)
+        {
+            sample = TRUE;
+        }
+        else if (strncmp(argv[i], "--profile=", 10) == 0)
+        {
+            profile_file = argv[i] + 10;
+        }
+        else if (strncmp(argv[i], "--simpoints=", 12) == 0)
+        {
+            simpoints_file = argv[i] + 12;
+        }
+        else
+        {
+            fprintf(stderr, "APEX_Error: Unknown option %s\n", argv[i]);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (!num_cores && !num_threads)
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    if ((sample || profile_file || simpoints_file) && (num_cores || num_threads > 1))
+    {
+        fprintf(stderr, "APEX_Error: Sampling needs a single core and thread\n");
+        exit(1);
+    }
 
-    //cpu = APEX_cpu_init(argv[1]);
-    cpu = APEX_cpu_init("/Users/ash/Downloads/binghamton/CAO/finalProject/apex_core/input.asm");
+    if (num_cores)
+    {
+        APEX_System *sys = APEX_system_init(core_files, num_cores);
+        if (!sys)
+        {
+            fprintf(stderr, "APEX_Error: Unable to initialize the cores\n");
+            exit(1);
+        }
+        for (int i = 0; i < num_cores; i++)
+        {
+            sys->cores[i]->select_policy = select_policy;
+        }
+        APEX_system_run(sys);
+        APEX_system_stop(sys);
+        return 0;
+    }
+
+    const char *filename = thread_files[0];
+    if (sample)
+    {
+        if (!APEX_sample_run(filename))
+        {
+            fprintf(stderr, "APEX_Error: Unable to sample the program\n");
+            exit(1);
+        }
+        return 0;
+    }
+    if (simpoints_file)
+    {
+        if (!APEX_simpoint_run(filename, simpoints_file))
+        {
+            fprintf(stderr, "APEX_Error: Unable to simulate the points\n");
+            exit(1);
+        }
+        return 0;
+    }
+    cpu = APEX_cpu_init(filename);
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
+    for (int i = 1; i < num_threads; i++)
+    {
+        if (!APEX_cpu_add_thread(cpu, thread_files[i]))
+        {
+            fprintf(stderr, "APEX_Error: Unable to add thread %s\n", thread_files[i]);
+            exit(1);
+        }
+    }
+    cpu->select_policy = select_policy;
+    cpu->fetch_policy = fetch_policy;
 
+    if (profile_file)
+    {
+        if (!APEX_simpoint_profile(cpu, profile_file))
+        {
+            fprintf(stderr, "APEX_Error: Unable to profile the program\n");
+            exit(1);
+        }
+        APEX_cpu_stop(cpu);
+        return 0;
+    }
     APEX_cpu_run(cpu);
     APEX_cpu_stop(cpu);
     return 0;
@@ -0,0 +1,16 @@
+MOVC R0,#1
+MOVC R7,#2000
+MOVC R6,#3000
+MOVC R1,#1
+MOVC R2,#10
+FADD R3,R7,R1
+SUBL R2,R2,#1
+BNZ #-8
+FENCE
+FADD R3,R6,R0
+LOAD R4,R6,#0
+SUBL R4,R4,#2
+BNZ #-8
+LOAD R5,R7,#0
+MOVC R3,#0
+HALT
@@ -0,0 +1,7 @@
+MOVC R6,#2
+ADDL R7,R7,#1
+BNZ #4
+BZ #4
+SUBL R6,R6,#1
+BNZ #-16
+HALT
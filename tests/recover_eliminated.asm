@@ -0,0 +1,23 @@
+MOVC R7,#200
+MOVC R0,#0
+MOVC R1,#4
+MOVC R2,#0
+MOVC R3,#0
+MOVC R4,#0
+MOVC R5,#1
+MOVC R6,#9
+AND R0,R6,R5
+CMP R0,R0,R4
+BZ #24
+EXOR R1,R1,R1
+MOVC R2,#7
+ADDL R3,R2,#0
+STORE R3,R7,#0
+LDR R1,R7,R4
+ADD R2,R2,R1
+EXOR R0,R0,R0
+MOVC R3,#2
+ADD R4,R4,R0
+SUBL R6,R6,#1
+BNZ #-52
+HALT
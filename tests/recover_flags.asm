@@ -0,0 +1,22 @@
+MOVC R7,#300
+MOVC R0,#0
+MOVC R1,#3
+MOVC R2,#0
+MOVC R3,#0
+MOVC R4,#1
+MOVC R5,#0
+MOVC R6,#10
+AND R0,R6,R1
+CMP R0,R0,R1
+BNZ #16
+ADDL R5,R5,#1
+SUB R2,R0,R1
+BZ #8
+MUL R3,R5,R4
+LOAD R0,R7,#0
+ADD R0,R0,R5
+STORE R0,R7,#0
+CMP R0,R2,R2
+SUBL R6,R6,#1
+BNZ #-48
+HALT
@@ -0,0 +1,23 @@
+MOVC R7,#100
+MOVC R0,#0
+MOVC R1,#5
+MOVC R2,#3
+MOVC R3,#0
+MOVC R4,#0
+MOVC R5,#0
+MOVC R6,#7
+LOAD R3,R7,#3
+STORE R3,R7,#0
+ADDL R3,R3,#2
+STORE R3,R7,#3
+LOAD R4,R7,#3
+ADD R5,R5,R4
+SUB R2,R2,R2
+BZ #8
+LOAD R0,R7,#50
+STR R7,R1,R6
+LDR R1,R7,R1
+ADDL R1,R6,#0
+SUBL R6,R6,#1
+BNZ #-52
+HALT
@@ -0,0 +1,26 @@
+MOVC R7,#500
+MOVC R0,#0
+MOVC R3,#12
+STORE R0,R7,#0
+STORE R0,R7,#100
+ADDL R0,R0,#10
+ADDL R7,R7,#1
+SUBL R3,R3,#1
+BNZ #-20
+MOVC R0,#7
+MOVC R7,#508
+STORE R0,R7,#0
+STORE R0,R7,#100
+MOVC R6,#499
+MOVC R5,#600
+MOVC R2,#0
+MOVC R3,#12
+ADDL R6,R6,#1
+LOAD R1,R6,#0
+LOAD R4,R5,#0
+ADDL R5,R5,#1
+ADD R2,R2,R1
+ADD R2,R2,R4
+SUBL R3,R3,#1
+BNZ #-28
+HALT
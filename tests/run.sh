@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# run.sh
+# Runs every regression program and compares the registers it retires with
+# tests/<program>.expected. A program that does not halt in time fails. When
+# tests/<program>.thread exists it runs alongside as a second SMT thread, and
+# when tests/<program>.core exists both run as cores of a multi-core system.
+# The expected file then holds the registers of both
+#
+# Usage: tests/run.sh <simulator>
+
+SIM=${1:-./apex_sim}
+failed=0
+
+for prog in tests/*.asm input.asm
+do
+    name=$(basename "$prog" .asm)
+    threads="--thread=$prog"
+    if [ -f "tests/$name.thread" ]
+    then
+        threads="$threads --thread=tests/$name.thread"
+    elif [ -f "tests/$name.core" ]
+    then
+        threads="--core=$prog --core=tests/$name.core"
+    fi
+    regs=$(timeout 60 "$SIM" $threads 2>/dev/null | sed -n '/Simulation Complete/,$p' | grep '^R0 ')
+    if [ "$regs" = "$(cat "tests/$name.expected")" ]
+    then
+        echo "PASS $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+done
+exit $failed
@@ -0,0 +1,25 @@
+MOVC R7,#1000
+MOVC R0,#1
+MOVC R1,#19
+MOVC R2,#-2
+MOVC R3,#12
+MOVC R4,#-2
+MOVC R5,#5
+MOVC R6,#6
+STORE R3,R7,#0
+LOAD R1,R7,#2
+BZ #16
+LOAD R4,R7,#3
+ADDL R2,R3,#0
+BNZ #8
+STORE R2,R7,#2
+ADDL R7,R7,#2
+LOAD R4,R7,#6
+SUBL R7,R7,#2
+ADDL R7,R7,#2
+LOAD R5,R7,#7
+SUBL R7,R7,#2
+ADDL R2,R4,#0
+BZ #8
+SUBL R2,R2,#1
+HALT
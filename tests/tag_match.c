@@ -0,0 +1,85 @@
+/*
+ * tag_match.c
+ * Runs every tag compare the host CPU supports, not only the one
+ * initTagMatch would pick, and checks the match masks each builds
+ *
+ * Usage: tests/tag_match
+ */
+#include "../apex_cpu.c"
+#include "../apex_system.c"
+#include "../apex_sample.c"
+#include "../apex_simpoint.c"
+
+/* Spans several mask words and a partial last one */
+#define MAX_TAGS 200
+
+/* Whether mask has exactly the slots below count whose tag is tag, over
+ * all of its TAG_MASK_WORDS(count) words */
+static int
+isMaskCorrect(const int *tags, int count, int tag, const unsigned long long *mask)
+{
+    for (int i = 0; i < TAG_MASK_WORDS(count) * 64; i++)
+    {
+        if (isSlotSet(mask, i) != (i < count && tags[i] == tag))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Matches random tags for every count up to MAX_TAGS. The padding after
+ * count is random as well, so it has to be masked off */
+static int
+checkTagMatch(const char *name, void (*match)(const int *, int, int, unsigned long long *))
+{
+    int tags[TAG_SLOTS(MAX_TAGS)];
+    unsigned long long mask[TAG_MASK_WORDS(MAX_TAGS)];
+
+    srand(1);
+    for (int count = 0; count <= MAX_TAGS; count++)
+    {
+        for (int i = 0; i < TAG_SLOTS(MAX_TAGS); i++)
+        {
+            tags[i] = rand() % 8 - 1;
+        }
+        for (int tag = -1; tag < 7; tag++)
+        {
+            memset(mask, 0xff, sizeof(mask));
+            match(tags, count, tag, mask);
+            if (!isMaskCorrect(tags, count, tag, mask))
+            {
+                printf("FAIL tag_match %s count = %d tag = %d\n", name, count, tag);
+                return FALSE;
+            }
+        }
+    }
+    printf("PASS tag_match %s\n", name);
+    return TRUE;
+}
+
+int
+main(void)
+{
+    int passed = checkTagMatch("scalar", matchTagsScalar);
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        passed &= checkTagMatch("SSE2", matchTagsSSE2);
+    }
+    else
+    {
+        printf("SKIP tag_match SSE2\n");
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        passed &= checkTagMatch("AVX2", matchTagsAVX2);
+    }
+    else
+    {
+        printf("SKIP tag_match AVX2\n");
+    }
+#endif
+    return passed ? 0 : 1;
+}